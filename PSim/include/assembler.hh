@@ -13,9 +13,9 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
-#include <regex>
 #include <string.h>
 #include <map>
+#include <unordered_map>
 #include <bitset>
 
 #include "utils.hh"
@@ -23,13 +23,56 @@
 #include "opcode.h"
 #include "register.hh"
 #include "mmbar.hh"
+#include "lexer.hh"
+#include "input.hh"
+
+enum operand_kinds {
+    OPD_REG,                                // $reg
+    OPD_IMM,                                // imm
+    OPD_LABEL,                              // label, by its index in Assembler::symbols
+    OPD_ADDR,                               // offset($reg)
+};
+
+/* An operand as the encoder takes it, resolved once by the parser */
+struct Operand {
+    uint32_t kind;
+    uint32_t reg;                           // OPD_REG, and the base of OPD_ADDR
+    int32_t value;                          // OPD_IMM, the offset of OPD_ADDR, the symbol of OPD_LABEL
+};
+
+#define ASM_MAX_OPERANDS ISA_MAX_OPERANDS
+#define ASM_UNDEFINED UINT32_MAX            // word index of a symbol not defined (yet)
+
+/* A line of the text section after parsing. The encoder does not look at
+ * the source again but for its messages */
+struct AsmInstruction {
+    Span source;                            // the instruction, without label and comment
+    Span mnemonic;
+    const OpcodeDesc *desc;                 // NULL if the mnemonic is no instruction
+    uint32_t n_operands;
+    Operand operands[ASM_MAX_OPERANDS];
+};
+
+struct SpanHash {
+    size_t operator()(const Span &span) const {
+        return span_hash(span);
+    }
+};
+
+struct SpanEqual {
+    bool operator()(const Span &a, const Span &b) const {
+        return a.size == b.size && memcmp(a.data, b.data, a.size) == 0;
+    }
+};
 
 struct Assembler {
     std::string ELF_path;
-    std::vector<std::string> content;
-    std::vector<std::string> text_section;
+    InputSource source;                     // the program, the spans below point into it
+    std::vector<AsmInstruction> text;
     std::vector<uint32_t> bin;
-    std::map<std::string, uint32_t> label_map;
+    std::unordered_map<Span, uint32_t, SpanHash, SpanEqual> symbol_ids;  // label name -> symbol
+    std::vector<uint32_t> symbols;          // word index of each label referenced or defined
+    std::vector<Span> symbol_names;
     Options *user_options;
     MMBar *mmBar;
 };
@@ -40,7 +83,4 @@ void assembler_exec(Assembler *assembler);
 
 void assembler_free(Assembler *assembler);
 
-typedef std::vector<std::string> tokens_t;
-typedef std::string token_t;
-
 #endif //PARCH_ASSEMBLER_HH
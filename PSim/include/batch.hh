@@ -0,0 +1,60 @@
+/**
+ * @filename: batch.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: in-process batch runner over a manifest of jobs
+ * @date: 3/27/2021
+ */
+
+#ifndef PARCH_BATCH_HH
+#define PARCH_BATCH_HH
+
+#include <string>
+#include <vector>
+
+#include "utils.hh"
+#include "options.hh"
+
+enum job_status {
+    JOB_EXITED,                             // ran off the end of the text or called exit
+    JOB_ERROR,                              // assembling or simulation stopped on an error
+    JOB_BUDGET,                             // retired its instruction budget
+    JOB_TIMEOUT,                            // ran past its wall-clock limit
+};
+
+/* One manifest line. Paths are relative to the manifest directory unless
+ * absolute; an empty input, expected or files path stands for "-" */
+struct BatchJob {
+    std::string asm_path;
+    std::string input_path;
+    std::string expected_path;
+    std::string files_path;                 // expected --vfs files, --vfs_expect when empty
+    uint64_t budget;                        // 0 for unlimited
+    uint32_t timeout_ms;                    // 0 for unlimited
+    uint32_t image;                         // assembled program shared with other jobs
+};
+
+struct JobResult {
+    uint32_t status;
+    int exit_code;
+    uint64_t retired;
+    uint32_t pc;                            // where a JOB_BUDGET or JOB_TIMEOUT job stopped
+    double wall_ms;
+    std::string output;                     // everything the print syscalls wrote
+    std::string message;                    // why a JOB_ERROR job stopped
+    std::string files;                      // files that are missing, differ or are not expected
+    bool checked;                           // compared against an expected output or files
+    bool matched;
+};
+
+/* function: batch_exec
+ * usage: run every job of options->batch on options->jobs worker threads,
+ *        assembling each distinct program once, then report the results in
+ *        manifest order on stdout
+ * arguments:
+ *      1) options: the command line options, shared by every job
+ * return: whether every job exited and matched its expected output
+ */
+bool batch_exec(Options *options);
+
+#endif //PARCH_BATCH_HH
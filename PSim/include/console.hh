@@ -0,0 +1,80 @@
+/**
+ * @filename: console.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: buffered output channel of the print syscalls
+ * @date: 3/29/2021
+ */
+
+#ifndef PARCH_CONSOLE_HH
+#define PARCH_CONSOLE_HH
+
+#include <string>
+
+#include "utils.hh"
+
+#define CONSOLE_BUFFER_SIZE 0x10000
+
+/* Console output of a run: stdout, the --output_stdout file or a capture
+ * string. Output to a file descriptor is gathered in buffer and written when
+ * it fills up, before the guest reads stdin and when the run ends; a capture
+ * is appended to directly */
+struct Console {
+    int fd;                                 // -1 when capturing or closed
+    bool owned;                             // fd was opened by console_open
+    std::string *capture;
+    char *buffer;
+    uint32_t used;
+    uint32_t size;                          // 0 writes through, e.g. to keep a verbose log in order
+};
+
+/* function: console_open
+ * usage: open the output channel of a run. A console left open when the
+ *        process exits is flushed on the way out
+ * arguments:
+ *      1) console: channel to open
+ *      2) path: file to append to, NULL for stdout
+ *      3) capture: string to append to instead of path or stdout, or NULL
+ *      4) buffered: whether to gather output in a CONSOLE_BUFFER_SIZE buffer
+ * return: void, exit if the file cannot be opened
+ */
+void console_open(Console *console, const char *path, std::string *capture, bool buffered);
+
+/* function: console_flush
+ * usage: write out whatever the buffer holds
+ */
+void console_flush(Console *console);
+
+/* function: console_close
+ * usage: flush, then close the file if the console opened one
+ */
+void console_close(Console *console);
+
+/* function: __console_spill
+ * usage: slow path of console_write, when data does not fit the buffer
+ */
+void __console_spill(Console *console, const char *data, size_t n);
+
+static inline bool console_is_stdout(const Console *console) {
+    return console->capture || console->fd == STDOUT_FILENO;
+}
+
+static inline void console_write(Console *console, const char *data, size_t n) {
+    if (console->capture) {
+        console->capture->append(data, n);
+    } else if (console->used + n <= console->size) {
+        memcpy(console->buffer + console->used, data, n);
+        console->used += (uint32_t) n;
+    } else {
+        __console_spill(console, data, n);
+    }
+}
+
+static inline void console_putc(Console *console, char c) {
+    if (!console->capture && console->used < console->size)
+        console->buffer[console->used++] = c;
+    else
+        console_write(console, &c, 1);
+}
+
+#endif //PARCH_CONSOLE_HH
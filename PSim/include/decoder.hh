@@ -0,0 +1,79 @@
+/**
+ * @filename: decoder.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: predecoded micro-ops for the simulator's text segment
+ * @date: 3/20/2021
+ */
+
+#ifndef PARCH_DECODER_HH
+#define PARCH_DECODER_HH
+
+#include <stdint.h>
+
+#include "utils.hh"
+
+/* macro: UOP_LIST
+ * usage: enumerate every micro-op the decoder can produce, as X(KIND, name),
+ *        so that the kind enum and the handler tables are generated from one list
+ */
+#define UOP_LIST(X) \
+    X(SLL, sll) X(SRL, srl) X(SRA, sra) X(SLLV, sllv) X(SRLV, srlv) X(SRAV, srav) \
+    X(JR, jr) X(JALR, jalr) X(SYSCALL, syscall) \
+    X(MFHI, mfhi) X(MTHI, mthi) X(MFLO, mflo) X(MTLO, mtlo) \
+    X(MULT, mult) X(MULTU, multu) X(DIV, div) X(DIVU, divu) \
+    X(ADD, add) X(ADDU, addu) X(SUB, sub) X(SUBU, subu) \
+    X(AND, and) X(OR, or) X(XOR, xor) X(NOR, nor) X(SLT, slt) X(SLTU, sltu) \
+    X(TGE, tge) X(TGEU, tgeu) X(TLT, tlt) X(TLTU, tltu) X(TEQ, teq) X(TNE, tne) \
+    X(BLTZ, bltz) X(BGEZ, bgez) X(TGEI, tgei) X(TGEIU, tgeiu) X(TLTI, tlti) \
+    X(TLTIU, tltiu) X(TNEI, tnei) X(BLTZAL, bltzal) X(BGEZAL, bgezal) \
+    X(J, j) X(JAL, jal) X(BEQ, beq) X(BNE, bne) X(BLEZ, blez) X(BGTZ, bgtz) \
+    X(ADDI, addi) X(ADDIU, addiu) X(SLTI, slti) X(SLTIU, sltiu) \
+    X(ANDI, andi) X(ORI, ori) X(XORI, xori) X(LUI, lui) \
+    X(LB, lb) X(LH, lh) X(LWL, lwl) X(LW, lw) X(LBU, lbu) X(LHU, lhu) X(LWR, lwr) \
+    X(SB, sb) X(SH, sh) X(SWL, swl) X(SW, sw) X(SWR, swr) \
+    X(BAD_RBT, bad_rbt) X(BAD_FUNCT, bad_funct) X(BAD_OPCODE, bad_opcode) \
+    X(STALE, stale)
+
+#define UOP_ENUM_ENTRY(KIND, name) UOP_##KIND,
+
+enum uop_kinds {
+    UOP_LIST(UOP_ENUM_ENTRY)
+    UOP_NUM
+};
+
+#undef UOP_ENUM_ENTRY
+
+struct CPUContext;
+struct MicroOp;
+
+typedef void (*uop_handler_t)(CPUContext *cpu, const MicroOp *uop);
+
+/* A decoded instruction. imm holds whatever the handler needs pre-extracted:
+ *      - shamt for sll/srl/sra
+ *      - sign extended 16-bit immediate for arithmetic, branches, traps and l/s
+ *      - zero extended 16-bit immediate for andi/ori/xori/sltiu
+ *      - the already shifted upper half for lui
+ *      - the 26-bit word index for j/jal
+ *      - the raw instruction word for the BAD_* and STALE kinds
+ */
+struct MicroOp {
+    uop_handler_t handler;
+    int32_t imm;
+    uint8_t kind;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+};
+
+/* function: decoder_predecode
+ * usage: split a binary instruction into its micro-op kind and operands,
+ *        the handler is left to the execution engine
+ * arguments:
+ *      1) b: instruction word
+ *      2) uop: micro-op to fill
+ * return: void
+ */
+void decoder_predecode(uint32_t b, MicroOp *uop);
+
+#endif //PARCH_DECODER_HH
@@ -0,0 +1,27 @@
+/**
+ * @filename: forkserver.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: one assembled and loaded program forked once per input file
+ * @date: 3/28/2021
+ */
+
+#ifndef PARCH_FORKSERVER_HH
+#define PARCH_FORKSERVER_HH
+
+#include "utils.hh"
+
+struct Simulator;
+
+/* function: fork_server_exec
+ * usage: load the assembled program once, then fork a child per input file
+ *        listed in user_options.fork_server; the children share the loaded
+ *        guest memory copy-on-write and run up to user_options.jobs at a time.
+ *        Their stdout and exit status are reported in list order on stdout
+ * arguments:
+ *      1) simulator: simulator with the program assembled into bin
+ * return: whether every child exited with status 0
+ */
+bool fork_server_exec(Simulator *simulator);
+
+#endif //PARCH_FORKSERVER_HH
@@ -0,0 +1,87 @@
+/**
+ * @filename: input.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: line source of the read syscalls
+ * @date: 3/30/2021
+ */
+
+#ifndef PARCH_INPUT_HH
+#define PARCH_INPUT_HH
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils.hh"
+
+#define INPUT_CHUNK_SIZE 0x10000
+
+/* The lines of an input file, handed out one at a time without copying. A
+ * regular file is mapped, anything else (a pipe, /dev/stdin) is read through
+ * a window that only grows to the longest line; a buffer given by the caller
+ * is used in place. Either way memory does not follow the input size */
+struct InputSource {
+    const char *data = NULL;                // mapping, window or caller's buffer
+    size_t size = 0;                        // bytes valid in data
+    size_t pos = 0;                         // start of the next line
+    size_t mapped = 0;                      // length of the mapping, 0 if not mapped
+    int fd = -1;                            // streamed file, -1 once at its end
+    char *window = NULL;
+    size_t capacity = 0;
+};
+
+/* function: input_open
+ * usage: start reading the lines of a file
+ * arguments:
+ *      1) input: source to open, closed first if it was open
+ *      2) path: file to read
+ * return: whether the file could be opened
+ */
+bool input_open(InputSource *input, const char *path);
+
+/* function: input_open_buffer
+ * usage: read the lines of a buffer, which must outlive the source
+ */
+void input_open_buffer(InputSource *input, const char *data, size_t n);
+
+/* function: input_next_line
+ * usage: take the next line, as std::getline splits them
+ * arguments:
+ *      1) input: source
+ *      2) line: set to the line, without its newline; valid up to the next call
+ *      3) n: set to the length of the line
+ * return: false once the input is exhausted
+ */
+bool input_next_line(InputSource *input, const char **line, size_t *n);
+
+/* function: input_hold
+ * usage: keep every line valid until input_close, for a reader that goes
+ *        over the input more than once: a streamed input is read whole into
+ *        its window, a mapped file or a buffer already is
+ */
+void input_hold(InputSource *input);
+
+/* function: input_rewind
+ * usage: take the lines again from the first one, once input_hold was called
+ */
+void input_rewind(InputSource *input);
+
+void input_close(InputSource *input);
+
+/* function: input_parse_int
+ * usage: parse a line: hexadecimal if the whole line is 0x followed by hex
+ *        digits, otherwise a decimal prefix after optional whitespace and
+ *        sign, as std::stoi reads it
+ * return: false if there is no number or it does not fit 32 bits
+ */
+bool input_parse_int(const char *s, size_t n, int32_t *value);
+
+/* function: input_parse_double / input_parse_float
+ * usage: parse a line as std::stod / std::stof do
+ * return: false if there is no number or it is out of range
+ */
+bool input_parse_double(const char *s, size_t n, double *value);
+
+bool input_parse_float(const char *s, size_t n, float *value);
+
+#endif //PARCH_INPUT_HH
@@ -0,0 +1,69 @@
+/**
+ * @filename: jit.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: x86-64 translator for hot basic blocks
+ * @date: 3/24/2021
+ */
+
+#ifndef PARCH_JIT_HH
+#define PARCH_JIT_HH
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "utils.hh"
+
+#define JIT_DEFAULT_THRESHOLD 64
+#define JIT_DEFAULT_CACHE_KB 16384
+
+struct Simulator;
+struct TranslatedBlock;
+struct CPUContext;
+
+/* native block: runs on the guest CPU context and returns the guest pc at
+ * which execution continues */
+typedef uint32_t (*jit_block_fn)(CPUContext *cpu);
+
+struct JitStats {
+    uint64_t translated;                    // blocks with native code
+    uint64_t rejected;                      // hot blocks starting with an untranslatable instruction
+    uint64_t native_runs;                   // entries into native code
+    uint64_t flushes;                       // code cache dropped (full or text written)
+};
+
+struct Jit {
+    uint8_t *code;
+    uint8_t *unwind;                        // .eh_frame of the code cache, registered with the unwinder
+    size_t size;
+    size_t used;
+    uint32_t threshold;
+    bool enabled;
+    JitStats stats;
+};
+
+/* function: jit_init
+ * usage: reserve the executable code cache
+ * arguments:
+ *      1) jit: translator state
+ *      2) threshold: executions of a block before it is translated
+ *      3) cache_kb: size of the code cache in KiB
+ * return: void, jit->enabled stays false if the host cannot run translated code
+ */
+void jit_init(Jit *jit, uint32_t threshold, uint32_t cache_kb);
+
+void jit_free(Jit *jit);
+
+/* function: jit_translate
+ * usage: emit native code for the longest translatable prefix of a block
+ * return: the native entry point, or NULL if not even the first instruction
+ *         can be translated
+ */
+jit_block_fn jit_translate(Jit *jit, Simulator *simulator, TranslatedBlock *block);
+
+/* function: jit_flush
+ * usage: drop every translation, e.g. after a store into the text segment
+ */
+void jit_flush(Jit *jit, Simulator *simulator);
+
+#endif //PARCH_JIT_HH
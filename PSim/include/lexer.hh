@@ -0,0 +1,103 @@
+/**
+ * @filename: lexer.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: single-pass lexer of assembly source lines
+ * @date: 4/2/2021
+ */
+
+#ifndef PARCH_LEXER_HH
+#define PARCH_LEXER_HH
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+/* A piece of the source, pointing into a buffer it does not own (the
+ * project is C++11, there is no std::string_view) */
+struct Span {
+    const char *data;
+    uint32_t size;
+};
+
+static inline Span span_of(const char *data, uint32_t size) {
+    Span span = {data, size};
+    return span;
+}
+
+static inline bool span_eq(Span span, const char *s) {
+    return strlen(s) == span.size && memcmp(span.data, s, span.size) == 0;
+}
+
+static inline std::string span_str(Span span) {
+    return std::string(span.data, span.size);
+}
+
+/* hash() of utils.hh over a span, the string need not end with '\0' */
+static inline unsigned int span_hash(Span span) {
+    unsigned int h = 5381;
+    for (uint32_t i = span.size; i-- > 0;)
+        h = (h * 33) ^ span.data[i];
+    return h;
+}
+
+enum token_kinds {
+    TOK_MNEMONIC,                           // first word of an instruction
+    TOK_DIRECTIVE,                          // first word of the line, starting with '.'
+    TOK_REGISTER,                           // $name
+    TOK_IMMEDIATE,                          // decimal or 0x hexadecimal, optionally signed
+    TOK_ADDRESS,                            // offset($reg), the offset may be left out
+    TOK_STRING,                             // "...", escapes kept
+    TOK_SYMBOL,                             // anything else, e.g. a label reference
+};
+
+struct Token {
+    uint32_t kind;
+    Span text;                              // the whole token
+    Span reg;                               // TOK_REGISTER and TOK_ADDRESS: name without '$'
+    int32_t value;                          // TOK_IMMEDIATE, and the offset of TOK_ADDRESS
+};
+
+#define LEX_MAX_TOKENS 8
+
+/* One source line: an optional label, then a directive or an instruction and
+ * its operands. Operands are separated by spaces, tabs or commas, and a '#'
+ * outside a string starts a comment */
+struct LexLine {
+    Span label;                             // empty without a label
+    Span body;                              // what follows the label, without the comment
+    uint32_t n_tokens;
+    Token tokens[LEX_MAX_TOKENS];
+};
+
+/* function: lex_int
+ * usage: read a whole token as a 32-bit integer: decimal, or hexadecimal
+ *        after 0x, with an optional sign
+ * arguments:
+ *      1) span: the token
+ *      2) value: set to the integer, wrapped to 32 bits
+ * return: false if it is not a number or does not fit 32 bits
+ */
+bool lex_int(Span span, int32_t *value);
+
+/* function: lex_operand
+ * usage: classify an operand token
+ * arguments:
+ *      1) span: the token, without delimiters
+ *      2) token: filled with its kind, register and value
+ * return: void
+ */
+void lex_operand(Span span, Token *token);
+
+/* function: lex_line
+ * usage: split a source line into its label and classified tokens, without
+ *        copying any of it: every span points into the line
+ * arguments:
+ *      1) begin, end: the line, without its newline
+ *      2) line: filled with the result
+ * return: false if it has more than LEX_MAX_TOKENS tokens or a string is
+ *         not closed
+ */
+bool lex_line(const char *begin, const char *end, LexLine *line);
+
+#endif //PARCH_LEXER_HH
@@ -0,0 +1,238 @@
+/**
+ * @filename: log.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: deferred logging through per-thread ring buffers
+ * @date: 4/1/2021
+ */
+
+#ifndef PARCH_LOG_HH
+#define PARCH_LOG_HH
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define LOG_RING_SIZE 0x400000              // bytes per thread, a power of two
+#define LOG_IDLE_US 200                     // writer sleep when every ring is empty
+#define LOG_FULL_WAIT_US 100000             // wait of a full ring for the writer before dropping
+
+/* A logged line as it sits in a ring: the format is kept by address, so it
+ * must be a string literal, and is followed by one 8-byte slot per argument.
+ * A string argument is copied, its length slot followed by its bytes padded
+ * to 8. The writer thread formats the record long after the call */
+struct LogRecord {
+    uint32_t size;                          // bytes of the record, 0 marks the end of the ring as unused
+    uint32_t dropped;                       // records dropped right before this one
+    uint64_t clock;                         // log_clock() of the call
+    const char *format;
+};
+
+/* Records of one thread. Only that thread advances head and only the writer
+ * advances tail, so neither side takes a lock */
+struct LogRing {
+    char *data;
+    uint64_t size;
+    std::atomic<uint64_t> head;             // bytes published
+    std::atomic<uint64_t> tail;             // bytes formatted and written
+    uint64_t next;                          // owner only: head once the reserved record is committed
+    std::atomic<uint32_t> dropped;          // owner only: records dropped since the last kept one
+    std::atomic<bool> retired;              // the owner thread is gone, free once drained
+};
+
+extern thread_local LogRing *__log_this_ring;
+extern std::atomic<bool> __log_started;
+
+/* function: log_clock
+ * usage: cheap monotonic clock of the records, the writer converts it to the
+ *        get_timestamp() scale
+ */
+static inline uint64_t log_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* function: log_sync
+ * usage: format and write every pending record, before the caller prints to
+ *        stdout or stderr itself so that the output stays in order
+ */
+void __log_drain();
+
+static inline void log_sync() {
+    if (__log_started.load(std::memory_order_acquire))
+        __log_drain();
+}
+
+/* function: __log_ring_slow
+ * usage: the ring of this thread, created on its first record
+ * return: NULL if it cannot be allocated
+ */
+LogRing *__log_ring_slow();
+
+static inline uint64_t __log_need(const LogRing *ring, uint64_t n) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t off = head & (ring->size - 1);
+    return ring->size - off < n ? ring->size - off + n : n;
+}
+
+/* function: __log_full
+ * usage: slow path of __log_reserve: wait up to LOG_FULL_WAIT_US for the
+ *        writer to make room for n bytes, or drain in place if no writer
+ *        thread runs (e.g. in a forked child)
+ * return: whether there is room now
+ */
+bool __log_full(LogRing *ring, uint64_t n);
+
+static inline char *__log_reserve(LogRing *ring, uint64_t n) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t need = __log_need(ring, n);
+    if (__builtin_expect(head + need - ring->tail.load(std::memory_order_acquire) > ring->size, 0)
+        && !__log_full(ring, n)) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    uint64_t off = head & (ring->size - 1);
+    if (need != n) {
+        // the record does not fit before the end of the ring, start over
+        uint32_t end = 0;
+        memcpy(ring->data + off, &end, sizeof(end));
+        off = 0;
+    }
+    ring->next = head + need;
+    return ring->data + off;
+}
+
+static inline void __log_commit(LogRing *ring) {
+    ring->head.store(ring->next, std::memory_order_release);
+}
+
+// argument encoding, see LogRecord
+
+static inline uint64_t __log_pad(uint64_t n) {
+    return (n + 7) & ~(uint64_t) 7;
+}
+
+static inline uint64_t __log_arg_size(const char *s) {
+    return 8 + __log_pad(s ? strlen(s) : 0);
+}
+
+static inline uint64_t __log_arg_size(char *s) {
+    return __log_arg_size((const char *) s);
+}
+
+template<typename T>
+static inline uint64_t __log_arg_size(T) {
+    static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                  "log arguments are numbers, pointers or C strings");
+    return 8;
+}
+
+static inline uint64_t __log_args_size() {
+    return 0;
+}
+
+template<typename T, typename... Rest>
+static inline uint64_t __log_args_size(T arg, Rest... rest) {
+    return __log_arg_size(arg) + __log_args_size(rest...);
+}
+
+static inline char *__log_slot(char *p, uint64_t bits) {
+    memcpy(p, &bits, sizeof(bits));
+    return p + 8;
+}
+
+static inline char *__log_put(char *p, const char *s) {
+    uint64_t n = s ? strlen(s) : 0;
+    p = __log_slot(p, n);
+    memcpy(p, s, n);
+    return p + __log_pad(n);
+}
+
+static inline char *__log_put(char *p, char *s) {
+    return __log_put(p, (const char *) s);
+}
+
+template<typename T>
+static inline typename std::enable_if<std::is_floating_point<T>::value, char *>::type
+__log_put(char *p, T v) {
+    double d = v;
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return __log_slot(p, bits);
+}
+
+template<typename T>
+static inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, char *>::type
+__log_put(char *p, T v) {
+    // sign extended as the type is, the writer narrows it back by the conversion
+    return __log_slot(p, std::is_signed<T>::value ? (uint64_t) (int64_t) v : (uint64_t) v);
+}
+
+template<typename T>
+static inline char *__log_put(char *p, T *v) {
+    return __log_slot(p, (uint64_t) (uintptr_t) v);
+}
+
+static inline char *__log_put_args(char *p) {
+    return p;
+}
+
+template<typename T, typename... Rest>
+static inline char *__log_put_args(char *p, T arg, Rest... rest) {
+    return __log_put_args(__log_put(p, arg), rest...);
+}
+
+static inline void __log_check_format(const char *, ...) __attribute__((format(printf, 1, 2)));
+
+static inline void __log_check_format(const char *, ...) {}
+
+/* function: log_stamp
+ * usage: record a line to be written to stderr with its timestamp, as
+ *        PRINTF_ERR_STAMP would print it. A record that the writer does not
+ *        make room for in time is dropped and counted
+ * arguments:
+ *      1) format: printf format, a string literal
+ *      2) args: numbers, pointers or C strings, as the format says
+ * return: void
+ */
+template<typename... Args>
+static inline void log_stamp(const char *format, Args... args) {
+    LogRing *ring = __log_this_ring;
+    if (__builtin_expect(!ring, 0) && !(ring = __log_ring_slow()))
+        return;
+
+    uint64_t size = sizeof(LogRecord) + __log_args_size(args...);
+    char *p = __log_reserve(ring, size);
+    if (!p)
+        return;
+
+    LogRecord record;
+    record.size = (uint32_t) size;
+    record.dropped = ring->dropped.exchange(0, std::memory_order_relaxed);
+    record.clock = log_clock();
+    record.format = format;
+    memcpy(p, &record, sizeof(record));
+    __log_put_args(p + sizeof(record), args...);
+    __log_commit(ring);
+}
+
+#define LOG_STAMP(format, ...) \
+    do { \
+        __log_check_format(format, ##__VA_ARGS__); \
+        log_stamp(format, ##__VA_ARGS__); \
+    } while (0)
+
+#endif //PARCH_LOG_HH
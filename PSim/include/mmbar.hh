@@ -10,46 +10,399 @@
 #define PARCH_MMBAR_HH
 
 #include <stdint.h>
+#include <vector>
 
 #include "utils.hh"
 #include "register.hh"
 #include "options.hh"
 
-#define MEM_SIZE 0x80000000UL
-#define MEM_TEXT_START 0x400000UL
-#define MEM_TEXT_END 0x500000UL
-#define MEM_STACK_START 0xA00000UL
-#define MEM_TOP MEM_STACK_START
-#define MEM_DATA_START MEM_TEXT_END
+// default address-space layout, see MemLayout
+#define MEM_DEFAULT_SIZE 0x80000000UL
+#define MEM_DEFAULT_TEXT_START 0x400000UL
+#define MEM_DEFAULT_TEXT_SIZE 0x100000UL
+#define MEM_DEFAULT_STACK_START 0xA00000UL
+#define MEM_DEFAULT_STACK_TOP 0x1000000UL
 
+// j/jal carry a 26-bit word index, so the text cannot reach past this
+#define MEM_TEXT_LIMIT 0x10000000UL
+
+#define MEM_PAGE_SIZE 0x1000UL
+
+/* guard mode: every 32-bit guest address, plus the widest access past it,
+ * falls inside the reservation, and whatever lies beyond mem_size or in the
+ * stack guard is PROT_NONE */
+#define MEM_GUARD_RESERVE 0x100010000UL
+#define MEM_STACK_GUARD_SIZE 0x10000UL
+
+#define MEM_HUGE_PAGE_SIZE 0x200000UL
+
+/* Guest address space, from the bottom:
+ *      [text_start, text_start + text_size)    program text
+ *      [data_start, ...)                       static data, then the heap
+ *      [stack_start, stack_top)                stack, growing down from stack_top
+ * all of it inside [0, mem_size). Labels are word indices starting at
+ * text_start >> 2 */
+struct MemLayout {
+    uint64_t mem_size;
+    uint32_t text_start;
+    uint32_t text_size;
+    uint32_t data_start;
+    uint32_t stack_start;
+    uint32_t stack_top;
+};
+
+/* function: mmbar_layout_default
+ * usage: fill in the default layout (1 MiB of text at 0x400000, data right
+ *        after it, stack in [0xA00000, 0x1000000) of a 2 GiB space)
+ * arguments: layout: layout to fill
+ * return: void
+ */
+void mmbar_layout_default(MemLayout *layout);
+
+/* function: mmbar_layout_parse
+ * usage: apply a descriptor of comma separated key=value pairs over layout,
+ *        keys are the MemLayout fields; when text_start or text_size is given
+ *        without data_start, the data follows the text. Exit on an invalid
+ *        descriptor or layout
+ * arguments:
+ *      1) layout: layout to update
+ *      2) desc: e.g. "text_size=0x400000,mem_size=0x4000000,stack_top=0x4000000"
+ * return: void
+ */
+void mmbar_layout_parse(MemLayout *layout, const char *desc);
+
+/* callback invoked with the word address of every store that lands in the
+ * loaded text segment, so that predecoded copies of it can be dropped */
+typedef void (*mmbar_text_hook_t)(void *ctx, uint32_t addr);
+
+/* guest memory is one mem_size mapping, committed page by page on first touch.
+ * limit is mem_size while the memory is mapped and 0 otherwise, so a single
+ * compare against it covers both the initialized and the range check */
 struct MMBar {
     uint8_t *_memory;
+    MemLayout layout;
+    uint64_t limit = 0;
+    uint64_t reserved = 0;
+    bool guarded = false;
+    bool huge = false;
     uint32_t text_end_addr;
     uint32_t static_end_addr;
     uint32_t dynamic_end_addr;
     bool initialized = false;
+    mmbar_text_hook_t text_write_hook = NULL;
+    void *text_write_ctx = NULL;
 };
 
-void mmbar_init(MMBar *mmBar);
+void mmbar_init(MMBar *mmBar, const MemLayout *layout);
+
+/* function: mmbar_init_guarded
+ * usage: like mmbar_init, but reserve the whole 32-bit guest address space
+ *        and leave everything past mem_size and the MEM_STACK_GUARD_SIZE
+ *        below stack_start inaccessible, so that the *_unchecked accessors
+ *        fault instead of running out of range
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) layout: address-space layout
+ * return: void
+ */
+void mmbar_init_guarded(MMBar *mmBar, const MemLayout *layout);
+
+static inline uint32_t mmbar_stack_guard_start(const MMBar *mmBar) {
+    return mmBar->layout.stack_start - MEM_STACK_GUARD_SIZE;
+}
 
-void mmbar_load_text(MMBar *mmBar, std::vector<std::uint32_t> bin);
+/* function: mmbar_advise_huge
+ * usage: ask the kernel to back guest memory with transparent huge pages,
+ *        guest memory keeps normal pages if it refuses
+ * arguments: mmBar: guest memory
+ * return: whether the advice was taken
+ */
+bool mmbar_advise_huge(MMBar *mmBar);
+
+/* function: mmbar_huge_pages
+ * usage: count the huge pages currently backing guest memory
+ * arguments: mmBar: guest memory
+ * return: number of MEM_HUGE_PAGE_SIZE pages, 0 if unknown
+ */
+uint64_t mmbar_huge_pages(MMBar *mmBar);
+
+/* function: mmbar_fault_addr
+ * usage: translate a host fault address back to the guest
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) host: faulting host address
+ *      3) addr: guest address, set on success
+ * return: whether host lies in the guest reservation
+ */
+bool mmbar_fault_addr(MMBar *mmBar, const void *host, uint64_t *addr);
+
+void mmbar_load_text(MMBar *mmBar, const std::vector<std::uint32_t> &bin);
+
+/* function: mmbar_reset
+ * usage: zero guest memory and forget the loaded program, keeping the
+ *        mapping. The pages touched so far are dropped rather than cleared,
+ *        the kernel zero-fills them again on the next touch
+ * arguments: mmBar: guest memory
+ * return: void
+ */
+void mmbar_reset(MMBar *mmBar);
 
 void mmbar_free(MMBar *mmBar);
 
-bool mmbar_write(MMBar *mmBar, uint32_t addr, uint8_t e);
+/* function: __mmbar_fault
+ * usage: slow path of the accessors below, logs why an access was refused
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) addr: guest address of the access
+ *      3) access: name of the access for the log
+ * return: void
+ */
+void __mmbar_fault(MMBar *mmBar, uint32_t addr, const char *access);
+
+void __mmbar_notify_text_write(MMBar *mmBar, uint32_t addr, uint32_t n);
+
+// ========================================================================== //
+// accessors
+//
+// Guest memory is little endian. Aligned accesses are a single native load or
+// store; the memcpy based variants are safe at any alignment and compile to
+// the same instruction on hosts that allow unaligned access. An access of n
+// bytes at addr is valid when addr + n <= limit.
+// ========================================================================== //
+
+static inline uint16_t __mmbar_le16(uint16_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap16(v);
+#else
+    return v;
+#endif
+}
+
+static inline uint32_t __mmbar_le32(uint32_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(v);
+#else
+    return v;
+#endif
+}
+
+static inline bool __mmbar_valid(const MMBar *mmBar, uint32_t addr, uint32_t n) {
+    return (uint64_t) addr + n <= mmBar->limit;
+}
 
-bool mmbar_writeu16(MMBar *mmBar, uint32_t addr, uint16_t e);
+static inline uint16_t mmbar_loadu16_unaligned(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return __mmbar_le16(v);
+}
 
-bool mmbar_writeu32(MMBar *mmBar, uint32_t addr, uint32_t e);
+static inline uint32_t mmbar_loadu32_unaligned(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return __mmbar_le32(v);
+}
 
-uint8_t mmbar_read(MMBar *mmBar, uint32_t addr);
+static inline uint16_t mmbar_loadu16_aligned(const uint8_t *p) {
+    uint16_t v;
+    memcpy(&v, __builtin_assume_aligned(p, 2), sizeof(v));
+    return __mmbar_le16(v);
+}
 
-uint16_t mmbar_readu16(MMBar *mmBar, uint32_t addr);
+static inline uint32_t mmbar_loadu32_aligned(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, __builtin_assume_aligned(p, 4), sizeof(v));
+    return __mmbar_le32(v);
+}
 
-uint32_t mmbar_readu32(MMBar *mmBar, uint32_t addr);
+static inline void mmbar_storeu16_unaligned(uint8_t *p, uint16_t e) {
+    e = __mmbar_le16(e);
+    memcpy(p, &e, sizeof(e));
+}
 
-uint32_t mmbar_allocate(MMBar* mmBar, uint32_t size_n);
+static inline void mmbar_storeu32_unaligned(uint8_t *p, uint32_t e) {
+    e = __mmbar_le32(e);
+    memcpy(p, &e, sizeof(e));
+}
+
+static inline void mmbar_storeu16_aligned(uint8_t *p, uint16_t e) {
+    e = __mmbar_le16(e);
+    memcpy(__builtin_assume_aligned(p, 2), &e, sizeof(e));
+}
+
+static inline void mmbar_storeu32_aligned(uint8_t *p, uint32_t e) {
+    e = __mmbar_le32(e);
+    memcpy(__builtin_assume_aligned(p, 4), &e, sizeof(e));
+}
+
+static inline void __mmbar_check_text_write(MMBar *mmBar, uint32_t addr, uint32_t n) {
+    if (__builtin_expect(addr < mmBar->text_end_addr && addr + n > mmBar->layout.text_start, 0))
+        __mmbar_notify_text_write(mmBar, addr, n);
+}
+
+static inline bool mmbar_write(MMBar *mmBar, uint32_t addr, uint8_t e) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 1), 0)) {
+        __mmbar_fault(mmBar, addr, "Write");
+        return false;
+    }
+    mmBar->_memory[addr] = e;
+    __mmbar_check_text_write(mmBar, addr, 1);
+    return true;
+}
+
+static inline bool mmbar_writeu16(MMBar *mmBar, uint32_t addr, uint16_t e) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 2), 0)) {
+        __mmbar_fault(mmBar, addr, "Write u16");
+        return false;
+    }
+    if (addr & 0x1)
+        mmbar_storeu16_unaligned(mmBar->_memory + addr, e);
+    else
+        mmbar_storeu16_aligned(mmBar->_memory + addr, e);
+    __mmbar_check_text_write(mmBar, addr, 2);
+    return true;
+}
+
+static inline bool mmbar_writeu32(MMBar *mmBar, uint32_t addr, uint32_t e) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 4), 0)) {
+        __mmbar_fault(mmBar, addr, "Write u32");
+        return false;
+    }
+    if (addr & 0x3)
+        mmbar_storeu32_unaligned(mmBar->_memory + addr, e);
+    else
+        mmbar_storeu32_aligned(mmBar->_memory + addr, e);
+    __mmbar_check_text_write(mmBar, addr, 4);
+    return true;
+}
+
+static inline uint8_t mmbar_read(MMBar *mmBar, uint32_t addr) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 1), 0)) {
+        __mmbar_fault(mmBar, addr, "Read");
+        return 0x0;
+    }
+    return mmBar->_memory[addr];
+}
+
+static inline uint16_t mmbar_readu16(MMBar *mmBar, uint32_t addr) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 2), 0)) {
+        __mmbar_fault(mmBar, addr, "Read u16");
+        return 0x0;
+    }
+    if (addr & 0x1)
+        return mmbar_loadu16_unaligned(mmBar->_memory + addr);
+    return mmbar_loadu16_aligned(mmBar->_memory + addr);
+}
+
+static inline uint32_t mmbar_readu32(MMBar *mmBar, uint32_t addr) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, 4), 0)) {
+        __mmbar_fault(mmBar, addr, "Read u32");
+        return 0x0;
+    }
+    if (addr & 0x3)
+        return mmbar_loadu32_unaligned(mmBar->_memory + addr);
+    return mmbar_loadu32_aligned(mmBar->_memory + addr);
+}
+
+/* unchecked accessors for guard mode: the MMU does the bounds check, stores
+ * into the text segment are still reported */
+
+static inline uint8_t mmbar_read_unchecked(MMBar *mmBar, uint32_t addr) {
+    return mmBar->_memory[addr];
+}
+
+static inline uint16_t mmbar_readu16_unchecked(MMBar *mmBar, uint32_t addr) {
+    return mmbar_loadu16_unaligned(mmBar->_memory + addr);
+}
+
+static inline uint32_t mmbar_readu32_unchecked(MMBar *mmBar, uint32_t addr) {
+    return mmbar_loadu32_unaligned(mmBar->_memory + addr);
+}
+
+static inline void mmbar_write_unchecked(MMBar *mmBar, uint32_t addr, uint8_t e) {
+    mmBar->_memory[addr] = e;
+    __mmbar_check_text_write(mmBar, addr, 1);
+}
+
+static inline void mmbar_writeu16_unchecked(MMBar *mmBar, uint32_t addr, uint16_t e) {
+    mmbar_storeu16_unaligned(mmBar->_memory + addr, e);
+    __mmbar_check_text_write(mmBar, addr, 2);
+}
+
+static inline void mmbar_writeu32_unchecked(MMBar *mmBar, uint32_t addr, uint32_t e) {
+    mmbar_storeu32_unaligned(mmBar->_memory + addr, e);
+    __mmbar_check_text_write(mmBar, addr, 4);
+}
+
+// ========================================================================== //
+// bulk access
+//
+// For the syscalls that move whole buffers between the host and the guest. A
+// span is a host view of a guest range, checked once for the whole range;
+// stores made through it must be reported with mmbar_span_written.
+// ========================================================================== //
+
+/* function: mmbar_span
+ * usage: host view of the guest range [addr, addr + n)
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) addr: guest address
+ *      3) n: number of bytes
+ * return: pointer to guest memory at addr, NULL if the range is not valid
+ */
+static inline uint8_t *mmbar_span(MMBar *mmBar, uint32_t addr, uint32_t n) {
+    if (__builtin_expect(!__mmbar_valid(mmBar, addr, n), 0)) {
+        __mmbar_fault(mmBar, addr, "Span");
+        return NULL;
+    }
+    return mmBar->_memory + addr;
+}
+
+static inline void mmbar_span_written(MMBar *mmBar, uint32_t addr, uint32_t n) {
+    __mmbar_check_text_write(mmBar, addr, n);
+}
+
+/* function: mmbar_strlen
+ * usage: length of the guest string at addr, searched with memchr
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) addr: guest address of the string
+ *      3) terminated: set to whether a terminator was found, may be NULL
+ * return: bytes before the terminator, or up to the end of guest memory
+ *         without one; 0 if addr is out of range
+ */
+uint32_t mmbar_strlen(MMBar *mmBar, uint32_t addr, bool *terminated);
+
+static inline bool mmbar_copy_in(MMBar *mmBar, uint32_t addr, const void *src, uint32_t n) {
+    uint8_t *dst = mmbar_span(mmBar, addr, n);
+    if (!dst)
+        return false;
+    memcpy(dst, src, n);
+    mmbar_span_written(mmBar, addr, n);
+    return true;
+}
+
+static inline bool mmbar_copy_out(MMBar *mmBar, void *dst, uint32_t addr, uint32_t n) {
+    const uint8_t *src = mmbar_span(mmBar, addr, n);
+    if (!src)
+        return false;
+    memcpy(dst, src, n);
+    return true;
+}
+
+uint32_t mmbar_allocate(MMBar* mmBar, uint32_t size_n, uint32_t stack_pointer);
 
 void mmbar_load_static_u8(MMBar* mmBar, uint8_t e);
 
+/* function: mmbar_load_static
+ * usage: append n bytes of already assembled static data
+ * arguments:
+ *      1) mmBar: guest memory
+ *      2) data: the bytes
+ *      3) n: number of bytes
+ * return: void
+ */
+void mmbar_load_static(MMBar *mmBar, const uint8_t *data, uint32_t n);
+
+void mmbar_set_text_hook(MMBar *mmBar, mmbar_text_hook_t hook, void *ctx);
+
 #endif //PARCH_MMBAR_HH
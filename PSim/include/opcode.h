@@ -5,6 +5,76 @@
 #ifndef PARCH_OPCODE_H
 #define PARCH_OPCODE_H
 
-#include <map>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "decoder.hh"
+
+/* Every instruction the assembler accepts is one OpcodeDesc of the table in
+ * opcode.cc. The assembler looks a mnemonic up by a perfect hash of it and
+ * encodes from the descriptor; the decoder and the disassembler go the other
+ * way, from the fixed bits of a word to the same descriptor */
+
+enum isa_formats {
+    ISA_R,                                  // opcode, then funct in the low 6 bits
+    ISA_REGIMM,                             // opcode 0x1, rt selects the instruction
+    ISA_I,                                  // opcode alone
+    ISA_J,                                  // opcode alone, 26-bit target
+};
+
+enum isa_fields {
+    FLD_NONE,                               // no more operands
+    FLD_RS,                                 // $reg
+    FLD_RT,
+    FLD_RD,
+    FLD_SHAMT,                              // imm, 5 bits
+    FLD_IMM,                                // imm, 16 bits, sign extended
+    FLD_UIMM,                               // imm, 16 bits, zero extended
+    FLD_BRANCH,                             // label, 16-bit word offset from the next instruction
+    FLD_TARGET,                             // label, 26-bit word index
+    FLD_ADDR,                               // offset($reg): imm and rs
+};
+
+#define ISA_MAX_OPERANDS 3
+
+struct OpcodeDesc {
+    const char *mnemonic;
+    uint8_t format;
+    uint8_t opcode;
+    uint8_t funct;                          // funct of ISA_R, rt of ISA_REGIMM
+    uint8_t fields[ISA_MAX_OPERANDS];       // field of each operand, in source order
+    uint8_t uop;                            // micro-op the simulator decodes it to
+    bool pseudo;                            // another instruction with some operand fixed to 0
+};
+
+/* function: isa_lookup
+ * usage: descriptor of a mnemonic, one probe of the perfect hash table and a
+ *        compare of the name
+ * arguments:
+ *      1) mnemonic, size: the name, need not end with '\0'
+ *      2) h: hash() of the name
+ * return: NULL if it is no instruction
+ */
+const OpcodeDesc *isa_lookup(const char *mnemonic, uint32_t size, uint32_t h);
+
+/* function: isa_decode
+ * usage: descriptor of an instruction word, by its opcode and funct or rt;
+ *        pseudo-instructions are never returned
+ * arguments:
+ *      1) word: the instruction
+ * return: NULL if it decodes to no instruction
+ */
+const OpcodeDesc *isa_decode(uint32_t word);
+
+/* function: isa_disassemble
+ * usage: write an instruction word as assembly, e.g. "lw $t0, 4($sp)";
+ *        branch and jump targets are written as addresses
+ * arguments:
+ *      1) word: the instruction
+ *      2) pc: its address
+ *      3) buf, size: the output, always '\0' terminated
+ * return: false if the word decodes to no instruction, buf then holds it in hex
+ */
+bool isa_disassemble(uint32_t word, uint32_t pc, char *buf, size_t size);
 
 #endif //PARCH_OPCODE_H
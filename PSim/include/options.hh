@@ -19,12 +19,25 @@
 
 #include "utils.hh"
 
+enum engine_types {
+    ENGINE_PREDECODE,                       // indexed loop over the predecoded text
+    ENGINE_THREADED,                        // computed-goto dispatch over the same
+    ENGINE_BLOCK,                           // chained basic-block translation cache
+    ENGINE_JIT,                             // block engine with x86-64 translation of hot blocks
+};
+
 typedef struct {
     char *ELF;
     char *ASM;
     char *input_file;
     char *output_bin;
     char *output_stdout;
+    char *layout;
+    char *batch;
+    char *fork_server;
+    char *vfs;
+    char *vfs_dump;
+    char *vfs_expect;
     bool from_elf;
     bool from_std_in;
     bool from_asm;
@@ -36,6 +49,17 @@ typedef struct {
     bool input_from_file;
     bool require_output_bin;
     bool require_output_stdout;
+    bool report_stats;
+    bool guard_pages;
+    bool huge_pages;
+    uint32_t engine;
+    uint32_t jit_threshold;
+    uint32_t jit_cache_kb;
+    uint32_t jobs;
+    uint64_t job_budget;
+    uint32_t job_timeout_ms;
+    uint64_t max_instructions;
+    uint32_t timeout_ms;
 } Options;
 
 extern bool verbose;
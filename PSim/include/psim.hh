@@ -12,23 +12,221 @@
 #include <iostream>
 #include <utility>
 #include <fcntl.h>
+#include <signal.h>
 
 #include "assembler.hh"
 #include "options.hh"
 #include "mmbar.hh"
+#include "decoder.hh"
+#include "jit.hh"
+#include "console.hh"
+#include "input.hh"
+#include "vfs.hh"
+
+/* A straight-line run of predecoded instructions ending at a branch, jump,
+ * jr/jalr or syscall. The two most recent successors are remembered so that
+ * consecutive blocks are entered without going back to the block lookup.
+ * With the jit engine, a block executed hotness times gets native code */
+struct TranslatedBlock {
+    uint32_t start;
+    uint32_t length;
+    const MicroOp *uops;
+    TranslatedBlock *succ[2];
+    uint32_t succ_pc[2];
+    uint32_t hotness;
+    jit_block_fn native;
+    uint32_t native_length;                 // instructions covered by native
+};
+
+/* Features the execution engines are compiled for. Handlers and run loops are
+ * instantiated once per combination, so a run without --verbose or --stats
+ * carries neither the logging nor the counters on its hot path */
+enum sim_features {
+    SIM_FEAT_VERBOSE = 0x1,                 // per-instruction trace
+    SIM_FEAT_STATS = 0x2,                   // engine counters
+    SIM_FEAT_GUARD = 0x4,                   // unchecked loads/stores behind guard pages
+    SIM_FEAT_LIMIT = 0x8,                   // retired instruction count, budget and deadline
+    SIM_FEAT_ALL = 0xF
+};
+
+/* why the engine returned */
+enum sim_stops {
+    SIM_STOP_NONE,                          // ran off the end of the text
+    SIM_STOP_BUDGET,                        // retired the instruction budget
+    SIM_STOP_TIMEOUT,                       // passed the deadline
+};
+
+/* what ended a run through EXIT_WITH_MSG, see RunResult */
+enum sim_traps {
+    SIM_TRAP_NONE,
+    SIM_TRAP_OVERFLOW,                      // add, addi or sub overflowed
+    SIM_TRAP_DIVIDE,                        // div or divu by zero
+    SIM_TRAP_CONDITION,                     // the condition of a trap instruction held
+    SIM_TRAP_DECODE,                        // the instruction does not decode
+    SIM_TRAP_FAULT,                         // guest access out of range, with --guard_pages
+    SIM_TRAP_ERROR,                         // anything else, e.g. the input ran out
+};
+
+enum run_statuses {
+    RUN_EXITED,                             // exit syscall, or ran off the end of the text
+    RUN_TRAPPED,
+    RUN_BUDGET,
+    RUN_TIMEOUT,
+};
+
+/* outcome of simulator_try_run */
+struct RunResult {
+    uint32_t status;                        // run_statuses
+    int32_t exit_code;                      // of RUN_EXITED
+    uint32_t trap;                          // sim_traps of RUN_TRAPPED
+    uint32_t pc;                            // the instruction that exited or trapped,
+                                            // otherwise the next one to run
+    uint64_t retired;                       // counted by limited runs only, otherwise 0
+    std::string message;                    // the report of RUN_TRAPPED
+};
+
+#define SIM_NO_BUDGET UINT64_MAX
+#define SIM_CLOCK_INTERVAL 0x10000          // instructions between two deadline checks
+#define SIM_EXIT_TIMEOUT 124                // exit status of a run stopped by --timeout
+#define SIM_EXIT_BUDGET 125                 // exit status of a run stopped by --max_instructions
+
+struct BlockStats {
+    uint64_t executed;                      // blocks entered
+    uint64_t chain_hits;                    // entered through a successor link
+    uint64_t lookup_hits;                   // found in the block map
+    uint64_t misses;                        // translated on first entry
+    uint64_t links;                         // successor links established
+    uint64_t flushes;                       // cache dropped after a text write
+};
 
 struct Simulator {
+    CPUContext cpu;
     Assembler assembler;
     MMBar mmBar;
     Options user_options;
-    std::vector<std::string> inputs;
-    uint32_t current_input;
-    std::vector<uint32_t> bin;
-    uint32_t pc;
+    InputSource input;                      // lines of --input_file for the read syscalls
+    const std::vector<uint32_t> *bin;       // the program, of the assembler or shared by batch jobs
+    const uop_handler_t *handlers;
+    std::vector<MicroOp> icache;
+    std::vector<uint32_t> icache_runs;      // per entry, instructions up to the next branch, jump or syscall
+    std::vector<TranslatedBlock> blocks;
+    std::vector<TranslatedBlock *> block_map;
+    const MicroOp *block_end;
+    bool block_flush;
+    BlockStats block_stats;
+    Jit jit;
+    const MicroOp *fault_uop;               // last memory access or syscall, for guard faults
+    std::string *output;                    // captures the print syscalls when set
+    Console console;                        // output channel of the run
+    VfsImage vfs_image;                     // preloaded files of --vfs, unless shared by a batch
+    Vfs vfs;                                // files of the run when --vfs is given
+    bool limited;                           // run with SIM_FEAT_LIMIT
+    uint64_t retired;                       // before the run of run_pc while the engine is inside it
+    uint32_t run_pc;                        // first pc of the sequential run being retired
+    uint64_t budget;
+    double deadline;                        // get_timestamp() to stop at, 0 for none
+    uint64_t clock_check;                   // retired count of the next deadline check
+    uint64_t limit_check;                   // min(budget, clock_check)
+    uint32_t stop;
+    uint32_t trap;                          // sim_traps, recorded before leaving the run
+    uint32_t trap_pc;
+
+    // cpu is cache-line aligned, which the global operator new only honours
+    // from C++17 on: heap instances go through posix_memalign instead
+    static void *operator new(size_t size);
+    static void operator delete(void *ptr);
 };
 
 void simulator_init(Simulator *simulator, int argc, char **argv);
 
+/* function: load_input
+ * usage: open user_options.input_file for the read syscalls
+ */
+void load_input(Simulator *simulator);
+
+/* function: simulator_prepare
+ * usage: map guest memory as the options ask and clear the run state, the
+ *        part of simulator_init that does not depend on the command line
+ * arguments:
+ *      1) simulator: simulator with user_options filled
+ * return: void
+ */
+void simulator_prepare(Simulator *simulator);
+
+/* function: simulator_load
+ * usage: load simulator->bin into guest memory, predecode it and reset the
+ *        CPU to the entry point, ready for simulator_resume
+ * arguments:
+ *      1) simulator: prepared simulator with bin set
+ * return: void
+ */
+void simulator_load(Simulator *simulator);
+
+/* function: simulator_resume
+ * usage: execute from the current CPU state with the engine of the options
+ * return: void, simulator->stop tells why the engine returned
+ */
+void simulator_resume(Simulator *simulator);
+
+/* function: simulator_run
+ * usage: simulator_load then simulator_resume, without reporting or
+ *        releasing anything
+ */
+void simulator_run(Simulator *simulator);
+
+/* function: simulator_limit
+ * usage: run with SIM_FEAT_LIMIT, stopping the engine once the run retired
+ *        budget instructions or timeout_ms passed, whichever comes first.
+ *        The block engines check once per block, and a run that is never
+ *        limited, both 0, does not check at all. Takes effect at the next
+ *        simulator_load, or at once if called between load and resume
+ * arguments:
+ *      1) simulator: prepared simulator
+ *      2) budget: instructions the run may retire, 0 for unlimited
+ *      3) timeout_ms: wall-clock limit from now, 0 for unlimited
+ * return: void
+ */
+void simulator_limit(Simulator *simulator, uint64_t budget, uint32_t timeout_ms);
+
+/* function: __simulator_report_stop
+ * usage: tell on stderr why a limited run stopped and at which pc
+ * return: SIM_EXIT_BUDGET or SIM_EXIT_TIMEOUT, 0 if it was not stopped
+ */
+int __simulator_report_stop(Simulator *simulator);
+
+/* function: simulator_try_run
+ * usage: simulator_run for embedders: the exit syscalls, traps and errors of
+ *        the run are returned instead of ending the process. The run is
+ *        limited as set by simulator_limit
+ * arguments:
+ *      1) simulator: prepared simulator with bin set
+ *      2) result: filled with how the run ended
+ * return: void
+ */
+void simulator_try_run(Simulator *simulator, RunResult *result);
+
+/* function: simulator_reset
+ * usage: make a simulator that ran ready for another program or input, its
+ *        guest memory stays mapped and is zeroed, the input, output capture,
+ *        budget and deadline are cleared. Load the next program as after
+ *        simulator_prepare
+ * arguments:
+ *      1) simulator: simulator after a run
+ * return: void
+ */
+void simulator_reset(Simulator *simulator);
+
+/* function: __simulator_report
+ * usage: print the huge page and --stats reports to stderr
+ */
+void __simulator_report(Simulator *simulator);
+
+/* function: simulator_release
+ * usage: free the translated code and guest memory of a run, and give the
+ *        fault signals back to their handlers once no guarded run is left
+ */
+void simulator_release(Simulator *simulator);
+
 void simulator_exec(Simulator *simulator);
 
 void simulator_free(Simulator *simulator);
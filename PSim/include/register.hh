@@ -35,26 +35,47 @@ enum f_registers {
     f0, f12                                 // for float point syscall
 };
 
+/* assembler names of the registers, by register_types */
+static const char *const register_names[REG_NUM] = {
+        "zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+        "t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+        "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+        "t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra",
+        "HI", "LO",
+};
+
 inline std::map<std::string, uint32_t> create_regparse_map() {
     std::map<std::string, uint32_t> rgm;
-    rgm["zero"] = zero;
-    rgm["at"] = at;
-    rgm["v0"] = v0, rgm["v1"] = v1;
-    rgm["a0"] = a0, rgm["a1"] = a1, rgm["a2"] = a2, rgm["a3"] = a3;
-    rgm["t0"] = t0, rgm["t1"] = t1, rgm["t2"] = t2, rgm["t3"] = t3, rgm["t4"] = t4, rgm["t5"] = t5;
-    rgm["t6"] = t6, rgm["t7"] = t7, rgm["t8"] = t8, rgm["t9"] = t9;
-    rgm["s0"] = s0, rgm["s1"] = s1, rgm["s2"] = s2, rgm["s3"] = s3, rgm["s4"] = s4, rgm["s5"] = s5;
-    rgm["s6"] = s6, rgm["s7"] = s7;
-    rgm["k0"] = k0, rgm["k1"] = k1;
-    rgm["gp"] = gp;
-    rgm["sp"] = sp;
-    rgm["fp"] = fp;
-    rgm["ra"] = ra;
-    rgm["HI"] = HI, rgm["LO"] = LO;
+    for (uint32_t i = 0; i < REG_NUM; i++)
+        rgm[register_names[i]] = i;
     return rgm;
 }
 
-extern int32_t register_file[REG_NUM];
-extern double f_register_file[2];
+#define CPU_CACHE_LINE 64
+
+struct Simulator;
+
+/* Architectural state of one simulated CPU: general purpose registers with
+ * HI/LO, the float registers of the syscalls and pc. Each Simulator owns one,
+ * aligned to a cache line so that instances running on different cores never
+ * share a line. regs comes first, translated code addresses it off the
+ * context pointer */
+struct alignas(CPU_CACHE_LINE) CPUContext {
+    int32_t regs[REG_NUM];
+    double f_regs[2];
+    uint32_t pc;
+    Simulator *simulator;                   // owner, for memory and syscalls
+};
+
+/* function: cpu_reset
+ * usage: clear the registers and set the entry state
+ * arguments:
+ *      1) cpu: context to reset
+ *      2) simulator: owner of the context
+ *      3) pc: entry point
+ *      4) stack_top: initial sp
+ * return: void
+ */
+void cpu_reset(CPUContext *cpu, Simulator *simulator, uint32_t pc, uint32_t stack_top);
 
 #endif //PARCH_REGISTER_HH
@@ -19,16 +19,39 @@
 #include <sys/stat.h>
 #include <assert.h>
 #include <string>
-#include <regex>
+
+#include "log.hh"
 
 #define TIMEVAL2F(stamp) \
     ((stamp).tv_sec * 1000.0 + (stamp).tv_usec / 1000.0)
 
 double get_timestamp();
 
-/* print msg with timestamp */
+/* Replaces exit() for code that runs guest programs in-process. While a
+ * thread has one armed, EXIT_WITH_MSG and the guest exit syscalls fill it in
+ * and throw it to the caller that armed it instead of ending the process */
+struct ExitTrap {
+    int status;
+    bool error;                             // left through EXIT_WITH_MSG
+    char message[256];                      // the EXIT_WITH_MSG text
+};
+
+extern thread_local ExitTrap *exit_trap;
+
+/* function: exit_or_trap
+ * usage: throw the armed ExitTrap of this thread, or exit the process
+ * arguments:
+ *      1) status: exit status
+ *      2) error: true when leaving on an error
+ * return: does not return
+ */
+[[noreturn]] void exit_or_trap(int status, bool error);
+
+/* print msg with timestamp. The printing macros write out the pending log
+ * records first, so that the output keeps the order of the calls */
 #define PRINTF_STAMP(format, ...) \
     do { \
+        log_sync(); \
         flockfile(stdout); \
         printf("%12.2f - ", get_timestamp()); \
         printf(format, ##__VA_ARGS__); \
@@ -39,6 +62,7 @@ double get_timestamp();
 /* print error msg to stderr */
 #define PRINTF_ERR(format, ...) \
     do { \
+        log_sync(); \
         flockfile(stderr); \
         fprintf(stderr, format, ##__VA_ARGS__); \
         fflush(stderr); \
@@ -48,17 +72,22 @@ double get_timestamp();
 /* print error msg with timestamp to stderr */
 #define PRINTF_ERR_STAMP(format, ...) \
     do { \
+        log_sync(); \
         flockfile(stderr); \
         fprintf(stderr, "%12.2f - ", get_timestamp()); \
         PRINTF_ERR(format, ##__VA_ARGS__); \
         funlockfile(stderr); \
     } while(0)
 
-/* print error msg with timestamp to stderr then exit */
+/* print error msg with timestamp to stderr then exit, or hand the msg to
+ * the armed ExitTrap of this thread */
 #define EXIT_WITH_MSG(format, ...) \
     do { \
-        PRINTF_ERR_STAMP(format, ##__VA_ARGS__); \
-        exit(-1); \
+        if (exit_trap) \
+            snprintf(exit_trap->message, sizeof(exit_trap->message), format, ##__VA_ARGS__); \
+        else \
+            PRINTF_ERR_STAMP(format, ##__VA_ARGS__); \
+        exit_or_trap(-1, true); \
     } while (0)
 
 /* print msg with timestamp to stderr if in debug mode */
@@ -69,11 +98,13 @@ double get_timestamp();
 #define PRINTF_DEBUG(...)
 #endif
 
+/* log msg with timestamp to stderr if _verbose, formatted and written by
+ * the log writer thread (see log.hh) */
 #ifndef PRINTF_DEBUG_VERBOSE
 #define PRINTF_DEBUG_VERBOSE(_verbose, format, ...) \
     do { \
         if (_verbose) \
-            PRINTF_ERR_STAMP(format, ##__VA_ARGS__); \
+            LOG_STAMP(format, ##__VA_ARGS__); \
     } while (0)
 #endif
 
@@ -82,6 +113,7 @@ double get_timestamp();
 #define PRINT_ARRAY_DEBUG(ele_format, array, size) \
         do { \
             unsigned int i; \
+            log_sync(); \
             fprintf(stderr, "%12.2f - array " #array ": ", get_timestamp()); \
             for(i = 0; i < (size); i++) { \
                 fprintf(stderr, ele_format, (array)[i]); \
@@ -133,6 +165,17 @@ inline constexpr unsigned int hash(const char *s, int off = 0) {
     return !s[off] ? 5381 : (hash(s, off + 1) * 33) ^ s[off];
 }
 
+/* value of a hexadecimal digit, -1 if c is none */
+inline int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
 #ifdef WINDOWS
 #include <direct.h>
 #define GetCurrentDir _getcwd
@@ -152,43 +195,7 @@ inline int currentPath(std::string &path) {
 
     cCurrentPath[sizeof(cCurrentPath) - 1] = '\0'; /* not really required */
     path = std::string(cCurrentPath);
-}
-
-inline int32_t arbstoi(const std::string &s) {
-    std::regex e("0[xX][0-9a-fA-F]+");
-    if (std::regex_match(s, e)) {
-        return std::stoi(s, nullptr, 16);
-    } else {
-        return std::stoi(s, nullptr, 10);
-    }
-}
-
-inline std::string unescape(const std::string &s) {
-    std::string res;
-    std::string::const_iterator it = s.begin();
-    while (it != s.end()) {
-        char c = *it++;
-        if (c == '\\' && it != s.end()) {
-            switch (*it++) {
-                case '\\':
-                    c = '\\';
-                    break;
-                case 'n':
-                    c = '\n';
-                    break;
-                case 't':
-                    c = '\t';
-                    break;
-                    // all other escapes
-                default:
-                    // invalid escape sequence - skip it. alternatively you can copy it as is, throw an exception...
-                    continue;
-            }
-        }
-        res += c;
-    }
-
-    return res;
+    return 0;
 }
 
 #endif //PARCH_UTILS_HH
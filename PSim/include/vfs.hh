@@ -0,0 +1,118 @@
+/**
+ * @filename: vfs.hh
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: in-memory file system behind the file syscalls
+ * @date: 3/31/2021
+ */
+
+#ifndef PARCH_VFS_HH
+#define PARCH_VFS_HH
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "utils.hh"
+#include "options.hh"
+
+// guest descriptors below this stay the host's stdin, stdout and stderr
+#define VFS_FD_BASE 3
+
+/* Files preloaded for the guest, by guest path. Loaded once and only read
+ * afterwards, so one image may back any number of runs at a time */
+struct VfsImage {
+    std::map<std::string, std::string> files;
+};
+
+/* A guest file of one run. It reads from its preloaded content until the
+ * first write, which copies it into data */
+struct VfsFile {
+    const std::string *base;                // preloaded content, NULL once copied
+    std::string data;
+    bool written;                           // captured: created, truncated or written
+};
+
+struct VfsHandle {
+    VfsFile *file;                          // NULL when the descriptor is free
+    uint32_t pos;
+    int flags;                              // open flags of the guest, as the host's O_*
+};
+
+/* The file system a run sees. Guest paths resolve against the image only,
+ * never against the host, so that runs of the same program cannot see each
+ * other's files */
+struct Vfs {
+    const VfsImage *image = NULL;           // NULL when the file syscalls go to the host
+    std::map<std::string, VfsFile> files;
+    std::vector<VfsHandle> handles;         // descriptor VFS_FD_BASE + i
+};
+
+/* function: vfs_image_load
+ * usage: preload the files of a directory, under their path relative to it,
+ *        or of a manifest of GUEST_PATH HOST_PATH lines (host paths relative
+ *        to the manifest)
+ * arguments:
+ *      1) image: image to fill
+ *      2) path: directory or manifest
+ * return: void, exit if a file cannot be read
+ */
+void vfs_image_load(VfsImage *image, const char *path);
+
+/* function: vfs_init
+ * usage: serve the file syscalls of a run from image, dropping the files of
+ *        the previous run
+ */
+void vfs_init(Vfs *vfs, const VfsImage *image);
+
+/* function: vfs_reset
+ * usage: drop every file and descriptor of the run, keeping the image
+ */
+void vfs_reset(Vfs *vfs);
+
+static inline bool vfs_enabled(const Vfs *vfs) {
+    return vfs->image != NULL;
+}
+
+/* descriptors of the vfs start at VFS_FD_BASE, the rest go to the host */
+static inline bool vfs_owns(const Vfs *vfs, int32_t fd) {
+    return vfs_enabled(vfs) && fd >= VFS_FD_BASE;
+}
+
+/* function: vfs_open
+ * usage: open a guest file. O_CREAT creates a missing file, O_TRUNC empties
+ *        it and O_APPEND writes at its end
+ * arguments:
+ *      1) vfs: file system of the run
+ *      2) path: guest path
+ *      3) flags: the host's O_* flags
+ * return: the guest descriptor, -1 if the file does not exist
+ */
+int32_t vfs_open(Vfs *vfs, const char *path, int flags);
+
+int32_t vfs_read(Vfs *vfs, int32_t fd, void *dst, uint32_t n);
+
+int32_t vfs_write(Vfs *vfs, int32_t fd, const void *src, uint32_t n);
+
+int32_t vfs_close(Vfs *vfs, int32_t fd);
+
+/* function: vfs_dump
+ * usage: write every captured file under dir, creating its directories
+ * return: void, exit if a file cannot be written
+ */
+void vfs_dump(const Vfs *vfs, const char *dir);
+
+/* function: vfs_compare
+ * usage: compare the files the run leaves with those under dir: every file
+ *        under dir must be there with the same content, preloaded or written,
+ *        and every captured file must be under dir
+ * arguments:
+ *      1) vfs: file system of the run
+ *      2) dir: directory of the expected files
+ *      3) report: a line per file that is missing, differs or is not expected
+ * return: whether all of them matched
+ */
+bool vfs_compare(const Vfs *vfs, const char *dir, std::string *report);
+
+#endif //PARCH_VFS_HH
@@ -8,81 +8,160 @@
 
 #include "assembler.hh"
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <stdarg.h>
+
+#define ASM_CHUNK 0x4000                    // instructions a worker of the encoding pass takes at a time
+#define ASM_MAX_DIAGS 32                    // messages reported, the other errors are only counted
+
+/* Errors of a chunk of the encoding pass, in source order. The pass goes on
+ * past an error, so one run reports every bad line */
+struct EncodeDiags {
+    uint32_t errors;
+    std::vector<std::string> messages;      // of the first ASM_MAX_DIAGS errors
+};
+
+/* lex a source line, exit if it cannot be */
+static void __lex(const char *line, size_t n, LexLine *lex) {
+    if (!lex_line(line, line + n, lex))
+        EXIT_WITH_MSG("[ASM]\tCannot parse line: %s\n", std::string(line, n).c_str());
+}
+
+/* the line is nothing but the section directive name */
+static bool __is_section(const LexLine *lex, const char *name) {
+    return !lex->label.size && lex->n_tokens == 1 && lex->tokens[0].kind == TOK_DIRECTIVE
+           && span_eq(lex->tokens[0].text, name);
+}
 
-std::map<std::string, uint32_t> reg_map;
+/* register number of a name without '$': one of register_names or 0 to 31;
+ * HI and LO are no operand */
+static uint32_t __register(Span name) {
+    for (uint32_t i = 0; i < HI; i++) {
+        if (span_eq(name, register_names[i]))
+            return i;
+    }
 
-bool isLineALabel(const std::string &line) {
-    std::regex e("(.+):(.*)");
-    return std::regex_match(line, e);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < name.size && name.size <= 2; i++) {
+        if (name.data[i] < '0' || name.data[i] > '9')
+            break;
+        n = n * 10 + (name.data[i] - '0');
+        if (i == name.size - 1 && n < 32)
+            return n;
+    }
+    EXIT_WITH_MSG("[ASM]\tUnknown register: $%s\n", span_str(name).c_str());
 }
 
-std::string removeComments(const std::string &line) {
-    std::string ret = line.substr(0, line.find("#"));
-    return ret;
+/* index of a label in assembler->symbols, added undefined on its first use */
+static uint32_t __symbol(Assembler *assembler, Span name) {
+    std::unordered_map<Span, uint32_t, SpanHash, SpanEqual>::iterator it = assembler->symbol_ids.find(name);
+    if (it != assembler->symbol_ids.end())
+        return it->second;
+
+    uint32_t symbol = (uint32_t) assembler->symbols.size();
+    assembler->symbol_ids[name] = symbol;
+    assembler->symbols.push_back(ASM_UNDEFINED);
+    assembler->symbol_names.push_back(name);
+    return symbol;
 }
 
-bool isLineEmpty(const std::string &line) {
-    for (uint32_t index = 0; index < line.length(); index++) {
-        if (!std::isspace(line[index]))
-            return false;
+/* resolve the operands of a text line, once, for the encoder */
+static void __parse_instruction(Assembler *assembler, const LexLine *lex, AsmInstruction *inst) {
+    inst->source = lex->body;
+    inst->mnemonic = lex->tokens[0].text;
+    inst->desc = isa_lookup(inst->mnemonic.data, inst->mnemonic.size, span_hash(inst->mnemonic));
+    inst->n_operands = lex->n_tokens - 1;
+    if (inst->n_operands > ASM_MAX_OPERANDS)
+        EXIT_WITH_MSG("[ASM]\tToo many operands: %s\n", span_str(lex->body).c_str());
+
+    for (uint32_t i = 0; i < inst->n_operands; i++) {
+        const Token *token = &lex->tokens[i + 1];
+        Operand *operand = &inst->operands[i];
+        operand->reg = 0;
+        operand->value = token->value;
+        switch (token->kind) {
+            case TOK_REGISTER:
+                operand->kind = OPD_REG;
+                operand->reg = __register(token->reg);
+                break;
+            case TOK_IMMEDIATE:
+                operand->kind = OPD_IMM;
+                break;
+            case TOK_ADDRESS:
+                operand->kind = OPD_ADDR;
+                operand->reg = __register(token->reg);
+                break;
+            case TOK_SYMBOL:
+                operand->kind = OPD_LABEL;
+                operand->value = (int32_t) __symbol(assembler, token->text);
+                break;
+            default:
+                EXIT_WITH_MSG("[ASM]\tInvalid operand: %s\n", span_str(token->text).c_str());
+        }
     }
-    return true;
 }
 
-tokens_t tokenize_str(const std::string &line) {
-    char delimiters[] = "\t ,";
-    char *token;
+/* record a diagnostic of the encoding pass */
+static void __diag(EncodeDiags *diags, const char *format, ...) __attribute__((format(printf, 2, 3)));
 
-    uint32_t n = line.length();
-    char line_str[n + 1];
-    strcpy(line_str, line.c_str());
+static void __diag(EncodeDiags *diags, const char *format, ...) {
+    diags->errors++;
+    if (diags->messages.size() >= ASM_MAX_DIAGS)
+        return;
 
-    token = strtok(line_str, delimiters);
-    tokens_t tokens;
+    char message[512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    diags->messages.push_back(message);
+}
 
-    while (token != NULL) {
-        tokens.push_back(token_t(token));
-        token = strtok(NULL, delimiters);
+/* operand i of an instruction, NULL and a diagnostic if it is missing or of another kind */
+static const Operand *__operand(const AsmInstruction *inst, uint32_t i, uint32_t kind, EncodeDiags *diags) {
+    static const char *const kind_names[] = {"register", "immediate", "label", "address"};
+    if (i >= inst->n_operands || inst->operands[i].kind != kind) {
+        __diag(diags, "[ASM]\tExpected a %s as operand %u: %s\n",
+               kind_names[kind], i + 1, span_str(inst->source).c_str());
+        return NULL;
     }
-
-    return tokens;
+    return &inst->operands[i];
 }
 
-uint32_t __encode_reg(const token_t &reg_str) {
-    token_t reg_key = reg_str;
-    reg_key.erase(std::remove(reg_key.begin(), reg_key.end(), '$'), reg_key.end());
-    return 0x1F & reg_map[reg_key];
+static inline uint32_t __reg(const AsmInstruction *inst, uint32_t i, EncodeDiags *diags) {
+    const Operand *operand = __operand(inst, i, OPD_REG, diags);
+    return operand ? operand->reg : 0;
 }
 
-void __encode_address(const token_t &addr_str, std::string *rs, uint32_t *offset) {
-    std::regex rt_rgx("\\-?\\d+\\(\\$(\\w+\\d?)\\)");
-    std::regex offset_rgx("(\\-?\\d+)\\(\\$\\w+\\d?\\)");
-    std::smatch match;
-
-    // search for offset in the token
-    std::regex_search(addr_str, match, offset_rgx);
-    *offset = 0xFFFF & int16_t(arbstoi(match[1]));
-
-    // search for rt register in the token
-    std::regex_search(addr_str, match, rt_rgx);
-    *rs = match[1];
+static inline int32_t __imm(const AsmInstruction *inst, uint32_t i, EncodeDiags *diags) {
+    const Operand *operand = __operand(inst, i, OPD_IMM, diags);
+    return operand ? operand->value : 0;
 }
 
-std::string __encode_label(Assembler *assembler, const token_t &label_str) {
-    if (assembler->label_map.find(label_str) == assembler->label_map.end())
-        EXIT_WITH_MSG("Assembly contains not defined label: %s\n", label_str.c_str());
-    return std::to_string(assembler->label_map[label_str]);
+/* word index of a label operand */
+static uint32_t __label(const Assembler *assembler, const AsmInstruction *inst, uint32_t i, EncodeDiags *diags) {
+    const Operand *operand = __operand(inst, i, OPD_LABEL, diags);
+    if (!operand)
+        return 0;
+
+    uint32_t symbol = (uint32_t) operand->value;
+    if (assembler->symbols[symbol] == ASM_UNDEFINED) {
+        __diag(diags, "[ASM]\tUndefined label: %s\n",
+               span_str(assembler->symbol_names[symbol]).c_str());
+        return 0;
+    }
+    return assembler->symbols[symbol];
 }
 
-std::string __encode_label_to_offset(Assembler *assembler, const token_t &label_str, uint32_t pointat) {
-    if (assembler->label_map.find(label_str) == assembler->label_map.end())
-        EXIT_WITH_MSG("Assembly contains not defined label: %s\n", label_str.c_str());
-    int32_t offset = (assembler->label_map[label_str] - pointat);
-    return std::to_string(offset);
+/* branch offset of a label operand, pointat being the next instruction */
+static inline int32_t __label_offset(const Assembler *assembler, const AsmInstruction *inst, uint32_t i,
+                                     uint32_t pointat, EncodeDiags *diags) {
+    return (int32_t) (__label(assembler, inst, i, diags) - pointat);
 }
 
-uint32_t __encode_rtype(const tokens_t &tokens,
-                        const uint32_t opcode,
+uint32_t __encode_rtype(const uint32_t opcode, uint32_t rs, uint32_t rt, uint32_t rd, uint32_t shamt,
                         const uint32_t funct) {
 
     // Encode format:
@@ -92,44 +171,21 @@ uint32_t __encode_rtype(const tokens_t &tokens,
     //|   opcode  |    rs   |    rt   |    rd   |  shamt  |   funct   |
     //+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
-    uint32_t rs = __encode_reg(tokens[1]);
-    uint32_t rt = __encode_reg(tokens[2]);
-    uint32_t rd = __encode_reg(tokens[3]);
-    uint32_t shamt = 0x1F & (arbstoi(tokens[4]));
-    uint32_t bin = (opcode << 26) | (rs << 21) | (rt << 16) |
-                   (rd << 11) | (shamt << 6) | funct;
-    PRINTF_DEBUG_VERBOSE(verbose,
-                         "[ASM]\t[ENCODE]\tInstruction: %s  %s,%s,%s [%d]"
-                         "\t\t----->\t\t%s\n",
-                         tokens[0].c_str(),
-                         tokens[1].c_str(),
-                         tokens[2].c_str(),
-                         tokens[3].c_str(),
-                         shamt,
-                         std::bitset<32>(bin).to_string().c_str());
-
-    return bin;
+    return (opcode << 26) | (rs << 21) | (rt << 16) |
+           (rd << 11) | ((0x1F & shamt) << 6) | funct;
 }
 
-uint32_t __encode_jtype(const tokens_t &tokens, const uint32_t opcode) {
+uint32_t __encode_jtype(const uint32_t opcode, uint32_t address) {
     // Encode format:
     // 0                   1                   2                   3
     // 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
     //+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
     //|   opcode  |                      address                      |
     //+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
-    uint32_t address = 0x3FFFFFF & arbstoi(tokens[1]);
-    uint32_t bin = (opcode << 26) | address;
-    PRINTF_DEBUG_VERBOSE(verbose,
-                         "[ASM]\t[ENCODE]\tInstruction: %s  %s"
-                         "\t\t----->\t\t%s\n",
-                         tokens[0].c_str(),
-                         tokens[1].c_str(),
-                         std::bitset<32>(bin).to_string().c_str());
-    return bin;
+    return (opcode << 26) | (0x3FFFFFF & address);
 }
 
-uint32_t __encode_itype(const tokens_t &tokens, const uint32_t opcode) {
+uint32_t __encode_itype(const uint32_t opcode, uint32_t rs, uint32_t rt, int32_t immediate) {
 
     // Encode format:
     // 0                   1                   2                   3
@@ -138,740 +194,294 @@ uint32_t __encode_itype(const tokens_t &tokens, const uint32_t opcode) {
     //|   opcode  |    rs   |    rt   |              imm              |
     //+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
 
-    uint32_t rs = __encode_reg(tokens[1]);
-    uint32_t rt = __encode_reg(tokens[2]);
-    uint32_t immediate = 0xFFFF & int16_t(arbstoi(tokens[3]));
-    uint32_t bin = (opcode << 26) | (rs << 21) | (rt << 16) | immediate;
-    PRINTF_DEBUG_VERBOSE(verbose,
-                         "[ASM]\t[ENCODE]\tInstruction: %s  %s,%s,%s"
-                         "\t\t----->\t\t%s\n",
-                         tokens[0].c_str(),
-                         tokens[1].c_str(),
-                         tokens[2].c_str(),
-                         tokens[3].c_str(),
-                         std::bitset<32>(bin).to_string().c_str());
-    return bin;
-}
-
-uint32_t __encode_ls(const tokens_t &tokens, const uint32_t opcode) {
-    // l/s rt, address -> rs, rt, offset
-    uint32_t offset;
-    std::string rs;
-    __encode_address(tokens[2], &rs, &offset);
-    tokens_t _tokens{tokens[0], rs, tokens[1], std::to_string(offset)};
-    return __encode_itype(_tokens, opcode);
+    return (opcode << 26) | (rs << 21) | (rt << 16) | (0xFFFF & immediate);
 }
 
-bool encode(Assembler *assembler, tokens_t &tokens, uint32_t *bin, uint32_t pointat) {
-    token_t opcode_string = tokens[0];
-    switch (hash(opcode_string.c_str())) {
-
-        case hash("add"): {
-            // add rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x20);
-            break;
-        }
-
-        case hash("addu"): {
-            // addu rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x21);
-            break;
-        }
-
-        case hash("addi"): {
-            // addi rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0x8);
-            break;
-        }
-
-        case hash("addiu"): {
-            // addiu rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0x9);
-            break;
-        }
-
-        case hash("and"): {
-            // and rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x24);
-            break;
-        }
-
-        case hash("andi"): {
-            // andi rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0xc);
-            break;
-        }
-
-        case hash("clo"): {
-            // clo rd, rs -> rs, 0x0, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], "0x0", tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x1c, 0x21);
-            break;
-        }
-
-        case hash("clz"): {
-            // clz rd, rs -> rs, 0x0, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], "0x0", tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x1c, 0x20);
-            break;
-        }
-
-        case hash("div"): {
-            // div rs, rt -> rs, rt, 0x1a
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x1a"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("divu"): {
-            // divu rs, rt -> rs, rt, 0x1b
-            tokens.push_back(token_t("0x1b"));
-            *bin = __encode_itype(tokens, 0x0);
-            break;
-        }
-
-        case hash("mult"): {
-            // mult rs, rt -> rs, rt, 0x18
-            tokens.push_back(token_t("0x18"));
-            *bin = __encode_itype(tokens, 0x0);
-            break;
-        }
-
-        case hash("madd"): {
-            // madd rs, rt -> rs, rt, 0x0
-            tokens.push_back(token_t("0x0"));
-            *bin = __encode_itype(tokens, 0x1c);
-            break;
-        }
-
-        case hash("msub"): {
-            // msub rs, rt -> rs, rt, 0x4
-            tokens.push_back(token_t("0x4"));
-            *bin = __encode_itype(tokens, 0x1c);
-            break;
-        }
-
-        case hash("maddu"): {
-            // maddu rs, rt -> rs, rt, 0x1
-            tokens.push_back(token_t("0x1"));
-            *bin = __encode_itype(tokens, 0x1c);
-            break;
-        }
-
-        case hash("msubu"): {
-            // msubu rs, rt -> rs, rt, 0x4
-            tokens.push_back(token_t("0x5"));
-            *bin = __encode_itype(tokens, 0x1c);
-            break;
-        }
-
-        case hash("nor"): {
-            // nor rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x27);
-            break;
-        }
-
-        case hash("or"): {
-            // or rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x25);
-            break;
-        }
-
-        case hash("ori"): {
-            // ori rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0xd);
-            break;
-        }
-
-        case hash("sll"): {
-            // sll rd, rt, shamt -> rs, rt, rd, shamt
-            tokens_t _t{tokens[0], "$zero", tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_rtype(_t, 0x0, 0x0);
-            break;
-        }
-
-        case hash("sllv"): {
-            // sllv rd, rt, rs -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[3], tokens[2], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x4);
-            break;
-        }
-
-        case hash("sra"): {
-            // sra rd, rt, shamt -> rs, rt, rd, shamt
-            tokens_t _t{tokens[0], "$zero", tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_rtype(_t, 0x0, 0x3);
-            break;
-        }
-
-        case hash("srav"): {
-            // srav rd, rt, rs -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[3], tokens[2], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x7);
-            break;
-        }
-
-        case hash("srl"): {
-            // srl rd, rt, shamt -> rs, rt, rd, shamt
-            tokens_t _t{tokens[0], "$zero", tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_rtype(_t, 0x0, 0x2);
-            break;
-        }
-
-        case hash("srlv"): {
-            // srlv rd, rt, rs -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[3], tokens[2], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x6);
-            break;
-        }
-
-        case hash("sub"): {
-            // sub rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x22);
-            break;
-        }
-
-        case hash("subu"): {
-            // subu rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x23);
-            break;
-        }
-
-        case hash("xor"): {
-            // xor rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x26);
-            break;
-        }
-
-        case hash("xori"): {
-            // xori rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0xe);
-            break;
-        }
-
-        case hash("lui"): {
-            // lui rt, imm -> 0x0, rt, imm
-            tokens_t _t{tokens[0], "0x0", tokens[1], tokens[2]};
-            *bin = __encode_itype(_t, 0xf);
-            break;
-        }
-
-        case hash("slt"): {
-            // slt rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x2a);
-            break;
-        }
-
-        case hash("sltu"): {
-            // sltu rd, rs, rt -> rs, rt, rd, 0x0
-            tokens_t _t{tokens[0], tokens[2], tokens[3], tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x2b);
-            break;
-        }
-
-        case hash("slti"): {
-            // slti rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0xa);
-            break;
-        }
-
-        case hash("sltiu"): {
-            // sltiu rt, rs, imm -> rs, rt, imm
-            tokens_t _t{tokens[0], tokens[2], tokens[1], tokens[3]};
-            *bin = __encode_itype(_t, 0xb);
-            break;
-        }
-
-        case hash("beq"): {
-            // beq rs, rt, offset
-            tokens[3] = __encode_label_to_offset(assembler, tokens[3], pointat);
-            *bin = __encode_itype(tokens, 0x4);
-            break;
-        }
-
-        case hash("bgez"): {
-            // bgez rs, label -> rs, 0x1, offset
-            tokens_t _t{tokens[0], tokens[1], "0x1", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("bgezal"): {
-            // bgezal rs, label-> rs, 0x11, offset
-            tokens_t _t{tokens[0], tokens[1], "0x11", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("bgtz"): {
-            // bgtz rs, label -> rs, 0x0, offset
-            tokens_t _t{tokens[0], tokens[1], "0x0", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x7);
-            break;
-        }
-
-        case hash("blez"): {
-            // blez rs, label -> rs, 0x0, offset
-            tokens_t _t{tokens[0], tokens[1], "0x0", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x6);
-            break;
-        }
-
-        case hash("bltzal"): {
-            // bltzal rs, label -> rs, 0x10, offset
-            tokens_t _t{tokens[0], tokens[1], "0x10", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("bltz"): {
-            // bltz rs, label -> rs, 0x0, offset
-            tokens_t _t{tokens[0], tokens[1], "0x0", __encode_label_to_offset(assembler, tokens[2], pointat)};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("bne"): {
-            // bne rs, rt, label -> rs, rt, offset
-            tokens[3] = __encode_label_to_offset(assembler, tokens[3], pointat);
-            *bin = __encode_itype(tokens, 0x5);
-            break;
-        }
-
-        case hash("j"): {
-            // j target
-            tokens[1] = __encode_label(assembler, tokens[1]);
-            *bin = __encode_jtype(tokens, 0x2);
-            break;
-        }
-
-        case hash("jal"): {
-            // jal target
-            tokens[1] = __encode_label(assembler, tokens[1]);
-            *bin = __encode_jtype(tokens, 0x3);
-            break;
-        }
-
-        case hash("jalr"): {
-            // jalr rs, rd -> rs, 0x0, rd, 0x0
-            tokens_t _t{tokens[0], tokens[1], "0x0", tokens[2], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x9);
-            break;
-        }
-
-        case hash("jr"): {
-            // jr rs -> rs, 0x0, 0x8
-            tokens_t _t{tokens[0], tokens[1], "0x0", "0x8"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("teq"): {
-            // teq rs, rt -> rs, rt, 0x0
-            tokens.push_back("0x0");
-            *bin = __encode_rtype(tokens, 0x0, 0x34);
-            break;
-        }
-
-        case hash("teqi"): {
-            // teqi rs, imm -> rs, 0xc, imm
-            tokens_t _t{tokens[0], tokens[1], "0xc", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("tne"): {
-            // tne rs, rt -> rs, rt, 0x36
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x36"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("tnei"): {
-            // tnei rs, imm -> rs, 0xe, imm
-            tokens_t _t{tokens[0], tokens[1], "0xe", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("tge"): {
-            // tge rs, rt -> rs, rt, 0x30
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x30"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("tgeu"): {
-            // tgeu rs, rt -> rs, rt, 0x31
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x31"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("tgei"): {
-            // tgei rs, imm -> rs, 0x8, imm
-            tokens_t _t{tokens[0], tokens[1], "0x8", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("tgeiu"): {
-            // tgeiu rs, imm -> rs, 0x9, imm
-            tokens_t _t{tokens[0], tokens[1], "0x9", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("tlt"): {
-            // tlt rs, rt -> rs, rt, 0x32
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x32"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("tltu"): {
-            // tltu rs, rt -> rs, rt, 0x33
-            tokens_t _t{tokens[0], tokens[1], tokens[2], "0x33"};
-            *bin = __encode_itype(_t, 0x0);
-            break;
-        }
-
-        case hash("tlti"): {
-            // tlti rs, imm -> rs, 0xa, imm
-            tokens_t _t{tokens[0], tokens[1], "0xa", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("tltiu"): {
-            // tltiu rs, imm -> rs, 0xb, imm
-            tokens_t _t{tokens[0], tokens[1], "0xb", tokens[2]};
-            *bin = __encode_itype(_t, 0x1);
-            break;
-        }
-
-        case hash("lb"): {
-            *bin = __encode_ls(tokens, 0x20);
-            break;
-        }
-
-        case hash("lbu"): {
-            *bin = __encode_ls(tokens, 0x24);
-            break;
-        }
-
-        case hash("lh"): {
-            *bin = __encode_ls(tokens, 0x21);
-            break;
-        }
-
-        case hash("lhu"): {
-            *bin = __encode_ls(tokens, 0x25);
-            break;
-        }
-
-        case hash("lw"): {
-            *bin = __encode_ls(tokens, 0x23);
-            break;
-        }
-
-        case hash("lwl"): {
-            *bin = __encode_ls(tokens, 0x22);
-            break;
-        }
-
-        case hash("lwr"): {
-            *bin = __encode_ls(tokens, 0x26);
-            break;
-        }
-
-        case hash("ll"): {
-            *bin = __encode_ls(tokens, 0x30);
-            break;
-        }
-
-        case hash("sb"): {
-            *bin = __encode_ls(tokens, 0x28);
-            break;
-        }
-
-        case hash("sh"): {
-            *bin = __encode_ls(tokens, 0x29);
-            break;
-        }
+bool encode(const Assembler *assembler, const AsmInstruction *inst, uint32_t *bin, uint32_t pointat,
+            EncodeDiags *diags) {
+    const OpcodeDesc *desc = inst->desc;
+    if (!desc) {
+        __diag(diags, "[ASM]\tUnrecognized instruction: %s\n", span_str(inst->mnemonic).c_str());
+        return 0;
+    }
 
-        case hash("sw"): {
-            *bin = __encode_ls(tokens, 0x2b);
-            break;
+    uint32_t errors = diags->errors;
+
+    // the fields no operand goes to stay 0, which is what a pseudo-instruction leaves out
+    uint32_t rs = 0, rt = 0, rd = 0, shamt = 0, imm = 0;
+    for (uint32_t i = 0; i < ISA_MAX_OPERANDS && desc->fields[i] != FLD_NONE; i++) {
+        switch (desc->fields[i]) {
+            case FLD_RS:
+                rs = __reg(inst, i, diags);
+                break;
+            case FLD_RT:
+                rt = __reg(inst, i, diags);
+                break;
+            case FLD_RD:
+                rd = __reg(inst, i, diags);
+                break;
+            case FLD_SHAMT:
+                shamt = __imm(inst, i, diags);
+                break;
+            case FLD_IMM:
+            case FLD_UIMM:
+                imm = __imm(inst, i, diags);
+                break;
+            case FLD_BRANCH:
+                imm = __label_offset(assembler, inst, i, pointat, diags);
+                break;
+            case FLD_TARGET:
+                imm = __label(assembler, inst, i, diags);
+                break;
+            case FLD_ADDR: {
+                // l/s rt, offset(rs)
+                const Operand *address = __operand(inst, i, OPD_ADDR, diags);
+                if (address) {
+                    rs = address->reg;
+                    imm = address->value;
+                }
+                break;
+            }
         }
+    }
 
-        case hash("swl"): {
-            *bin = __encode_ls(tokens, 0x2a);
-            break;
-        }
+    if (diags->errors != errors)
+        return 0;
 
-        case hash("swr"): {
-            *bin = __encode_ls(tokens, 0x2e);
+    switch (desc->format) {
+        case ISA_R:
+            *bin = __encode_rtype(desc->opcode, rs, rt, rd, shamt, desc->funct);
             break;
-        }
-
-        case hash("sc"): {
-            *bin = __encode_ls(tokens, 0x38);
+        case ISA_REGIMM:
+            *bin = __encode_itype(desc->opcode, rs, desc->funct, imm);
             break;
-        }
-
-        case hash("mfhi"): {
-            // mfhi rd -> 0x0, 0x0, rd, 0x0
-            tokens_t _t{tokens[0], "$zero", "$zero", tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x10);
-        }
+        case ISA_I:
+            *bin = __encode_itype(desc->opcode, rs, rt, imm);
             break;
-
-        case hash("mflo"): {
-            // mflo rd -> 0x0, rd, 0x0
-            tokens_t _t{tokens[0], "$zero", "$zero", tokens[1], "0x0"};
-            *bin = __encode_rtype(_t, 0x0, 0x12);
-        }
+        case ISA_J:
+            *bin = __encode_jtype(desc->opcode, imm);
             break;
+    }
 
-        case hash("mthi"): {
-            // mthi rs -> rs, 0x0, 0x11
-            tokens_t _t{tokens[0], tokens[1], "$zero", "0x11"};
-            *bin = __encode_itype(_t, 0x0);
-        }
-            break;
+    PRINTF_DEBUG_VERBOSE(verbose,
+                         "[ASM]\t[ENCODE]\tInstruction: %s"
+                         "\t\t----->\t\t%s\n",
+                         span_str(inst->source).c_str(),
+                         std::bitset<32>(*bin).to_string().c_str());
+    return 1;
+}
 
-        case hash("mtlo"): {
-            tokens_t _t{tokens[0], tokens[1], "$zero", "0x13"};
-            *bin = __encode_itype(_t, 0x0);
+/* copy the characters of a string literal into the static data, escapes
+ * \\, \n and \t resolved and any other escape dropped
+ * return: the number of bytes copied */
+static uint32_t __load_string(MMBar *mmBar, Span literal) {
+    const char *p = literal.data + 1;
+    const char *end = literal.data + literal.size - 1;
+    uint32_t n = 0;
+    while (p < end) {
+        char c = *p++;
+        if (c == '\\' && p < end) {
+            switch (*p++) {
+                case '\\':
+                    c = '\\';
+                    break;
+                case 'n':
+                    c = '\n';
+                    break;
+                case 't':
+                    c = '\t';
+                    break;
+                default:
+                    continue;
+            }
         }
-            break;
+        mmbar_load_static_u8(mmBar, c);
+        n++;
+    }
+    return n;
+}
 
-        case hash("syscall"):
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[ASM]\t[ENCODE]\tInstruction: syscall\n");
-            *bin = 0xc;
-            break;
+/* a line of the data section: label: .type value */
+static void __catalyze_data(Assembler *assembler, const LexLine *lex) {
+    bool complete = lex->label.size && lex->n_tokens >= 2 && lex->tokens[0].kind == TOK_DIRECTIVE;
+    Span type = complete ? lex->tokens[0].text : span_of(lex->body.data, 0);
+    const Token *data = &lex->tokens[1];
+    Span value = complete ? span_of(data->text.data, lex->body.data + lex->body.size - data->text.data)
+                          : span_of(lex->body.data, 0);
+
+    PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DATA]\t\t%s:\t%s\t%s\n",
+                         span_str(lex->label).c_str(), span_str(type).c_str(), span_str(value).c_str());
+
+    if (span_eq(type, ".ascii") || span_eq(type, ".asciiz")) {
+        if (data->kind != TOK_STRING)
+            EXIT_WITH_MSG("[ASM]\t[DATA]\tExpected a string: %s\n", span_str(value).c_str());
+
+        // padded to a word, with a whole word of padding when already aligned
+        uint32_t ac = __load_string(assembler->mmBar, data->text);
+        if (span_eq(type, ".asciiz")) {
+            mmbar_load_static_u8(assembler->mmBar, '\0');
+            ac++;
+        }
+        for (int32_t i = 0; i < 4 - ac % 4; i++)
+            mmbar_load_static_u8(assembler->mmBar, 0);
+        return;
+    }
 
-        default:
-            PRINTF_ERR_STAMP("[!] unrecognized instruction: %s\n", opcode_string.c_str());
-            return 0;
+    if (!span_eq(type, ".word") && !span_eq(type, ".half") && !span_eq(type, ".byte"))
+        EXIT_WITH_MSG("[ASM]\t[DATA]\tUnrecognized data type: %s\n", span_str(type).c_str());
+    if (data->kind != TOK_IMMEDIATE)
+        EXIT_WITH_MSG("[ASM]\t[DATA]\tInvalid number: %s\n", span_str(data->text).c_str());
 
+#define LOLO_MASK 0xFFUL
+    uint32_t d = (uint32_t) data->value;
+    if (span_eq(type, ".word")) {
+        uint8_t blhh = d >> 24;
+        uint8_t blhl = (d >> 16) & LOLO_MASK;
+        uint8_t bllh = (d >> 8) & LOLO_MASK;
+        uint8_t blll = d & LOLO_MASK;
+
+        mmbar_load_static_u8(assembler->mmBar, blll);
+        mmbar_load_static_u8(assembler->mmBar, bllh);
+        mmbar_load_static_u8(assembler->mmBar, blhl);
+        mmbar_load_static_u8(assembler->mmBar, blhh);
+    } else if (span_eq(type, ".half")) {
+        uint8_t hi = (d >> 8) & LOLO_MASK;
+        uint8_t lo = d & LOLO_MASK;
+
+        mmbar_load_static_u8(assembler->mmBar, lo);
+        mmbar_load_static_u8(assembler->mmBar, hi);
+    } else {
+        mmbar_load_static_u8(assembler->mmBar, d & LOLO_MASK);
     }
-
-    return 1;
+#undef LOLO_MASK
 }
 
 bool __catalyze_content(Assembler *assembler) {
     bool contentAllText = true;
     bool inText = false, inData = false;
-    uint32_t pointat = 0x100000;
-
-    for (std::string line: assembler->content) {
-        line = std::regex_replace(line, std::regex("^[ \t]+"), "");
-        line = std::regex_replace(line, std::regex("[ \t]+$"), "");
-        line = removeComments(line);
-
-        if (isLineEmpty(line))
-            continue;
-
-        if (hash(line.c_str()) == hash(".text")) {
+    // labels are word indices into the text segment
+    uint32_t pointat = assembler->mmBar->layout.text_start >> 2;
+    LexLine lex;
+    const char *line;
+    size_t n;
+
+    input_rewind(&assembler->source);
+    while (input_next_line(&assembler->source, &line, &n)) {
+        __lex(line, n, &lex);
+        if (__is_section(&lex, ".text")) {
             contentAllText = false;
             break;
         }
     }
 
-    for (std::string line: assembler->content) {
-        // remove leading and trailing spaces
-        line = std::regex_replace(line, std::regex("^[ \t]+"), "");
-        line = std::regex_replace(line, std::regex("[ \t]+$"), "");
-        line = removeComments(line);
+    // at most an instruction per line; the pages of the reservation that
+    // comments and data leave unused are never touched
+    const InputSource *source = &assembler->source;
+    assembler->text.reserve(std::count(source->data, source->data + source->size, '\n') + 1);
 
-        if (isLineEmpty(line))
+    input_rewind(&assembler->source);
+    while (input_next_line(&assembler->source, &line, &n)) {
+        __lex(line, n, &lex);
+        if (!lex.label.size && !lex.n_tokens)
             continue;
 
         if (!contentAllText) {
-            switch (hash(line.c_str())) {
-
-                case hash(".text"):
-                    PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DT]\t\t%s\n", line.c_str());
-                    inText = true;
-                    inData = false;
-                    continue;
-
-                case hash(".data"):
-                    PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DD]\t\t%s\n", line.c_str());
-                    inText = false;
-                    inData = true;
-                    continue;
-
-                default:
-                    break;
+            if (__is_section(&lex, ".text")) {
+                PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DT]\t\t%s\n", ".text");
+                inText = true;
+                inData = false;
+                continue;
+            }
 
+            if (__is_section(&lex, ".data")) {
+                PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DD]\t\t%s\n", ".data");
+                inText = false;
+                inData = true;
+                continue;
             }
         }
 
         if (inText || contentAllText) {
-            if (isLineALabel(line)) {
-                std::regex label_rgx("(.+):.*");
-                std::regex remainder_rgx(".+:\\s*(.*)");
-                std::smatch match;
-
-                // search for label in the line
-                std::regex_search(line, match, label_rgx);
-                std::string label = match[1];
-
-                // search for remaining content in the line
-                std::regex_search(line, match, remainder_rgx);
-                std::string line_remainder = match[1];
-
-                PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[LABEL]\t\t%s\t----->\tpoint_at: 0x%X\n", label.c_str(), pointat);
-                assembler->label_map[label] = pointat;
+            if (lex.label.size) {
+                PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[LABEL]\t\t%s\t----->\tpoint_at: 0x%X\n",
+                                     span_str(lex.label).c_str(), pointat);
+                assembler->symbols[__symbol(assembler, lex.label)] = pointat;
+            }
 
-                if (!line_remainder.empty()) {
-                    assembler->text_section.push_back(line_remainder);
-                    pointat += 1;
-                }
-            } else {
-                assembler->text_section.push_back(line);
+            if (lex.n_tokens) {
+                assembler->text.push_back(AsmInstruction());
+                __parse_instruction(assembler, &lex, &assembler->text.back());
                 pointat += 1;
             }
         } else if (inData && assembler->user_options->full_flow) {
-            std::regex label_rgx("(.+):\\s+\\..+\\s+.+");
-            std::regex type_rgx(".+:\\s+(\\.((asciiz)|(ascii)|(word)|(byte)|(half)))\\s+.+");
-            std::regex data_rgx(".+:\\s+\\.(asciiz|ascii|word|byte|half)\\s+(.+)");
-            std::smatch match;
-
-            // search for label in the line
-            std::regex_search(line, match, label_rgx);
-            std::string label = match[1];
-
-            // search for type in the line
-            std::regex_search(line, match, type_rgx);
-            std::string type = match[1];
-
-            // search for data in the line
-            std::regex_search(line, match, data_rgx);
-            std::string data = match[2];
-
-            PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[DATA]\t\t%s:\t%s\t%s\n",
-                                 label.c_str(), type.c_str(), data.c_str());
-
-            switch (hash(type.c_str())) {
-                case hash(".ascii"): {
-                    std::regex ctrgx("\\\"(.*)\\\"");
-                    std::regex_search(data, match, ctrgx);
-
-                    std::string escaped_string = unescape(match[1]);
-                    std::string::const_iterator it = escaped_string.begin();
-
-                    uint32_t ac = 0;
-                    while (it != escaped_string.end()) {
-                        ac++;
-                        char c = *it++;
-                        mmbar_load_static_u8(assembler->mmBar, c);
-                    }
-
-                    for (int32_t i = 0; i < 4 - ac % 4; i++)
-                        mmbar_load_static_u8(assembler->mmBar, 0);
-
-                    break;
-                }
-
-                case hash(".asciiz"): {
-                    std::regex ctrgx("\\\"(.*)\\\"");
-                    std::regex_search(data, match, ctrgx);
-
-                    std::string escaped_string = unescape(match[1]);
-                    std::string::const_iterator it = escaped_string.begin();
-
-                    uint32_t ac = 0;
-                    while (it != escaped_string.end()) {
-                        ac++;
-                        char c = *it++;
-                        mmbar_load_static_u8(assembler->mmBar, c);
-                    }
-                    mmbar_load_static_u8(assembler->mmBar, '\0');
-
-                    for (int32_t i = 0; i < 4 - (ac + 1) % 4; i++)
-                        mmbar_load_static_u8(assembler->mmBar, 0);
-
-                    break;
-                }
-
-                case hash(".word"): {
-                    uint32_t d = (uint32_t) arbstoi(data);
-#define LOLO_MASK 0xFFUL
-                    uint8_t blhh = d >> 24;
-                    uint8_t blhl = (d >> 16) & LOLO_MASK;
-                    uint8_t bllh = (d >> 8) & LOLO_MASK;
-                    uint8_t blll = d & LOLO_MASK;
-
-                    mmbar_load_static_u8(assembler->mmBar, blll);
-                    mmbar_load_static_u8(assembler->mmBar, bllh);
-                    mmbar_load_static_u8(assembler->mmBar, blhl);
-                    mmbar_load_static_u8(assembler->mmBar, blhh);
-
-                    break;
-                }
-
-                case hash(".byte"): {
-                    uint8_t d = (uint8_t) arbstoi(data);
-                    mmbar_load_static_u8(assembler->mmBar, d);
-                    break;
-                }
-
-                case hash(".half"): {
-                    uint16_t d = (uint16_t) arbstoi(data);
-                    uint8_t hi = d >> 8;
-                    uint8_t lo = d & LOLO_MASK;
-
-                    mmbar_load_static_u8(assembler->mmBar, lo);
-                    mmbar_load_static_u8(assembler->mmBar, hi);
-
-                    break;
-                }
-
-                default: {
-                    EXIT_WITH_MSG("[ASM]\t[DATA]\tUnrecognized data type: %s\n", type.c_str());
-                }
-            }
-
+            __catalyze_data(assembler, &lex);
         }
     }
 
     return 1;
 }
 
-bool __parse(Assembler *assembler) {
-    uint32_t pointat = 0x100000;
-    for (auto line: assembler->text_section) {
-        tokens_t tokens = tokenize_str(line);
-        uint32_t bin_line;
-        pointat++;
-
-        if (!encode(assembler, tokens, &bin_line, pointat)) {
-            return 0;
+/* The encoding pass over assembler->text. Every instruction only needs the
+ * symbols of the first pass and its own index, so workers take chunks of
+ * it and write straight into the preallocated bin */
+struct EncodePass {
+    const Assembler *assembler;
+    uint32_t *bin;                          // assembler->bin, one word per instruction
+    uint32_t text_word;                     // word index of the first instruction
+    uint32_t n_chunks;
+    std::atomic<uint32_t> next_chunk;
+    std::vector<EncodeDiags> diags;         // by chunk
+};
+
+static void __encode_chunks(EncodePass *pass) {
+    const Assembler *assembler = pass->assembler;
+    uint32_t n = (uint32_t) assembler->text.size();
+    uint32_t chunk;
+    while ((chunk = pass->next_chunk.fetch_add(1, std::memory_order_relaxed)) < pass->n_chunks) {
+        EncodeDiags *diags = &pass->diags[chunk];
+        uint32_t end = std::min(n, (chunk + 1) * ASM_CHUNK);
+        for (uint32_t i = chunk * ASM_CHUNK; i < end; i++) {
+            encode(assembler, &assembler->text[i], &pass->bin[i], pass->text_word + i + 1, diags);
         }
+    }
+}
 
-        assembler->bin.push_back(bin_line);
+bool __parse(Assembler *assembler) {
+    uint32_t n = (uint32_t) assembler->text.size();
+    assembler->bin.assign(n, 0);
+
+    EncodePass pass;
+    pass.assembler = assembler;
+    pass.bin = assembler->bin.data();
+    pass.text_word = assembler->mmBar->layout.text_start >> 2;
+    pass.n_chunks = (n + ASM_CHUNK - 1) / ASM_CHUNK;
+    pass.next_chunk = 0;
+    pass.diags.resize(pass.n_chunks);
+    for (uint32_t i = 0; i < pass.n_chunks; i++)
+        pass.diags[i].errors = 0;
+
+    // the verbose trace is written in source order by one thread
+    uint32_t n_workers = assembler->user_options->jobs ? assembler->user_options->jobs
+                                                       : std::thread::hardware_concurrency();
+    if (verbose || n_workers > pass.n_chunks)
+        n_workers = verbose ? 1 : pass.n_chunks;
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 1; i < n_workers; i++)
+        workers.push_back(std::thread(__encode_chunks, &pass));
+    __encode_chunks(&pass);
+    for (auto &worker: workers)
+        worker.join();
+
+    uint32_t errors = 0, reported = 0;
+    for (const EncodeDiags &diags: pass.diags) {
+        errors += diags.errors;
+        for (uint32_t i = 0; i < diags.messages.size() && reported < ASM_MAX_DIAGS; i++, reported++)
+            PRINTF_ERR_STAMP("%s", diags.messages[i].c_str());
     }
-    return true;
+    if (errors > reported)
+        PRINTF_ERR_STAMP("[ASM]\t%u more errors not shown\n", errors - reported);
+    return !errors;
 }
 
 bool __finalize(Assembler *assembler) {
@@ -912,18 +522,22 @@ void assembler_exec(Assembler *assembler) {
 }
 
 void assembler_free(Assembler *assembler) {
-
+    input_close(&assembler->source);
 }
 
 bool __parse_file(Assembler *assembler) {
-    std::ifstream ELF_file(assembler->ELF_path);
-    std::string line;
-
-    while (std::getline(ELF_file, line)) {
-        PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[ELF]\t\t%s\n", line.c_str());
-        assembler->content.push_back(line);
+    // the lines stay in the mapping (or, from a pipe, the window) for both
+    // passes, the symbols and instructions point into it
+    if (!input_open(&assembler->source, assembler->ELF_path.c_str()))
+        return 0;
+    input_hold(&assembler->source);
+
+    if (verbose) {
+        const char *line;
+        size_t n;
+        while (input_next_line(&assembler->source, &line, &n))
+            PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\t[ELF]\t\t%s\n", std::string(line, n).c_str());
     }
-
     return 1;
 }
 
@@ -948,7 +562,4 @@ void assembler_init(Assembler *assembler, std::string ELF_path, bool loadFromELF
     } else {
 
     }
-
-    PRINTF_DEBUG_VERBOSE(verbose, "[ASM]\tInitialize register map\n");
-    reg_map = create_regparse_map();
 }
\ No newline at end of file
@@ -0,0 +1,350 @@
+/**
+ * @filename: batch.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: in-process batch runner over a manifest of jobs
+ * @date: 3/27/2021
+ */
+
+#include "batch.hh"
+#include "psim.hh"
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+/* A program assembled once for every job that runs it. Jobs only read it,
+ * through a const pointer: each copies the text and static data into its own
+ * guest memory, which the guest may write */
+struct BatchImage {
+    std::string path;
+    std::vector<uint32_t> bin;
+    std::vector<uint8_t> data;              // static data from layout.data_start
+    bool ok;
+    std::string message;
+};
+
+/* Jobs waiting on one worker: the owner takes from the back, a worker whose
+ * own queue ran dry steals from the front of the others */
+struct WorkQueue {
+    std::mutex lock;
+    std::deque<uint32_t> jobs;
+};
+
+struct Batch {
+    Options options;                        // shared by every job, output options off
+    MemLayout layout;
+    std::vector<BatchJob> jobs;
+    std::vector<BatchImage> images;
+    std::vector<JobResult> results;
+    VfsImage vfs_image;                     // preloaded files of --vfs, each job works on its own copy
+};
+
+/* everything a trapped call needs */
+struct JobRun {
+    Batch *batch;
+    BatchJob *job;
+    JobResult *result;
+    Simulator *simulator;
+    Assembler *assembler;
+    MMBar *mmBar;
+};
+
+/* run fn(run) with trap armed on this thread, false if it left through it */
+static bool __run_trapped(ExitTrap *trap, void (*fn)(JobRun *), JobRun *run) {
+    trap->message[0] = '\0';
+    exit_trap = trap;
+    try {
+        fn(run);
+    } catch (const ExitTrap &) {
+        return false;
+    }
+    exit_trap = NULL;
+    return true;
+}
+
+static std::string __resolve(const std::string &dir, const std::string &path) {
+    if (path == "-")
+        return std::string();
+    if (dir.empty() || path[0] == '/')
+        return path;
+    return dir + "/" + path;
+}
+
+static void __parse_manifest(Batch *batch) {
+    const char *path = batch->options.batch;
+    if (!isFileExist(path))
+        EXIT_WITH_MSG("[BATCH]\tFailed to read manifest: %s\n", path);
+
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash);
+
+    std::map<std::string, uint32_t> image_of;
+    std::ifstream manifest(path);
+    std::string line;
+    uint32_t n_line = 0;
+    while (std::getline(manifest, line)) {
+        n_line++;
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string asm_path, input, expected, budget, timeout, files;
+        if (!(fields >> asm_path))
+            continue;
+        if (!(fields >> input >> expected))
+            EXIT_WITH_MSG("[BATCH]\tManifest line %u: expected ASM INPUT|- EXPECTED|- "
+                          "[BUDGET [TIMEOUT_MS [FILES|-]]]\n", n_line);
+
+        BatchJob job;
+        job.asm_path = __resolve(dir, asm_path);
+        job.input_path = __resolve(dir, input);
+        job.expected_path = __resolve(dir, expected);
+        job.budget = batch->options.job_budget;
+        job.timeout_ms = batch->options.job_timeout_ms;
+        if (fields >> budget)
+            job.budget = strtoull(budget.c_str(), NULL, 0);
+        if (fields >> timeout)
+            job.timeout_ms = (uint32_t) strtoul(timeout.c_str(), NULL, 0);
+        if (fields >> files) {
+            if (!batch->options.vfs)
+                EXIT_WITH_MSG("[BATCH]\tManifest line %u: expected files need --vfs\n", n_line);
+            job.files_path = __resolve(dir, files);
+        }
+        if (job.files_path.empty() && batch->options.vfs_expect)
+            job.files_path = batch->options.vfs_expect;
+
+        std::map<std::string, uint32_t>::iterator it = image_of.find(job.asm_path);
+        if (it == image_of.end()) {
+            it = image_of.insert(std::make_pair(job.asm_path, (uint32_t) batch->images.size())).first;
+            batch->images.push_back(BatchImage());
+            batch->images.back().path = job.asm_path;
+        }
+        job.image = it->second;
+        batch->jobs.push_back(job);
+    }
+}
+
+static void __assemble(JobRun *run) {
+    Assembler *assembler = run->assembler;
+    assembler_init(assembler, run->batch->images[run->job->image].path, true);
+    assembler->user_options = &run->batch->options;
+    assembler->mmBar = run->mmBar;
+    assembler_exec(assembler);
+}
+
+/* assemble every distinct program up front, once rather than per job */
+static void __build_images(Batch *batch) {
+    for (uint32_t i = 0; i < batch->images.size(); i++) {
+        BatchImage *image = &batch->images[i];
+        Assembler assembler;
+        MMBar mmBar;
+        BatchJob job;
+        job.image = i;
+        JobRun run = {batch, &job, NULL, NULL, &assembler, &mmBar};
+        ExitTrap trap;
+
+        mmbar_init(&mmBar, &batch->layout);
+        image->ok = __run_trapped(&trap, __assemble, &run);
+        if (image->ok) {
+            image->bin.swap(assembler.bin);
+            image->data.assign(mmBar._memory + batch->layout.data_start,
+                               mmBar._memory + mmBar.static_end_addr);
+        } else {
+            image->message = trap.message;
+        }
+        mmbar_free(&mmBar);
+        assembler_free(&assembler);
+    }
+}
+
+/* everything of a job before its first instruction */
+static void __job_setup(JobRun *run) {
+    Simulator *simulator = run->simulator;
+    const BatchImage *image = &run->batch->images[run->job->image];
+
+    simulator_prepare(simulator);
+    mmbar_load_static(&simulator->mmBar, image->data.data(), (uint32_t) image->data.size());
+    simulator->bin = &image->bin;
+    if (simulator->user_options.input_from_file)
+        load_input(simulator);
+
+    if (run->batch->options.vfs)
+        vfs_init(&simulator->vfs, &run->batch->vfs_image);
+
+    simulator->output = &run->result->output;
+    simulator_limit(simulator, run->job->budget, run->job->timeout_ms);
+}
+
+static void __job_exec(Batch *batch, uint32_t idx) {
+    BatchJob *job = &batch->jobs[idx];
+    JobResult *result = &batch->results[idx];
+    const BatchImage *image = &batch->images[job->image];
+    double start = get_timestamp();
+
+    result->exit_code = 0;
+    result->retired = 0;
+    result->pc = 0;
+    if (!image->ok) {
+        result->status = JOB_ERROR;
+        result->message = image->message;
+    } else {
+        Simulator simulator{};
+        simulator.user_options = batch->options;
+        simulator.user_options.input_file = (char *) job->input_path.c_str();
+        simulator.user_options.input_from_file = !job->input_path.empty();
+        // the files of a job are compared and reported by the batch, never written out
+        simulator.user_options.vfs_dump = NULL;
+        simulator.user_options.vfs_expect = NULL;
+
+        JobRun run = {batch, job, result, &simulator, NULL, NULL};
+        ExitTrap trap;
+        RunResult run_result;
+        if (!__run_trapped(&trap, __job_setup, &run)) {
+            result->status = JOB_ERROR;
+            result->message = trap.message;
+        } else {
+            simulator_try_run(&simulator, &run_result);
+            result->status = run_result.status == RUN_BUDGET ? JOB_BUDGET
+                           : run_result.status == RUN_TIMEOUT ? JOB_TIMEOUT
+                           : run_result.status == RUN_TRAPPED ? JOB_ERROR : JOB_EXITED;
+            result->exit_code = run_result.exit_code;
+            result->retired = run_result.retired;
+            result->pc = run_result.pc;
+            result->message = run_result.message;
+            if (batch->options.vfs && !job->files_path.empty())
+                vfs_compare(&simulator.vfs, job->files_path.c_str(), &result->files);
+        }
+        simulator_release(&simulator);
+    }
+    result->wall_ms = (get_timestamp() - start) * 1000.0;
+
+    result->checked = !job->expected_path.empty() || (batch->options.vfs && !job->files_path.empty());
+    result->matched = result->files.empty();
+    if (!job->expected_path.empty()) {
+        std::ifstream expected(job->expected_path);
+        std::stringstream content;
+        content << expected.rdbuf();
+        result->matched = result->matched && expected.is_open() && content.str() == result->output;
+    }
+}
+
+static bool __next_job(std::vector<WorkQueue> *queues, uint32_t self, uint32_t *idx) {
+    WorkQueue *own = &(*queues)[self];
+    {
+        std::lock_guard<std::mutex> guard(own->lock);
+        if (!own->jobs.empty()) {
+            *idx = own->jobs.back();
+            own->jobs.pop_back();
+            return true;
+        }
+    }
+
+    // no job is queued once the workers started, so empty queues mean done
+    uint32_t n = queues->size();
+    for (uint32_t i = 1; i < n; i++) {
+        WorkQueue *victim = &(*queues)[(self + i) % n];
+        std::lock_guard<std::mutex> guard(victim->lock);
+        if (!victim->jobs.empty()) {
+            *idx = victim->jobs.front();
+            victim->jobs.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+static void __worker(Batch *batch, std::vector<WorkQueue> *queues, uint32_t self) {
+    uint32_t idx;
+    while (__next_job(queues, self, &idx))
+        __job_exec(batch, idx);
+}
+
+static const char *__status_name(uint32_t status) {
+    switch (status) {
+        case JOB_EXITED:
+            return "exited";
+        case JOB_BUDGET:
+            return "budget exceeded";
+        case JOB_TIMEOUT:
+            return "timed out";
+        default:
+            return "error";
+    }
+}
+
+static bool __report(Batch *batch, uint32_t n_workers, double wall_ms) {
+    uint32_t passed = 0;
+    log_sync();
+    for (uint32_t i = 0; i < batch->jobs.size(); i++) {
+        BatchJob *job = &batch->jobs[i];
+        JobResult *result = &batch->results[i];
+        bool ok = result->status == JOB_EXITED && (!result->checked || result->matched);
+        passed += ok;
+
+        printf("[BATCH]\tjob %u: %s", i + 1, __status_name(result->status));
+        if (result->status == JOB_EXITED)
+            printf(" (%d)", result->exit_code);
+        else if (result->status == JOB_BUDGET || result->status == JOB_TIMEOUT)
+            printf(" at 0x%08X", result->pc);
+        if (job->budget || job->timeout_ms)
+            printf(", %lu instructions", (unsigned long) result->retired);
+        printf(", %.2f ms", result->wall_ms);
+        if (result->checked)
+            printf(", %s", result->matched ? "PASS" : "FAIL");
+        printf(", %s < %s\n", job->asm_path.c_str(),
+               job->input_path.empty() ? "-" : job->input_path.c_str());
+
+        if (result->status == JOB_ERROR)
+            printf("\t%s", result->message.c_str());
+        std::istringstream files(result->files);
+        std::string line;
+        while (std::getline(files, line))
+            printf("\tfile %s\n", line.c_str());
+        if (!result->checked && !result->output.empty()) {
+            fwrite(result->output.data(), 1, result->output.size(), stdout);
+            if (result->output[result->output.size() - 1] != '\n')
+                printf("\n");
+        }
+    }
+    printf("[BATCH]\t%u of %lu jobs passed, %lu programs, %u workers, %.2f ms\n",
+           passed, (unsigned long) batch->jobs.size(), (unsigned long) batch->images.size(),
+           n_workers, wall_ms);
+    return passed == batch->jobs.size();
+}
+
+bool batch_exec(Options *options) {
+    Batch batch;
+    batch.options = *options;
+    batch.options.full_flow = true;
+    batch.options.require_output_bin = false;
+    batch.options.require_output_stdout = false;
+    batch.options.report_stats = false;
+    mmbar_layout_default(&batch.layout);
+    if (options->layout)
+        mmbar_layout_parse(&batch.layout, options->layout);
+    if (options->vfs)
+        vfs_image_load(&batch.vfs_image, options->vfs);
+
+    double start = get_timestamp();
+    __parse_manifest(&batch);
+    __build_images(&batch);
+    batch.results.resize(batch.jobs.size());
+
+    uint32_t n_workers = options->jobs ? options->jobs : std::thread::hardware_concurrency();
+    if (n_workers > batch.jobs.size())
+        n_workers = batch.jobs.size();
+    if (n_workers == 0)
+        n_workers = 1;
+
+    std::vector<WorkQueue> queues(n_workers);
+    for (uint32_t i = 0; i < batch.jobs.size(); i++)
+        queues[i % n_workers].jobs.push_back(i);
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < n_workers; i++)
+        workers.push_back(std::thread(__worker, &batch, &queues, i));
+    for (uint32_t i = 0; i < n_workers; i++)
+        workers[i].join();
+
+    return __report(&batch, n_workers, (get_timestamp() - start) * 1000.0);
+}
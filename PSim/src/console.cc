@@ -0,0 +1,106 @@
+/**
+ * @filename: console.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: buffered output channel of the print syscalls
+ * @date: 3/29/2021
+ */
+
+#include "console.hh"
+
+#include <fcntl.h>
+
+// the console of the run on this thread, flushed if the process exits mid-run
+static thread_local Console *__console_active = NULL;
+
+static void __console_flush_active() {
+    if (__console_active)
+        console_flush(__console_active);
+}
+
+void console_open(Console *console, const char *path, std::string *capture, bool buffered) {
+    static bool registered = false;
+    if (!registered) {
+        atexit(__console_flush_active);
+        registered = true;
+    }
+
+    console->fd = -1;
+    console->owned = false;
+    console->capture = capture;
+    console->buffer = NULL;
+    console->used = 0;
+    console->size = 0;
+    if (capture)
+        return;
+
+    if (path) {
+        console->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (console->fd < 0)
+            EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", path);
+        console->owned = true;
+    } else {
+        console->fd = STDOUT_FILENO;
+    }
+
+    if (buffered) {
+        console->buffer = SMALLOC(char, CONSOLE_BUFFER_SIZE);
+        console->size = CONSOLE_BUFFER_SIZE;
+    }
+    __console_active = console;
+}
+
+/* stdout is written through stdio, so that it stays in order with whatever
+ * else the process prints there */
+static void __console_write_through(Console *console, const char *data, size_t n) {
+    if (console->fd == STDOUT_FILENO) {
+        log_sync();
+        fwrite(data, 1, n, stdout);
+        return;
+    }
+
+    size_t done = 0;
+    while (done < n) {
+        ssize_t written = write(console->fd, data + done, n - done);
+        if (written <= 0)
+            break;
+        done += written;
+    }
+}
+
+void __console_spill(Console *console, const char *data, size_t n) {
+    if (console->fd < 0)
+        return;
+    if (console->used)
+        console_flush(console);
+    if (n > console->size) {
+        __console_write_through(console, data, n);
+        return;
+    }
+    memcpy(console->buffer, data, n);
+    console->used = (uint32_t) n;
+}
+
+void console_flush(Console *console) {
+    if (console->fd < 0)
+        return;
+    __console_write_through(console, console->buffer, console->used);
+    console->used = 0;
+    if (console->fd == STDOUT_FILENO)
+        fflush(stdout);
+}
+
+void console_close(Console *console) {
+    console_flush(console);
+    if (console->owned)
+        close(console->fd);
+    if (console->buffer)
+        SFREE(console->buffer);
+    if (__console_active == console)
+        __console_active = NULL;
+    console->fd = -1;
+    console->owned = false;
+    console->capture = NULL;
+    console->buffer = NULL;
+    console->size = 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * @filename: decoder.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: predecoded micro-ops for the simulator's text segment
+ * @date: 3/20/2021
+ */
+
+#include "decoder.hh"
+#include "opcode.h"
+
+#define get_opcode(bin) (bin >> 26)
+#define get_rs(bin) ((bin >> 21) & 0x1F)
+#define get_rt(bin) ((bin >> 16) & 0x1F)
+#define get_rd(bin) ((bin >> 11) & 0x1F)
+#define get_shamt(bin) ((bin >> 6) & 0x1F)
+#define get_imm(bin) ((int16_t)(bin & 0xFFFF))
+
+void decoder_predecode(uint32_t b, MicroOp *uop) {
+    uop->handler = NULL;
+    uop->imm = get_imm(b);
+    uop->rs = get_rs(b);
+    uop->rt = get_rt(b);
+    uop->rd = get_rd(b);
+
+    uint32_t kind;
+    const OpcodeDesc *desc = isa_decode(b);
+    if (desc)
+        kind = desc->uop;
+    else if (get_opcode(b) == 0x0)
+        kind = UOP_BAD_FUNCT;
+    else if (get_opcode(b) == 0x1)
+        kind = UOP_BAD_RBT;
+    else
+        kind = UOP_BAD_OPCODE;
+
+    // the immediate as the handler takes it, sign extended unless said here
+    switch (kind) {
+        case UOP_SLL:
+        case UOP_SRL:
+        case UOP_SRA:
+            uop->imm = get_shamt(b);
+            break;
+        case UOP_SLTIU:
+        case UOP_ANDI:
+        case UOP_ORI:
+        case UOP_XORI:
+            uop->imm = (uint16_t) get_imm(b);
+            break;
+        case UOP_LUI:
+            uop->imm = (int32_t) ((uint32_t) (uint16_t) get_imm(b) << 16);
+            break;
+        case UOP_J:
+        case UOP_JAL:
+            uop->imm = b & 0x3FFFFFF;
+            break;
+        case UOP_BAD_FUNCT:
+        case UOP_BAD_OPCODE:
+            uop->imm = (int32_t) b;
+            break;
+        default:
+            break;
+    }
+    uop->kind = (uint8_t) kind;
+}
+
+#undef get_opcode
+#undef get_rs
+#undef get_rt
+#undef get_rd
+#undef get_shamt
+#undef get_imm
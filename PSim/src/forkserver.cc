@@ -0,0 +1,188 @@
+/**
+ * @filename: forkserver.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: one assembled and loaded program forked once per input file
+ * @date: 3/28/2021
+ */
+
+#include "forkserver.hh"
+#include "psim.hh"
+
+#include <map>
+#include <thread>
+#include <sys/wait.h>
+
+struct ForkRun {
+    std::string input_path;                 // empty for none
+    FILE *output;                           // the child's stdout
+    double start;
+    double wall_ms;
+    int status;                             // as reported by wait()
+    std::string captured;
+};
+
+static void __parse_input_list(const char *path, std::vector<ForkRun> *runs) {
+    if (!isFileExist(path))
+        EXIT_WITH_MSG("[FORK]\tFailed to read input list: %s\n", path);
+
+    // inputs are relative to the list, as the paths of a batch manifest
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+    std::ifstream list(path);
+    std::string line;
+    while (std::getline(list, line)) {
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string input;
+        if (!(fields >> input))
+            continue;
+        ForkRun run;
+        if (input == "-")
+            run.input_path = std::string();
+        else
+            run.input_path = input[0] == '/' ? input : dir + input;
+        runs->push_back(run);
+    }
+}
+
+/* the child: the parent already loaded the text and data and reset the CPU,
+ * only the inputs are its own. It leaves through _exit, exit() would run the
+ * atexit handlers of the parent, e.g. the log writer shutdown, once more */
+static void __child(Simulator *simulator, ForkRun *run) {
+    ExitTrap trap;
+    int status;
+    trap.message[0] = '\0';
+    exit_trap = &trap;
+    try {
+        dup2(fileno(run->output), STDOUT_FILENO);
+        input_close(&simulator->input);
+        simulator->user_options.input_file = (char *) run->input_path.c_str();
+        simulator->user_options.input_from_file = !run->input_path.empty();
+        if (simulator->user_options.input_from_file)
+            load_input(simulator);
+
+        // the deadline of a child counts from its own start
+        if (simulator->user_options.timeout_ms)
+            simulator_limit(simulator, simulator->user_options.max_instructions, simulator->user_options.timeout_ms);
+
+        simulator_resume(simulator);
+        __simulator_report(simulator);
+        status = __simulator_report_stop(simulator);
+    } catch (const ExitTrap &) {
+        // the exit syscalls, or an error whose message is still to be printed
+        if (trap.error)
+            PRINTF_ERR_STAMP("%s", trap.message);
+        status = trap.status;
+    }
+
+    console_flush(&simulator->console);
+    log_sync();
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+static void __collect(ForkRun *run, int status) {
+    run->wall_ms = (get_timestamp() - run->start) * 1000.0;
+    run->status = status;
+
+    int fd = fileno(run->output);
+    char buffer[4096];
+    ssize_t n;
+    lseek(fd, 0, SEEK_SET);
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+        run->captured.append(buffer, n);
+    fclose(run->output);
+    run->output = NULL;
+}
+
+/* the limit a child stopped on, by its exit status, NULL if it exited */
+static const char *__stopped(const Options *options, int status) {
+    if (status == SIM_EXIT_BUDGET && options->max_instructions)
+        return "budget exceeded";
+    if (status == SIM_EXIT_TIMEOUT && options->timeout_ms)
+        return "timed out";
+    return NULL;
+}
+
+static bool __report(const Options *options, std::vector<ForkRun> *runs, uint32_t n_workers, double wall_ms) {
+    uint32_t passed = 0;
+    log_sync();
+    for (uint32_t i = 0; i < runs->size(); i++) {
+        ForkRun *run = &(*runs)[i];
+        const char *input = run->input_path.empty() ? "-" : run->input_path.c_str();
+        if (WIFEXITED(run->status) && __stopped(options, WEXITSTATUS(run->status))) {
+            printf("[FORK]\tinput %u: %s, %.2f ms, %s\n", i + 1, __stopped(options, WEXITSTATUS(run->status)),
+                   run->wall_ms, input);
+        } else if (WIFEXITED(run->status)) {
+            passed += WEXITSTATUS(run->status) == 0;
+            printf("[FORK]\tinput %u: exited (%d), %.2f ms, %s\n",
+                   i + 1, WEXITSTATUS(run->status), run->wall_ms, input);
+        } else {
+            printf("[FORK]\tinput %u: killed by signal %d, %.2f ms, %s\n",
+                   i + 1, WTERMSIG(run->status), run->wall_ms, input);
+        }
+        if (!run->captured.empty()) {
+            fwrite(run->captured.data(), 1, run->captured.size(), stdout);
+            if (run->captured[run->captured.size() - 1] != '\n')
+                printf("\n");
+        }
+    }
+    printf("[FORK]\t%u of %lu inputs exited with 0, %u workers, %.2f ms\n",
+           passed, (unsigned long) runs->size(), n_workers, wall_ms);
+    return passed == runs->size();
+}
+
+bool fork_server_exec(Simulator *simulator) {
+    std::vector<ForkRun> runs;
+    __parse_input_list(simulator->user_options.fork_server, &runs);
+
+    // the children print to their own capture, never to a shared file
+    simulator->user_options.require_output_stdout = false;
+    simulator->user_options.vfs_dump = NULL;
+    double start = get_timestamp();
+    if (simulator->user_options.max_instructions || simulator->user_options.timeout_ms)
+        simulator_limit(simulator, simulator->user_options.max_instructions, simulator->user_options.timeout_ms);
+    simulator_load(simulator);
+
+    uint32_t n_workers = simulator->user_options.jobs ? simulator->user_options.jobs
+                                                      : std::thread::hardware_concurrency();
+    if (n_workers == 0)
+        n_workers = 1;
+
+    std::map<pid_t, uint32_t> running;
+    uint32_t next = 0;
+    while (next < runs.size() || !running.empty()) {
+        while (running.size() < n_workers && next < runs.size()) {
+            ForkRun *run = &runs[next];
+            if (!(run->output = tmpfile()))
+                EXIT_WITH_MSG("[FORK]\tFailed to create the output of input %u\n", next + 1);
+
+            // nothing buffered may be inherited and printed twice
+            fflush(stdout);
+            fflush(stderr);
+            run->start = get_timestamp();
+            pid_t pid = fork();
+            if (pid < 0)
+                EXIT_WITH_MSG("[FORK]\tFailed to fork for input %u\n", next + 1);
+            if (pid == 0)
+                __child(simulator, run);
+            running[pid] = next++;
+        }
+
+        int status;
+        pid_t pid = wait(&status);
+        if (pid < 0)
+            EXIT_WITH_MSG("[FORK]\tFailed to wait for the children\n");
+        std::map<pid_t, uint32_t>::iterator it = running.find(pid);
+        if (it == running.end())
+            continue;
+        __collect(&runs[it->second], status);
+        running.erase(it);
+    }
+
+    simulator_release(simulator);
+    return __report(&simulator->user_options, &runs, n_workers, (get_timestamp() - start) * 1000.0);
+}
@@ -0,0 +1,203 @@
+/**
+ * @filename: input.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: line source of the read syscalls
+ * @date: 3/30/2021
+ */
+
+#include "input.hh"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/mman.h>
+
+bool input_open(InputSource *input, const char *path) {
+    input_close(input);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        if (st.st_size == 0) {
+            close(fd);
+            return true;
+        }
+        void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            close(fd);
+            madvise(data, st.st_size, MADV_SEQUENTIAL);
+            input->data = (const char *) data;
+            input->size = st.st_size;
+            input->mapped = st.st_size;
+            return true;
+        }
+    }
+
+    input->fd = fd;
+    input->capacity = INPUT_CHUNK_SIZE;
+    input->window = SMALLOC(char, input->capacity);
+    input->data = input->window;
+    return true;
+}
+
+void input_open_buffer(InputSource *input, const char *data, size_t n) {
+    input_close(input);
+    input->data = data;
+    input->size = n;
+}
+
+/* move the unread part of the window to its front and read more after it,
+ * growing the window when a single line fills it */
+static bool __input_refill(InputSource *input) {
+    size_t left = input->size - input->pos;
+    memmove(input->window, input->window + input->pos, left);
+    input->pos = 0;
+    input->size = left;
+    if (left == input->capacity) {
+        input->capacity *= 2;
+        input->window = (char *) realloc(input->window, input->capacity);
+        if (!input->window)
+            EXIT_WITH_MSG("[!] insufficient memory\n");
+        input->data = input->window;
+    }
+
+    ssize_t n;
+    do {
+        n = read(input->fd, input->window + input->size, input->capacity - input->size);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) {
+        close(input->fd);
+        input->fd = -1;
+        return false;
+    }
+    input->size += n;
+    return true;
+}
+
+bool input_next_line(InputSource *input, const char **line, size_t *n) {
+    size_t scanned = 0;
+    for (;;) {
+        const char *start = input->data + input->pos;
+        size_t left = input->size - input->pos;
+        const char *end = (const char *) memchr(start + scanned, '\n', left - scanned);
+        if (end) {
+            *line = start;
+            *n = end - start;
+            input->pos += *n + 1;
+            return true;
+        }
+        if (input->fd < 0 || !__input_refill(input))
+            break;
+        scanned = left;
+    }
+
+    // the last line has no newline
+    if (input->pos == input->size)
+        return false;
+    *line = input->data + input->pos;
+    *n = input->size - input->pos;
+    input->pos = input->size;
+    return true;
+}
+
+void input_hold(InputSource *input) {
+    while (input->fd >= 0)
+        __input_refill(input);
+}
+
+void input_rewind(InputSource *input) {
+    input->pos = 0;
+}
+
+void input_close(InputSource *input) {
+    if (input->mapped)
+        munmap((void *) input->data, input->mapped);
+    if (input->fd >= 0)
+        close(input->fd);
+    if (input->window)
+        SFREE(input->window);
+    input->data = NULL;
+    input->size = 0;
+    input->pos = 0;
+    input->mapped = 0;
+    input->fd = -1;
+    input->window = NULL;
+    input->capacity = 0;
+}
+
+bool input_parse_int(const char *s, size_t n, int32_t *value) {
+    const char *end = s + n;
+    int64_t v = 0;
+
+    if (n > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        const char *p = s + 2;
+        while (p < end && hex_digit(*p) >= 0)
+            p++;
+        // otherwise not hexadecimal as a whole, the decimal prefix is the leading 0
+        if (p == end) {
+            for (p = s + 2; p < end; p++) {
+                v = v * 16 + hex_digit(*p);
+                if (v > INT_MAX)
+                    return false;
+            }
+            *value = (int32_t) v;
+            return true;
+        }
+    }
+
+    const char *p = s;
+    while (p < end && isspace((unsigned char) *p))
+        p++;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    if (p == end || !isdigit((unsigned char) *p))
+        return false;
+    while (p < end && isdigit((unsigned char) *p)) {
+        v = v * 10 + (*p++ - '0');
+        if (v > (int64_t) INT_MAX + 1)
+            return false;
+    }
+    if (negative)
+        v = -v;
+    if (v > INT_MAX || v < INT_MIN)
+        return false;
+    *value = (int32_t) v;
+    return true;
+}
+
+/* strtod and strtof need a terminated string, lines of the input are not */
+template<typename T>
+static bool __parse_real(const char *s, size_t n, T (*convert)(const char *, char **), T *value) {
+    char local[64];
+    std::string copy;
+    const char *str = local;
+    if (n < sizeof(local)) {
+        memcpy(local, s, n);
+        local[n] = '\0';
+    } else {
+        copy.assign(s, n);
+        str = copy.c_str();
+    }
+
+    char *end;
+    errno = 0;
+    T v = convert(str, &end);
+    if (end == str || errno == ERANGE)
+        return false;
+    *value = v;
+    return true;
+}
+
+bool input_parse_double(const char *s, size_t n, double *value) {
+    return __parse_real<double>(s, n, strtod, value);
+}
+
+bool input_parse_float(const char *s, size_t n, float *value) {
+    return __parse_real<float>(s, n, strtof, value);
+}
@@ -0,0 +1,508 @@
+/**
+ * @filename: jit.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: x86-64 translator for hot basic blocks
+ * @date: 3/24/2021
+ */
+
+#include "jit.hh"
+#include "psim.hh"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+extern "C" void __register_frame(void *begin);
+extern "C" void __deregister_frame(void *begin);
+
+// Translated code keeps the CPU context, whose register file sits at offset 0,
+// in rbx (callee saved, so it survives calls into the interpreter handlers) and works through
+// eax/ecx/edx. Every exit path leaves the next guest pc in eax.
+//
+// Instructions with simple register semantics are emitted inline, loads,
+// stores, multiplication and division call the interpreter handler for the
+// micro-op so that memory and overflow behaviour stays identical, and
+// syscalls, traps and lwl/lwr/swl/swr end the translated prefix so the
+// interpreter picks them up.
+
+#define JIT_MAX_UOP_BYTES 64
+#define JIT_FRAME_BYTES 32
+#define JIT_UNWIND_BYTES 64
+
+struct Emitter {
+    uint8_t *p;
+};
+
+enum jit_emit_results {
+    JIT_EMITTED,                            // continue with the next micro-op
+    JIT_EXITED,                             // block terminator, return already emitted
+    JIT_UNSUPPORTED,                        // leave this micro-op to the interpreter
+};
+
+enum x86_regs {
+    EAX = 0, ECX = 1, EDX = 2,
+};
+
+enum x86_conds {
+    CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5,
+    CC_L = 0xC, CC_GE = 0xD, CC_LE = 0xE, CC_G = 0xF,
+};
+
+static inline void emit8(Emitter *e, uint8_t b) {
+    *e->p++ = b;
+}
+
+static inline void emit32(Emitter *e, uint32_t v) {
+    memcpy(e->p, &v, 4);
+    e->p += 4;
+}
+
+static inline void emit64(Emitter *e, uint64_t v) {
+    memcpy(e->p, &v, 8);
+    e->p += 8;
+}
+
+/* mov r32, [rbx + 4 * guest_reg] */
+static void emit_load(Emitter *e, uint32_t x86_reg, uint32_t guest_reg) {
+    emit8(e, 0x8B);
+    emit8(e, 0x83 | (x86_reg << 3));
+    emit32(e, guest_reg * 4);
+}
+
+/* mov [rbx + 4 * guest_reg], r32 */
+static void emit_store(Emitter *e, uint32_t guest_reg, uint32_t x86_reg) {
+    emit8(e, 0x89);
+    emit8(e, 0x83 | (x86_reg << 3));
+    emit32(e, guest_reg * 4);
+}
+
+/* mov dword [rbx + 4 * guest_reg], imm32 */
+static void emit_store_imm(Emitter *e, uint32_t guest_reg, uint32_t imm) {
+    emit8(e, 0xC7);
+    emit8(e, 0x83);
+    emit32(e, guest_reg * 4);
+    emit32(e, imm);
+}
+
+/* <op> eax, ecx for the 0x01-style ALU opcodes (add, or, and, sub, xor, cmp) */
+static void emit_alu_rr(Emitter *e, uint8_t opcode) {
+    emit8(e, opcode);
+    emit8(e, 0xC8);
+}
+
+/* <op> eax, imm32 for the short eax forms (05 add, 0D or, 25 and, 35 xor, 3D cmp) */
+static void emit_alu_eax_imm(Emitter *e, uint8_t opcode, uint32_t imm) {
+    emit8(e, opcode);
+    emit32(e, imm);
+}
+
+/* shl/shr/sar eax, imm8 (ext 4, 5, 7) */
+static void emit_shift_imm(Emitter *e, uint8_t ext, uint8_t imm) {
+    emit8(e, 0xC1);
+    emit8(e, 0xC0 | (ext << 3));
+    emit8(e, imm);
+}
+
+/* shl/shr eax, cl (ext 4, 5) */
+static void emit_shift_cl(Emitter *e, uint8_t ext) {
+    emit8(e, 0xD3);
+    emit8(e, 0xC0 | (ext << 3));
+}
+
+/* mov r32, imm32 */
+static void emit_mov_imm(Emitter *e, uint32_t x86_reg, uint32_t imm) {
+    emit8(e, 0xB8 + x86_reg);
+    emit32(e, imm);
+}
+
+static void emit_prologue(Emitter *e) {
+    emit8(e, 0x53);                         // push rbx
+    emit8(e, 0x48);                         // mov rbx, rdi
+    emit8(e, 0x89);
+    emit8(e, 0xFB);
+}
+
+static void emit_epilogue(Emitter *e) {
+    emit8(e, 0x5B);                         // pop rbx
+    emit8(e, 0xC3);                         // ret
+}
+
+/* return next_pc to the engine */
+static void emit_exit(Emitter *e, uint32_t next_pc) {
+    emit_mov_imm(e, EAX, next_pc);
+    emit_epilogue(e);
+}
+
+/* eax = cond ? taken : fallthrough, then return it */
+static void emit_exit_cond(Emitter *e, uint8_t cc, uint32_t taken, uint32_t fallthrough) {
+    emit_mov_imm(e, EAX, fallthrough);      // mov does not touch the flags
+    emit_mov_imm(e, EDX, taken);
+    emit8(e, 0x0F);                         // cmovcc eax, edx
+    emit8(e, 0x40 | cc);
+    emit8(e, 0xC2);
+    emit_epilogue(e);
+}
+
+/* handler(cpu, uop) */
+static void emit_call_handler(Emitter *e, const MicroOp *uop) {
+    emit8(e, 0x48);                         // mov rdi, rbx
+    emit8(e, 0x89);
+    emit8(e, 0xDF);
+    emit8(e, 0x48);                         // mov rsi, uop
+    emit8(e, 0xBE);
+    emit64(e, (uint64_t) uop);
+    emit8(e, 0x48);                         // mov rax, handler
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t) uop->handler);
+    emit8(e, 0xFF);                         // call rax
+    emit8(e, 0xD0);
+}
+
+/* leave the block right after a store that hit the text segment */
+static void emit_text_write_check(Emitter *e, Simulator *simulator, uint32_t next_pc) {
+    emit8(e, 0x48);                         // mov rax, &simulator->block_flush
+    emit8(e, 0xB8);
+    emit64(e, (uint64_t) &simulator->block_flush);
+    emit8(e, 0x80);                         // cmp byte [rax], 0
+    emit8(e, 0x38);
+    emit8(e, 0x00);
+    emit8(e, 0x74);                         // je over the exit
+    emit8(e, 0x07);
+    emit_exit(e, next_pc);
+}
+
+static uint32_t emit_uop(Emitter *e, Simulator *simulator, const MicroOp *uop, uint32_t pc) {
+    switch (uop->kind) {
+
+        case UOP_ADD:
+        case UOP_ADDU:
+        case UOP_SUB:
+        case UOP_SUBU:
+        case UOP_AND:
+        case UOP_OR:
+        case UOP_XOR:
+        case UOP_NOR: {
+            static const uint8_t alu[] = {0x01, 0x01, 0x29, 0x29, 0x21, 0x09, 0x31, 0x09};
+            emit_load(e, EAX, uop->rs);
+            emit_load(e, ECX, uop->rt);
+            emit_alu_rr(e, alu[uop->kind - UOP_ADD]);
+            if (uop->kind == UOP_NOR) {
+                emit8(e, 0xF7);             // not eax
+                emit8(e, 0xD0);
+            }
+            emit_store(e, uop->rd, EAX);
+            return JIT_EMITTED;
+        }
+
+        case UOP_SLT:
+        case UOP_SLTU: {
+            // rd is only ever set, never cleared, as in the interpreter
+            emit_load(e, EAX, uop->rs);
+            emit_load(e, ECX, uop->rt);
+            emit_alu_rr(e, 0x39);
+            emit8(e, uop->kind == UOP_SLT ? 0x7D : 0x73);   // jge/jae over the store
+            emit8(e, 0x0A);
+            emit_store_imm(e, uop->rd, 1);
+            return JIT_EMITTED;
+        }
+
+        case UOP_SLL:
+        case UOP_SRL:
+        case UOP_SRA: {
+            static const uint8_t ext[] = {4, 5, 7};
+            emit_load(e, EAX, uop->rt);
+            emit_shift_imm(e, ext[uop->kind - UOP_SLL], uop->imm & 0x1F);
+            emit_store(e, uop->rd, EAX);
+            return JIT_EMITTED;
+        }
+
+        case UOP_SLLV:
+        case UOP_SRLV: {
+            emit_load(e, ECX, uop->rs);
+            emit_load(e, EAX, uop->rt);
+            emit_shift_cl(e, uop->kind == UOP_SLLV ? 4 : 5);
+            emit_store(e, uop->rd, EAX);
+            return JIT_EMITTED;
+        }
+
+        case UOP_MFHI:
+        case UOP_MFLO:
+            emit_load(e, EAX, uop->kind == UOP_MFHI ? HI : LO);
+            emit_store(e, uop->rd, EAX);
+            return JIT_EMITTED;
+
+        case UOP_MTHI:
+        case UOP_MTLO:
+            emit_load(e, EAX, uop->rs);
+            emit_store(e, uop->kind == UOP_MTHI ? HI : LO, EAX);
+            return JIT_EMITTED;
+
+        case UOP_ADDI:
+        case UOP_ADDIU:
+        case UOP_ANDI:
+        case UOP_ORI:
+        case UOP_XORI: {
+            static const uint8_t alu[] = {0x05, 0x05, 0x00, 0x00, 0x25, 0x0D, 0x35};
+            emit_load(e, EAX, uop->rs);
+            emit_alu_eax_imm(e, alu[uop->kind - UOP_ADDI], uop->imm);
+            emit_store(e, uop->rt, EAX);
+            return JIT_EMITTED;
+        }
+
+        case UOP_SLTI:
+        case UOP_SLTIU:
+            emit_load(e, EAX, uop->rs);
+            emit_alu_eax_imm(e, 0x3D, uop->imm);
+            emit8(e, 0x0F);                 // setl/setb al
+            emit8(e, uop->kind == UOP_SLTI ? 0x9C : 0x92);
+            emit8(e, 0xC0);
+            emit8(e, 0x0F);                 // movzx eax, al
+            emit8(e, 0xB6);
+            emit8(e, 0xC0);
+            emit_store(e, uop->rt, EAX);
+            return JIT_EMITTED;
+
+        case UOP_LUI:
+            emit_store_imm(e, uop->rt, uop->imm);
+            return JIT_EMITTED;
+
+        case UOP_SRAV:
+        case UOP_MULT:
+        case UOP_MULTU:
+        case UOP_DIV:
+        case UOP_DIVU:
+        case UOP_LB:
+        case UOP_LH:
+        case UOP_LW:
+        case UOP_LBU:
+        case UOP_LHU:
+            emit_call_handler(e, uop);
+            return JIT_EMITTED;
+
+        case UOP_SB:
+        case UOP_SH:
+        case UOP_SW:
+            emit_call_handler(e, uop);
+            emit_text_write_check(e, simulator, pc + 4);
+            return JIT_EMITTED;
+
+        case UOP_BEQ:
+        case UOP_BNE: {
+            uint32_t taken = pc + 4 * (int16_t) uop->imm + 4;
+            emit_load(e, EAX, uop->rs);
+            emit_load(e, ECX, uop->rt);
+            emit_alu_rr(e, 0x39);
+            emit_exit_cond(e, uop->kind == UOP_BEQ ? CC_E : CC_NE, taken, pc + 4);
+            return JIT_EXITED;
+        }
+
+        case UOP_BLTZAL:
+        case UOP_BGEZAL:
+            // ra is written before rs is read, as in the interpreter
+            emit_store_imm(e, ra, (pc + 4) >> 2);
+            // fall through
+        case UOP_BLTZ:
+        case UOP_BGEZ:
+        case UOP_BLEZ:
+        case UOP_BGTZ: {
+            uint8_t cc;
+            switch (uop->kind) {
+                case UOP_BLTZ:
+                case UOP_BLTZAL:
+                    cc = CC_L;
+                    break;
+                case UOP_BGEZ:
+                case UOP_BGEZAL:
+                    cc = CC_GE;
+                    break;
+                case UOP_BLEZ:
+                    cc = CC_LE;
+                    break;
+                default:
+                    cc = CC_G;
+                    break;
+            }
+            uint32_t taken = pc + 4 * (int16_t) uop->imm + 4;
+            emit_load(e, EAX, uop->rs);
+            emit_alu_eax_imm(e, 0x3D, 0);
+            emit_exit_cond(e, cc, taken, pc + 4);
+            return JIT_EXITED;
+        }
+
+        case UOP_JAL:
+            emit_store_imm(e, ra, (pc >> 2) + 1);
+            // fall through
+        case UOP_J:
+            emit_exit(e, (uint32_t) uop->imm << 2);
+            return JIT_EXITED;
+
+        case UOP_JALR:
+            emit_store_imm(e, uop->rd, (pc + 4) >> 2);
+            emit_load(e, EAX, uop->rs);
+            emit_shift_imm(e, 4, 2);
+            emit_epilogue(e);
+            return JIT_EXITED;
+
+        case UOP_JR:
+            emit_load(e, EAX, uop->rs);
+            emit_alu_eax_imm(e, 0x05, (uint32_t) -1);
+            emit_shift_imm(e, 4, 2);
+            emit_alu_eax_imm(e, 0x05, 4);
+            emit_epilogue(e);
+            return JIT_EXITED;
+
+        default:
+            return JIT_UNSUPPORTED;
+    }
+}
+
+/* Unwind table of the code cache: one CIE and one FDE spanning the whole
+ * cache. Handlers called from translated code may throw the ExitTrap, and the
+ * unwinder has to step over the block. Every call is made from the body, where
+ * the frame is the one of the prologue: return address, then the pushed rbx */
+static void __jit_unwind_build(uint8_t *p, const uint8_t *code, size_t size) {
+    static const uint8_t cie[24] = {
+            20, 0, 0, 0,                    // length
+            0, 0, 0, 0,                     // CIE id
+            1, 'z', 'R', 0,                 // version, augmentation
+            1, 0x78, 16,                    // code align 1, data align -8, return address in rip
+            1, 0x00,                        // augmentation data: absolute FDE pointers
+            0x0C, 7, 16,                    // DW_CFA_def_cfa rsp + 16
+            0x90, 1,                        // DW_CFA_offset rip at cfa - 8
+            0x83, 2,                        // DW_CFA_offset rbx at cfa - 16
+    };
+    uint64_t begin = (uint64_t) code;
+    uint64_t range = size;
+
+    memset(p, 0, JIT_UNWIND_BYTES);         // the padding DW_CFA_nop and the terminator
+    memcpy(p, cie, sizeof(cie));
+    p[24] = 28;                             // FDE length
+    p[28] = 28;                             // CIE pointer, back to the CIE
+    memcpy(p + 32, &begin, 8);
+    memcpy(p + 40, &range, 8);
+}
+
+/* The cache is never writable and executable at once: the pages a block is
+ * emitted into are made writable for the translation, then executable again */
+static bool __jit_protect(Jit *jit, uint8_t *p, size_t n, int prot) {
+    uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) p & ~(page - 1);
+    uintptr_t end = std::min((uintptr_t) (p + n), (uintptr_t) (jit->code + jit->size));
+    return mprotect((void *) start, end - start, prot) == 0;
+}
+
+void jit_init(Jit *jit, uint32_t threshold, uint32_t cache_kb) {
+    memset(jit, 0, sizeof(Jit));
+    jit->threshold = threshold ? threshold : 1;
+    jit->size = (size_t) cache_kb * 1024;
+
+    void *code = mmap(NULL, jit->size, PROT_READ | PROT_EXEC,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        PRINTF_ERR_STAMP("[JIT]\tFailed to map %u KiB of executable memory, "
+                         "continuing with the block engine\n", cache_kb);
+        jit->code = NULL;
+        jit->size = 0;
+        return;
+    }
+
+    jit->code = (uint8_t *) code;
+    jit->unwind = (uint8_t *) safe_malloc(JIT_UNWIND_BYTES);
+    __jit_unwind_build(jit->unwind, jit->code, jit->size);
+    __register_frame(jit->unwind);
+    jit->enabled = true;
+    PRINTF_DEBUG_VERBOSE(verbose, "[JIT]\tCode cache: %u KiB, threshold: %u\n",
+                         cache_kb, jit->threshold);
+}
+
+void jit_free(Jit *jit) {
+    if (jit->code) {
+        __deregister_frame(jit->unwind);
+        free(jit->unwind);
+        munmap(jit->code, jit->size);
+    }
+    jit->code = NULL;
+    jit->unwind = NULL;
+    jit->enabled = false;
+}
+
+jit_block_fn jit_translate(Jit *jit, Simulator *simulator, TranslatedBlock *block) {
+    size_t worst = JIT_FRAME_BYTES + (size_t) block->length * JIT_MAX_UOP_BYTES;
+    if (worst > jit->size)
+        return NULL;
+    if (jit->used + worst > jit->size)
+        jit_flush(jit, simulator);
+
+    Emitter e = {jit->code + jit->used};
+    uint8_t *entry = e.p;
+    if (!__jit_protect(jit, entry, worst, PROT_READ | PROT_WRITE)) {
+        PRINTF_ERR_STAMP("[JIT]\tFailed to make the code cache writable, "
+                         "continuing with the block engine\n");
+        jit->enabled = false;
+        return NULL;
+    }
+    emit_prologue(&e);
+
+    uint32_t pc = block->start;
+    uint32_t i;
+    uint32_t result = JIT_EMITTED;
+    for (i = 0; i < block->length; i++, pc += 4) {
+        result = emit_uop(&e, simulator, &block->uops[i], pc);
+        if (result != JIT_EMITTED)
+            break;
+    }
+
+    if (i == 0 && result == JIT_UNSUPPORTED) {
+        __jit_protect(jit, entry, worst, PROT_READ | PROT_EXEC);
+        jit->stats.rejected++;
+        return NULL;
+    }
+
+    // the prefix stopped at an instruction left to the interpreter, or the
+    // block ran into the end of the text
+    if (result != JIT_EXITED)
+        emit_exit(&e, pc);
+    if (!__jit_protect(jit, entry, worst, PROT_READ | PROT_EXEC)) {
+        PRINTF_ERR_STAMP("[JIT]\tFailed to make the code cache executable, "
+                         "continuing with the block engine\n");
+        jit_flush(jit, simulator);
+        jit->enabled = false;
+        return NULL;
+    }
+
+    jit->used = e.p - jit->code;
+    jit->stats.translated++;
+    block->native_length = i + (result == JIT_EXITED);
+    PRINTF_DEBUG_VERBOSE(verbose, "[JIT]\tTranslated block 0x%X: %u of %u instructions, %u bytes\n",
+                         block->start, i + (result == JIT_EXITED), block->length,
+                         (uint32_t) (e.p - entry));
+    return (jit_block_fn) entry;
+}
+
+#else
+
+void jit_init(Jit *jit, uint32_t threshold, uint32_t cache_kb) {
+    memset(jit, 0, sizeof(Jit));
+    PRINTF_ERR_STAMP("[JIT]\tThe translator only targets x86-64 Linux, "
+                     "continuing with the block engine\n");
+}
+
+void jit_free(Jit *jit) {
+    jit->enabled = false;
+}
+
+jit_block_fn jit_translate(Jit *jit, Simulator *simulator, TranslatedBlock *block) {
+    return NULL;
+}
+
+#endif
+
+void jit_flush(Jit *jit, Simulator *simulator) {
+    for (uint32_t i = 0; i < simulator->blocks.size(); i++) {
+        simulator->blocks[i].native = NULL;
+        simulator->blocks[i].hotness = 0;
+    }
+    jit->used = 0;
+    jit->stats.flushes++;
+}
@@ -0,0 +1,172 @@
+/**
+ * @filename: lexer.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: single-pass lexer of assembly source lines
+ * @date: 4/2/2021
+ */
+
+#include "lexer.hh"
+#include "utils.hh"
+
+static inline bool __space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' || c == '\f';
+}
+
+static inline bool __delimiter(char c) {
+    return __space(c) || c == ',';
+}
+
+bool lex_int(Span span, int32_t *value) {
+    const char *p = span.data;
+    const char *end = span.data + span.size;
+    bool negative = false;
+    if (p < end && (*p == '+' || *p == '-'))
+        negative = *p++ == '-';
+    if (p == end)
+        return false;
+
+    uint64_t v = 0;
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        for (p += 2; p < end; p++) {
+            int digit = hex_digit(*p);
+            if (digit < 0)
+                return false;
+            v = v * 16 + digit;
+            if (v > UINT32_MAX)
+                return false;
+        }
+    } else {
+        for (; p < end; p++) {
+            if (*p < '0' || *p > '9')
+                return false;
+            v = v * 10 + (*p - '0');
+            if (v > UINT32_MAX)
+                return false;
+        }
+        // -2147483648 is the lowest, 4294967295 the highest as unsigned
+        if (negative && v > (uint64_t) INT32_MAX + 1)
+            return false;
+    }
+    *value = (int32_t) (negative ? 0 - (uint32_t) v : (uint32_t) v);
+    return true;
+}
+
+/* past the closing quote of the string opening at p, NULL if not closed */
+static const char *__string_end(const char *p, const char *end) {
+    for (p++; p < end; p++) {
+        if (*p == '\\' && p + 1 < end)
+            p++;
+        else if (*p == '"')
+            return p + 1;
+    }
+    return NULL;
+}
+
+void lex_operand(Span span, Token *token) {
+    const char *s = span.data;
+    uint32_t n = span.size;
+    token->text = span;
+    token->reg = span_of(s, 0);
+    token->value = 0;
+    if (!n) {
+        token->kind = TOK_SYMBOL;
+        return;
+    }
+
+    if (s[0] == '$') {
+        token->kind = TOK_REGISTER;
+        token->reg = span_of(s + 1, n - 1);
+    } else if (s[0] == '"') {
+        token->kind = TOK_STRING;
+    } else if (lex_int(token->text, &token->value)) {
+        token->kind = TOK_IMMEDIATE;
+    } else {
+        token->kind = TOK_SYMBOL;
+        const char *open = (const char *) memchr(s, '(', n);
+        if (!open || s[n - 1] != ')')
+            return;
+
+        Span offset = span_of(s, open - s);
+        Span reg = span_of(open + 1, s + n - 1 - (open + 1));
+        if (reg.size && reg.data[0] == '$')
+            reg = span_of(reg.data + 1, reg.size - 1);
+        if (offset.size && !lex_int(offset, &token->value))
+            return;
+        token->kind = TOK_ADDRESS;
+        token->reg = reg;
+    }
+}
+
+bool lex_line(const char *begin, const char *end, LexLine *line) {
+    const char *p = begin;
+    line->label = span_of(begin, 0);
+    line->n_tokens = 0;
+
+    // the comment starts at the first '#' outside a string
+    const char *code_end = end;
+    for (const char *q = begin; q < end; q++) {
+        if (*q == '"') {
+            const char *closed = __string_end(q, end);
+            if (!closed)
+                break;
+            q = closed - 1;
+        } else if (*q == '#') {
+            code_end = q;
+            break;
+        }
+    }
+    while (code_end > begin && __space(code_end[-1]))
+        code_end--;
+
+    // a label is whatever comes before the first ':' that is not in a string
+    for (const char *q = p; q < code_end && *q != '"'; q++) {
+        if (*q != ':')
+            continue;
+        const char *label_begin = p, *label_end = q;
+        while (label_begin < label_end && __space(*label_begin))
+            label_begin++;
+        while (label_end > label_begin && __space(label_end[-1]))
+            label_end--;
+        if (label_end > label_begin) {
+            line->label = span_of(label_begin, label_end - label_begin);
+            p = q + 1;
+        }
+        break;
+    }
+
+    while (p < code_end && __space(*p))
+        p++;
+    line->body = span_of(p, code_end - p);
+
+    while (p < code_end) {
+        while (p < code_end && __delimiter(*p))
+            p++;
+        if (p == code_end)
+            break;
+        if (line->n_tokens == LEX_MAX_TOKENS)
+            return false;
+
+        const char *token_end = p;
+        if (*p == '"') {
+            if (!(token_end = __string_end(p, code_end)))
+                return false;
+        } else {
+            while (token_end < code_end && !__delimiter(*token_end))
+                token_end++;
+        }
+
+        Token *token = &line->tokens[line->n_tokens];
+        if (line->n_tokens == 0) {
+            token->text = span_of(p, token_end - p);
+            token->reg = span_of(p, 0);
+            token->value = 0;
+            token->kind = *p == '.' ? TOK_DIRECTIVE : TOK_MNEMONIC;
+        } else {
+            lex_operand(span_of(p, token_end - p), token);
+        }
+        line->n_tokens++;
+        p = token_end;
+    }
+    return true;
+}
@@ -0,0 +1,507 @@
+/**
+ * @filename: log.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: deferred logging through per-thread ring buffers
+ * @date: 4/1/2021
+ */
+
+#include "utils.hh"
+
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <pthread.h>
+#include <sched.h>
+
+thread_local LogRing *__log_this_ring = NULL;
+std::atomic<bool> __log_started(false);
+
+static std::mutex __log_rings_lock;         // the list of rings
+static std::vector<LogRing *> __log_rings;
+static std::mutex __log_drain_lock;         // one formatter at a time
+static std::atomic<bool> __log_running(false);
+static std::atomic<bool> __log_stopping(false);
+static pthread_t __log_writer;
+static std::atomic<uint64_t> __log_dropped_total(0);
+
+// log_clock() to get_timestamp(), calibrated against it while running
+static uint64_t __log_clock0;
+static double __log_stamp0;
+static double __log_ticks_per_sec = 0;
+
+/* marks the ring of a thread retired when the thread exits */
+struct LogOwner {
+    LogRing *ring = NULL;
+
+    ~LogOwner() {
+        if (ring)
+            ring->retired.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local LogOwner __log_owner;
+
+// ========================================================================== //
+// formatting
+// ========================================================================== //
+
+struct LogArgs {
+    const char *p;
+    const char *end;
+};
+
+static uint64_t __next_slot(LogArgs *args) {
+    uint64_t bits = 0;
+    if (args->p + 8 <= args->end) {
+        memcpy(&bits, args->p, sizeof(bits));
+        args->p += 8;
+    }
+    return bits;
+}
+
+static const char *__next_string(LogArgs *args, uint64_t *n) {
+    *n = __next_slot(args);
+    if (args->p + *n > args->end)
+        *n = 0;
+    const char *s = args->p;
+    args->p += __log_pad(*n);
+    return s;
+}
+
+enum log_arg_kinds {
+    LOG_ARG_NONE,                           // %n, or an unknown conversion copied as text
+    LOG_ARG_SIGNED,
+    LOG_ARG_UNSIGNED,
+    LOG_ARG_CHAR,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER,
+};
+
+/* A conversion of a format and the literal text before it. Integer
+ * conversions are widened to ll, the slot is narrowed back to the size the
+ * format asked for (4 bytes without a length modifier) */
+struct LogPiece {
+    std::string text;
+    std::string spec;
+    uint8_t kind;
+    uint8_t size;
+    uint8_t stars;                          // '*' width and precision, taken from the slots first
+    bool plain;                             // bare %d or %u
+};
+
+/* a format split once, the first time a record of it is written */
+struct LogFormat {
+    std::vector<LogPiece> pieces;
+    std::string tail;
+};
+
+// only used under __log_drain_lock
+static std::unordered_map<const char *, LogFormat> __log_formats;
+
+static void __parse_format(const char *format, LogFormat *parsed) {
+    const char *f = format;
+    std::string text;
+    while (*f) {
+        if (*f != '%') {
+            text.push_back(*f++);
+            continue;
+        }
+        const char *start = f++;
+        if (*f == '%') {
+            text.push_back(*f++);
+            continue;
+        }
+
+        LogPiece piece;
+        piece.spec = "%";
+        piece.stars = 0;
+        while (*f && strchr("-+ #0", *f))
+            piece.spec.push_back(*f++);
+        for (int part = 0; part < 2; part++) {
+            if (part == 1) {
+                if (*f != '.')
+                    break;
+                piece.spec.push_back(*f++);
+            }
+            if (*f == '*') {
+                piece.spec.push_back(*f++);
+                piece.stars++;
+            }
+            while (*f >= '0' && *f <= '9')
+                piece.spec.push_back(*f++);
+        }
+        std::string length;
+        while (*f && strchr("hlLqjzt", *f))
+            length.push_back(*f++);
+        if (!*f)
+            break;
+
+        char conversion = *f++;
+        piece.plain = piece.spec == "%";
+        piece.size = length == "hh" ? 1 : length == "h" ? 2 : length.empty() ? 4 : 8;
+        switch (conversion) {
+            case 'd':
+            case 'i':
+                piece.kind = LOG_ARG_SIGNED;
+                piece.spec += "ll";
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                piece.kind = LOG_ARG_UNSIGNED;
+                piece.plain = piece.plain && conversion == 'u';
+                piece.spec += "ll";
+                break;
+            case 'c':
+                piece.kind = LOG_ARG_CHAR;
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                piece.kind = LOG_ARG_DOUBLE;
+                break;
+            case 's':
+                piece.kind = LOG_ARG_STRING;
+                break;
+            case 'p':
+                piece.kind = LOG_ARG_POINTER;
+                break;
+            case 'n':
+                piece.kind = LOG_ARG_NONE;
+                piece.spec.clear();
+                break;
+            default:
+                piece.kind = LOG_ARG_NONE;
+                piece.spec.assign(start, f - start);
+                piece.stars = 0;
+                text += piece.spec;
+                continue;
+        }
+        piece.spec.push_back(conversion);
+        piece.text.swap(text);
+        parsed->pieces.push_back(piece);
+    }
+    parsed->tail = text;
+}
+
+template<typename... Args>
+static void __append(std::string *out, const char *spec, Args... args) {
+    char buffer[256];
+    int n = snprintf(buffer, sizeof(buffer), spec, args...);
+    if (n < 0)
+        return;
+    if ((size_t) n < sizeof(buffer)) {
+        out->append(buffer, n);
+    } else {
+        std::string large(n + 1, '\0');
+        snprintf(&large[0], large.size(), spec, args...);
+        out->append(large.data(), n);
+    }
+}
+
+static void __append_decimal(std::string *out, uint64_t v, bool negative) {
+    char buffer[24];
+    char *p = buffer + sizeof(buffer);
+    do {
+        *--p = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v);
+    if (negative)
+        *--p = '-';
+    out->append(p, buffer + sizeof(buffer) - p);
+}
+
+template<typename T>
+static void __append_arg(std::string *out, const LogPiece *piece, int *stars, T v) {
+    if (piece->stars == 0)
+        __append(out, piece->spec.c_str(), v);
+    else if (piece->stars == 1)
+        __append(out, piece->spec.c_str(), stars[0], v);
+    else
+        __append(out, piece->spec.c_str(), stars[0], stars[1], v);
+}
+
+static int64_t __narrow_signed(uint64_t bits, uint8_t size) {
+    return size == 1 ? (int64_t) (signed char) bits : size == 2 ? (int64_t) (short) bits
+                     : size == 4 ? (int64_t) (int) bits : (int64_t) bits;
+}
+
+static uint64_t __narrow_unsigned(uint64_t bits, uint8_t size) {
+    return size == 1 ? (uint64_t) (unsigned char) bits : size == 2 ? (uint64_t) (unsigned short) bits
+                     : size == 4 ? (uint64_t) (unsigned) bits : bits;
+}
+
+/* printf of a record, over the parsed format */
+static void __format(std::string *out, const char *format, LogArgs *args) {
+    std::unordered_map<const char *, LogFormat>::iterator it = __log_formats.find(format);
+    if (it == __log_formats.end()) {
+        it = __log_formats.insert(std::make_pair(format, LogFormat())).first;
+        __parse_format(format, &it->second);
+    }
+
+    const LogFormat *parsed = &it->second;
+    for (size_t i = 0; i < parsed->pieces.size(); i++) {
+        const LogPiece *piece = &parsed->pieces[i];
+        out->append(piece->text);
+
+        int stars[2];
+        for (uint8_t j = 0; j < piece->stars; j++)
+            stars[j] = (int) __next_slot(args);
+
+        switch (piece->kind) {
+            case LOG_ARG_SIGNED: {
+                int64_t v = __narrow_signed(__next_slot(args), piece->size);
+                if (piece->plain)
+                    __append_decimal(out, v < 0 ? 0 - (uint64_t) v : (uint64_t) v, v < 0);
+                else
+                    __append_arg(out, piece, stars, (long long) v);
+                break;
+            }
+            case LOG_ARG_UNSIGNED: {
+                uint64_t v = __narrow_unsigned(__next_slot(args), piece->size);
+                if (piece->plain)
+                    __append_decimal(out, v, false);
+                else
+                    __append_arg(out, piece, stars, (unsigned long long) v);
+                break;
+            }
+            case LOG_ARG_CHAR:
+                __append_arg(out, piece, stars, (int) __next_slot(args));
+                break;
+            case LOG_ARG_DOUBLE: {
+                uint64_t bits = __next_slot(args);
+                double d;
+                memcpy(&d, &bits, sizeof(d));
+                __append_arg(out, piece, stars, d);
+                break;
+            }
+            case LOG_ARG_STRING: {
+                uint64_t n;
+                const char *s = __next_string(args, &n);
+                if (piece->spec == "%s")
+                    out->append(s, n);
+                else
+                    __append_arg(out, piece, stars, std::string(s, n).c_str());
+                break;
+            }
+            case LOG_ARG_POINTER:
+                __append_arg(out, piece, stars, (void *) (uintptr_t) __next_slot(args));
+                break;
+            default:
+                break;
+        }
+    }
+    out->append(parsed->tail);
+}
+
+static double __stamp_of(uint64_t clock, double now) {
+    if (__log_ticks_per_sec <= 0 || clock < __log_clock0)
+        return now;
+    return __log_stamp0 + (double) (clock - __log_clock0) / __log_ticks_per_sec;
+}
+
+/* "%12.2f - " of the stamp, reformatted only when the hundredths change */
+static void __stamp(std::string *out, double stamp) {
+    static int64_t last = -1;
+    static char buffer[32];
+    static int n = 0;
+
+    int64_t hundredths = (int64_t) (stamp * 100 + 0.5);
+    if (hundredths != last) {
+        n = snprintf(buffer, sizeof(buffer), "%12.2f - ", hundredths / 100.0);
+        last = hundredths;
+    }
+    out->append(buffer, n);
+}
+
+/* format what the ring holds now, false if it was empty */
+static bool __drain_ring(LogRing *ring, std::string *out, double now) {
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    if (tail == head)
+        return false;
+
+    while (tail < head) {
+        uint64_t off = tail & (ring->size - 1);
+        LogRecord record;
+        memcpy(&record.size, ring->data + off, sizeof(record.size));
+        if (!record.size) {
+            tail += ring->size - off;
+            continue;
+        }
+        memcpy(&record, ring->data + off, sizeof(record));
+
+        double stamp = __stamp_of(record.clock, now);
+        if (record.dropped) {
+            __stamp(out, stamp);
+            out->append("[LOG]\t" + std::to_string(record.dropped) + " records dropped, the ring was full\n");
+            __log_dropped_total.fetch_add(record.dropped, std::memory_order_relaxed);
+        }
+        __stamp(out, stamp);
+        LogArgs args = {ring->data + off + sizeof(record), ring->data + off + record.size};
+        __format(out, record.format, &args);
+        tail += record.size;
+    }
+    ring->tail.store(tail, std::memory_order_release);
+    return true;
+}
+
+static void __log_drain_locked(bool *wrote) {
+    std::vector<LogRing *> rings;
+    {
+        std::lock_guard<std::mutex> guard(__log_rings_lock);
+        rings = __log_rings;
+    }
+
+    uint64_t clock = log_clock();
+    double now = get_timestamp();
+    if (now - __log_stamp0 >= 0.01)
+        __log_ticks_per_sec = (double) (clock - __log_clock0) / (now - __log_stamp0);
+
+    std::string out;
+    for (size_t i = 0; i < rings.size(); i++) {
+        bool retired = rings[i]->retired.load(std::memory_order_acquire);
+        *wrote |= __drain_ring(rings[i], &out, now);
+        if (retired) {
+            std::lock_guard<std::mutex> guard(__log_rings_lock);
+            for (size_t j = 0; j < __log_rings.size(); j++) {
+                if (__log_rings[j] == rings[i]) {
+                    __log_rings.erase(__log_rings.begin() + j);
+                    break;
+                }
+            }
+            free(rings[i]->data);
+            delete rings[i];
+        }
+    }
+
+    if (!out.empty()) {
+        flockfile(stderr);
+        fwrite(out.data(), 1, out.size(), stderr);
+        fflush(stderr);
+        funlockfile(stderr);
+    }
+}
+
+void __log_drain() {
+    std::lock_guard<std::mutex> guard(__log_drain_lock);
+    bool wrote = false;
+    __log_drain_locked(&wrote);
+}
+
+// ========================================================================== //
+// writer thread
+// ========================================================================== //
+
+static void *__log_writer_loop(void *) {
+    while (!__log_stopping.load(std::memory_order_acquire)) {
+        bool wrote = false;
+        {
+            std::lock_guard<std::mutex> guard(__log_drain_lock);
+            __log_drain_locked(&wrote);
+        }
+        if (!wrote)
+            usleep(LOG_IDLE_US);
+    }
+    return NULL;
+}
+
+static void __log_shutdown() {
+    if (__log_running.exchange(false)) {
+        __log_stopping.store(true, std::memory_order_release);
+        pthread_join(__log_writer, NULL);
+    }
+    __log_drain();
+
+    uint64_t dropped = __log_dropped_total.load();
+    {
+        std::lock_guard<std::mutex> guard(__log_rings_lock);
+        for (size_t i = 0; i < __log_rings.size(); i++)
+            dropped += __log_rings[i]->dropped.load(std::memory_order_relaxed);
+    }
+    if (dropped)
+        PRINTF_ERR_STAMP("[LOG]\t%lu records dropped in total, the rings were full\n", (unsigned long) dropped);
+}
+
+static void __log_fork_prepare() {
+    __log_drain_lock.lock();
+    __log_rings_lock.lock();
+}
+
+static void __log_fork_parent() {
+    __log_rings_lock.unlock();
+    __log_drain_lock.unlock();
+}
+
+// the writer thread is not forked: the child drains in place, see __log_full
+static void __log_fork_child() {
+    __log_rings_lock.unlock();
+    __log_drain_lock.unlock();
+    __log_running.store(false);
+}
+
+static void __log_start() {
+    __log_clock0 = log_clock();
+    __log_stamp0 = get_timestamp();
+    pthread_atfork(__log_fork_prepare, __log_fork_parent, __log_fork_child);
+    atexit(__log_shutdown);
+    if (pthread_create(&__log_writer, NULL, __log_writer_loop, NULL) == 0)
+        __log_running.store(true);
+    __log_started.store(true);
+}
+
+LogRing *__log_ring_slow() {
+    static std::once_flag started;
+    std::call_once(started, __log_start);
+
+    LogRing *ring = new LogRing;
+    ring->data = (char *) malloc(LOG_RING_SIZE);
+    if (!ring->data) {
+        delete ring;
+        return NULL;
+    }
+    ring->size = LOG_RING_SIZE;
+    ring->head.store(0);
+    ring->tail.store(0);
+    ring->next = 0;
+    ring->dropped.store(0);
+    ring->retired.store(false);
+
+    {
+        std::lock_guard<std::mutex> guard(__log_rings_lock);
+        __log_rings.push_back(ring);
+    }
+    __log_owner.ring = ring;
+    __log_this_ring = ring;
+    return ring;
+}
+
+static bool __log_room(const LogRing *ring, uint64_t n) {
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    return head + __log_need(ring, n) - ring->tail.load(std::memory_order_acquire) <= ring->size;
+}
+
+bool __log_full(LogRing *ring, uint64_t n) {
+    if (n > ring->size)
+        return false;
+    if (!__log_running.load(std::memory_order_relaxed)) {
+        __log_drain();
+        return __log_room(ring, n);
+    }
+
+    double deadline = get_timestamp() + LOG_FULL_WAIT_US / 1e6;
+    while (!__log_room(ring, n)) {
+        if (get_timestamp() > deadline)
+            return false;
+        sched_yield();
+    }
+    return true;
+}
@@ -8,167 +8,269 @@
 
 #include "mmbar.hh"
 
+#include <sys/mman.h>
+
 void __reset_mmcounters(MMBar *mmBar) {
-    mmBar->text_end_addr = MEM_TEXT_START;
-    mmBar->static_end_addr = MEM_DATA_START;
-    mmBar->dynamic_end_addr = MEM_DATA_START;
+    mmBar->text_end_addr = mmBar->layout.text_start;
+    mmBar->static_end_addr = mmBar->layout.data_start;
+    mmBar->dynamic_end_addr = mmBar->layout.data_start;
 }
 
-bool mmbar_write(MMBar *mmBar, uint32_t addr, uint8_t c) {
-    if (!mmBar->initialized) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return false;
-    }
-
-    if (addr >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tWrite address index out of range: %d\n",
-                             addr);
-        return false;
-    }
-
-    mmBar->_memory[addr] = c;
-    return true;
+void mmbar_layout_default(MemLayout *layout) {
+    layout->mem_size = MEM_DEFAULT_SIZE;
+    layout->text_start = MEM_DEFAULT_TEXT_START;
+    layout->text_size = MEM_DEFAULT_TEXT_SIZE;
+    layout->data_start = MEM_DEFAULT_TEXT_START + MEM_DEFAULT_TEXT_SIZE;
+    layout->stack_start = MEM_DEFAULT_STACK_START;
+    layout->stack_top = MEM_DEFAULT_STACK_TOP;
 }
 
-bool mmbar_writeu16(MMBar *mmBar, uint32_t addr, uint16_t e) {
-    if (!mmBar->initialized) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return false;
-    }
-
-    if (addr + 2 >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tWrite u16 address index out of range: %d\n",
-                             addr);
-        return false;
-    }
-
-#define LOLO_MASK 0xFFUL
-    uint8_t bllh = (e >> 8) & LOLO_MASK;
-    uint8_t blll = e & LOLO_MASK;
+static void __layout_validate(const MemLayout *layout) {
+    uint64_t text_end = (uint64_t) layout->text_start + layout->text_size;
 
-    mmBar->_memory[addr] = blll;
-    mmBar->_memory[addr + 1] = bllh;
-
-    return 1;
+    if (layout->mem_size == 0 || layout->mem_size > 0x100000000UL || layout->mem_size % MEM_PAGE_SIZE)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: mem_size must be a non-zero multiple of 0x%lX up to 4 GiB\n",
+                      MEM_PAGE_SIZE);
+    if ((layout->text_start | layout->text_size | layout->data_start) & 0x3)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: text and data must be word aligned\n");
+    if (layout->stack_start % MEM_PAGE_SIZE || layout->stack_top & 0x3)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: stack_start must be page aligned and stack_top word aligned\n");
+    if (layout->text_size == 0 || text_end > MEM_TEXT_LIMIT)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: text must be non-empty and end below 0x%lX\n", MEM_TEXT_LIMIT);
+    if (text_end > layout->data_start)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: data_start 0x%X overlaps the text\n", layout->data_start);
+    if ((uint64_t) layout->data_start + MEM_STACK_GUARD_SIZE > layout->stack_start)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: stack_start 0x%X leaves no room for data\n", layout->stack_start);
+    if (layout->stack_top <= layout->stack_start || layout->stack_top > layout->mem_size)
+        EXIT_WITH_MSG("[MMBAR]\tLayout: stack_top must lie in (stack_start, mem_size]\n");
 }
 
-bool mmbar_writeu32(MMBar *mmBar, uint32_t addr, uint32_t e) {
-    if (!mmBar->initialized) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return false;
-    }
+void mmbar_layout_parse(MemLayout *layout, const char *desc) {
+    char *copy = strdup(desc), *save = NULL;
+    bool data_given = false, text_given = false;
 
-    if (addr + 4 >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tWrite u32 address index out of range: %d\n",
-                             addr);
-        return false;
-    }
-
-#define LOLO_MASK 0xFFUL
-    uint8_t blhh = e >> 24;
-    uint8_t blhl = (e >> 16) & LOLO_MASK;
-    uint8_t bllh = (e >> 8) & LOLO_MASK;
-    uint8_t blll = e & LOLO_MASK;
+    for (char *item = strtok_r(copy, ",", &save); item; item = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(item, '=');
+        char *end = NULL;
+        if (!eq)
+            EXIT_WITH_MSG("[MMBAR]\tLayout: expected key=value, got %s\n", item);
+        *eq = '\0';
+        uint64_t value = strtoull(eq + 1, &end, 0);
+        if (end == eq + 1 || *end != '\0' || value > 0x100000000UL)
+            EXIT_WITH_MSG("[MMBAR]\tLayout: invalid value for %s: %s\n", item, eq + 1);
 
-    mmBar->_memory[addr] = blll;
-    mmBar->_memory[addr + 1] = bllh;
-    mmBar->_memory[addr + 2] = blhl;
-    mmBar->_memory[addr + 3] = blhh;
+        switch (hash(item)) {
+            case hash("mem_size"):
+                layout->mem_size = value;
+                break;
+            case hash("text_start"):
+                layout->text_start = (uint32_t) value;
+                text_given = true;
+                break;
+            case hash("text_size"):
+                layout->text_size = (uint32_t) value;
+                text_given = true;
+                break;
+            case hash("data_start"):
+                layout->data_start = (uint32_t) value;
+                data_given = true;
+                break;
+            case hash("stack_start"):
+                layout->stack_start = (uint32_t) value;
+                break;
+            case hash("stack_top"):
+                layout->stack_top = (uint32_t) value;
+                break;
+            default:
+                EXIT_WITH_MSG("[MMBAR]\tLayout: unknown key %s\n", item);
+        }
+    }
+    free(copy);
 
-    return 1;
+    if (text_given && !data_given)
+        layout->data_start = layout->text_start + layout->text_size;
+    __layout_validate(layout);
 }
 
-uint8_t mmbar_read(MMBar *mmBar, uint32_t addr) {
+void __mmbar_notify_text_write(MMBar *mmBar, uint32_t addr, uint32_t n) {
+    if (!mmBar->text_write_hook)
+        return;
 
-    if (!mmBar->initialized) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return 0x0;
+    for (uint32_t word = addr & ~0x3U; word < addr + n; word += 4) {
+        if (word >= mmBar->layout.text_start && word < mmBar->text_end_addr)
+            mmBar->text_write_hook(mmBar->text_write_ctx, word);
     }
-
-    if (addr >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tRead address index out of range: %d\n",
-                             addr);
-        return 0x0;
-    }
-
-    return mmBar->_memory[addr];
 }
 
-uint16_t mmbar_readu16(MMBar *mmBar, uint32_t addr) {
+void __mmbar_fault(MMBar *mmBar, uint32_t addr, const char *access) {
     if (!mmBar->initialized) {
         PRINTF_DEBUG_VERBOSE(verbose,
                              "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return 0x0;
-    }
-
-    if (addr + 2 >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tWrite u16 address index out of range: %d\n",
-                             addr);
-        return 0x0;
+        return;
     }
 
-    return (mmBar->_memory[addr + 1] << 8) |
-           (mmBar->_memory[addr]);
+    PRINTF_DEBUG_VERBOSE(verbose,
+                         "[MMBAR]\t\t%s address index out of range: %d\n",
+                         access, addr);
 }
 
-uint32_t mmbar_readu32(MMBar *mmBar, uint32_t addr) {
-    if (!mmBar->initialized) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tMemory has not been initialized yet!\n");
-        return 0x0;
+uint32_t mmbar_strlen(MMBar *mmBar, uint32_t addr, bool *terminated) {
+    if (addr >= mmBar->limit) {
+        __mmbar_fault(mmBar, addr, "String");
+        if (terminated)
+            *terminated = false;
+        return 0;
     }
-
-    if (addr + 4 >= MEM_SIZE) {
-        PRINTF_DEBUG_VERBOSE(verbose,
-                             "[MMBAR]\t\tWrite u32 address index out of range: %d\n",
-                             addr);
-        return 0x0;
-    }
-
-    return ((uint32_t) mmBar->_memory[addr + 3] << 24) |
-           ((uint32_t) mmBar->_memory[addr + 2] << 16) |
-           ((uint32_t) mmBar->_memory[addr + 1] << 8) |
-           ((uint32_t) mmBar->_memory[addr]);
+    const uint8_t *s = mmBar->_memory + addr;
+    const uint8_t *end = (const uint8_t *) memchr(s, '\0', mmBar->limit - addr);
+    if (terminated)
+        *terminated = end != NULL;
+    return end ? (uint32_t) (end - s) : (uint32_t) (mmBar->limit - addr);
 }
 
-uint32_t mmbar_allocate(MMBar *mmBar, uint32_t size_n) {
-    if (mmBar->dynamic_end_addr + size_n >= register_file[sp])
+uint32_t mmbar_allocate(MMBar *mmBar, uint32_t size_n, uint32_t stack_pointer) {
+    if (mmBar->dynamic_end_addr + size_n >= stack_pointer)
         EXIT_WITH_MSG("[MMBAR]\tInsufficient memory to allocate...\n");
+    if (mmBar->guarded && mmBar->dynamic_end_addr + size_n > mmbar_stack_guard_start(mmBar))
+        EXIT_WITH_MSG("[MMBAR]\tInsufficient memory to allocate below the stack guard...\n");
     uint32_t addr = mmBar->dynamic_end_addr;
     mmBar->dynamic_end_addr += size_n;
     return addr;
 }
 
 void mmbar_load_static_u8(MMBar *mmBar, uint8_t e) {
+    if (mmBar->static_end_addr >= mmBar->layout.stack_start)
+        EXIT_WITH_MSG("[MMBAR]\tStatic data runs into the stack at 0x%X\n", mmBar->layout.stack_start);
     mmBar->_memory[(mmBar->static_end_addr)++] = e;
     mmBar->dynamic_end_addr++;
 }
 
-void mmbar_load_text(MMBar *mmBar, std::vector<std::uint32_t> bin) {
+void mmbar_load_static(MMBar *mmBar, const uint8_t *data, uint32_t n) {
+    if ((uint64_t) mmBar->static_end_addr + n > mmBar->layout.stack_start)
+        EXIT_WITH_MSG("[MMBAR]\tStatic data runs into the stack at 0x%X\n", mmBar->layout.stack_start);
+    memcpy(mmBar->_memory + mmBar->static_end_addr, data, n);
+    mmBar->static_end_addr += n;
+    mmBar->dynamic_end_addr += n;
+}
+
+void mmbar_load_text(MMBar *mmBar, const std::vector<std::uint32_t> &bin) {
+    if ((uint64_t) bin.size() * 4 > mmBar->layout.text_size)
+        EXIT_WITH_MSG("[MMBAR]\tText of %lu bytes does not fit the 0x%X bytes text segment\n",
+                      (unsigned long) bin.size() * 4, mmBar->layout.text_size);
     for (uint32_t bl: bin) {
         mmbar_writeu32(mmBar, mmBar->text_end_addr, bl);
         mmBar->text_end_addr += 4;
     }
 }
 
-void mmbar_init(MMBar *mmBar) {
-    mmBar->_memory = SMALLOC(uint8_t, MEM_SIZE);
-    memset(mmBar->_memory, 0, MEM_SIZE);
+void mmbar_set_text_hook(MMBar *mmBar, mmbar_text_hook_t hook, void *ctx) {
+    mmBar->text_write_hook = hook;
+    mmBar->text_write_ctx = ctx;
+}
+
+void mmbar_init(MMBar *mmBar, const MemLayout *layout) {
+    // reserve the guest address space without committing it: pages are
+    // zero-filled by the kernel on first touch, so resident memory follows
+    // what the guest actually uses instead of mem_size
+    void *memory = mmap(NULL, layout->mem_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+        EXIT_WITH_MSG("[MMBAR]\tFailed to reserve %lu bytes of guest memory\n",
+                      (unsigned long) layout->mem_size);
+    mmBar->_memory = (uint8_t *) memory;
+    mmBar->layout = *layout;
+    mmBar->limit = layout->mem_size;
+    mmBar->reserved = layout->mem_size;
+    mmBar->guarded = false;
+    mmBar->huge = false;
     mmBar->initialized = true;
+    mmbar_set_text_hook(mmBar, NULL, NULL);
+    __reset_mmcounters(mmBar);
+}
+
+void mmbar_init_guarded(MMBar *mmBar, const MemLayout *layout) {
+    void *memory = mmap(NULL, MEM_GUARD_RESERVE, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+        EXIT_WITH_MSG("[MMBAR]\tFailed to reserve %lu bytes of guarded guest memory\n", MEM_GUARD_RESERVE);
+
+    uint8_t *base = (uint8_t *) memory;
+    uint32_t guard = layout->stack_start - MEM_STACK_GUARD_SIZE;
+    if (mprotect(base, guard, PROT_READ | PROT_WRITE) != 0 ||
+        mprotect(base + layout->stack_start, layout->mem_size - layout->stack_start,
+                 PROT_READ | PROT_WRITE) != 0)
+        EXIT_WITH_MSG("[MMBAR]\tFailed to map guarded guest memory\n");
+
+    mmBar->_memory = base;
+    mmBar->layout = *layout;
+    mmBar->limit = layout->mem_size;
+    mmBar->reserved = MEM_GUARD_RESERVE;
+    mmBar->guarded = true;
+    mmBar->huge = false;
+    mmBar->initialized = true;
+    mmbar_set_text_hook(mmBar, NULL, NULL);
+    __reset_mmcounters(mmBar);
+    PRINTF_DEBUG_VERBOSE(verbose, "[MMBAR]\t\tGuard pages above 0x%lX and at [0x%X, 0x%X)\n",
+                         (unsigned long) layout->mem_size, guard, layout->stack_start);
+}
+
+bool mmbar_advise_huge(MMBar *mmBar) {
+#ifdef MADV_HUGEPAGE
+    if (madvise(mmBar->_memory, mmBar->layout.mem_size, MADV_HUGEPAGE) == 0) {
+        mmBar->huge = true;
+        PRINTF_DEBUG_VERBOSE(verbose, "[MMBAR]\t\tTransparent huge pages requested\n");
+        return true;
+    }
+#endif
+    PRINTF_ERR_STAMP("[MMBAR]\t\tHuge pages unavailable, using normal pages\n");
+    return false;
+}
+
+uint64_t mmbar_huge_pages(MMBar *mmBar) {
+    // the reservation may be split into several mappings by the guard pages,
+    // add up AnonHugePages of every one of them
+    FILE *smaps = fopen("/proc/self/smaps", "r");
+    if (!smaps)
+        return 0;
+
+    uintptr_t lo = (uintptr_t) mmBar->_memory, hi = lo + mmBar->reserved;
+    bool inside = false;
+    uint64_t kb = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), smaps)) {
+        unsigned long start, end, n;
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            inside = start < hi && end > lo;
+        else if (inside && sscanf(line, "AnonHugePages: %lu kB", &n) == 1)
+            kb += n;
+    }
+    fclose(smaps);
+    return kb * 1024 / MEM_HUGE_PAGE_SIZE;
+}
+
+bool mmbar_fault_addr(MMBar *mmBar, const void *host, uint64_t *addr) {
+    const uint8_t *p = (const uint8_t *) host;
+    if (!mmBar->_memory || p < mmBar->_memory || p >= mmBar->_memory + mmBar->reserved)
+        return false;
+    *addr = (uint64_t) (p - mmBar->_memory);
+    return true;
+}
+
+void mmbar_reset(MMBar *mmBar) {
+    if (mmBar->_memory && madvise(mmBar->_memory, mmBar->layout.mem_size, MADV_DONTNEED) != 0)
+        EXIT_WITH_MSG("[MMBAR]\tFailed to reset guest memory\n");
+    mmbar_set_text_hook(mmBar, NULL, NULL);
     __reset_mmcounters(mmBar);
 }
 
 void mmbar_free(MMBar *mmBar) {
     mmBar->initialized = false;
-    SFREE(mmBar->_memory);
+    mmBar->limit = 0;
+    mmbar_set_text_hook(mmBar, NULL, NULL);
+    if (mmBar->_memory) {
+        munmap(mmBar->_memory, mmBar->reserved);
+        mmBar->_memory = NULL;
+    }
+    mmBar->guarded = false;
     __reset_mmcounters(mmBar);
 }
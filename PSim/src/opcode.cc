@@ -0,0 +1,265 @@
+/**
+ * @filename: opcode.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: instruction descriptors, looked up by mnemonic or by encoding
+ * @date: 4/2/2021
+ */
+
+#include "opcode.h"
+#include "register.hh"
+#include "utils.hh"
+
+#include <stdio.h>
+#include <string.h>
+
+#define ISA_HASH_BITS 9                     // 512 slots for the mnemonics
+#define ISA_HASH_SEED 0x1154efu             // searched offline: no two mnemonics share a slot
+#define ISA_NONE 0xFF                       // empty slot
+#define ISA_NO_FUNCT 0x40                   // key of ISA_I and ISA_J, no funct or rt is this
+
+static constexpr OpcodeDesc isa_table[] = {
+        // mnemonic    format      opcode  funct   operands                            micro-op         pseudo
+        {"add",       ISA_R,      0x00,   0x20,   {FLD_RD, FLD_RS, FLD_RT},          UOP_ADD,        false},
+        {"addu",      ISA_R,      0x00,   0x21,   {FLD_RD, FLD_RS, FLD_RT},          UOP_ADDU,       false},
+        {"addi",      ISA_I,      0x08,   0x00,   {FLD_RT, FLD_RS, FLD_IMM},         UOP_ADDI,       false},
+        {"addiu",     ISA_I,      0x09,   0x00,   {FLD_RT, FLD_RS, FLD_IMM},         UOP_ADDIU,      false},
+        {"and",       ISA_R,      0x00,   0x24,   {FLD_RD, FLD_RS, FLD_RT},          UOP_AND,        false},
+        {"andi",      ISA_I,      0x0c,   0x00,   {FLD_RT, FLD_RS, FLD_UIMM},        UOP_ANDI,       false},
+        {"clo",       ISA_R,      0x1c,   0x21,   {FLD_RD, FLD_RS},                  UOP_BAD_OPCODE, false},
+        {"clz",       ISA_R,      0x1c,   0x20,   {FLD_RD, FLD_RS},                  UOP_BAD_OPCODE, false},
+        {"div",       ISA_R,      0x00,   0x1a,   {FLD_RS, FLD_RT},                  UOP_DIV,        false},
+        {"divu",      ISA_R,      0x00,   0x1b,   {FLD_RS, FLD_RT},                  UOP_DIVU,       false},
+        {"mult",      ISA_R,      0x00,   0x18,   {FLD_RS, FLD_RT},                  UOP_MULT,       false},
+        {"multu",     ISA_R,      0x00,   0x19,   {FLD_RS, FLD_RT},                  UOP_MULTU,      false},
+        {"madd",      ISA_R,      0x1c,   0x00,   {FLD_RS, FLD_RT},                  UOP_BAD_OPCODE, false},
+        {"msub",      ISA_R,      0x1c,   0x04,   {FLD_RS, FLD_RT},                  UOP_BAD_OPCODE, false},
+        {"maddu",     ISA_R,      0x1c,   0x01,   {FLD_RS, FLD_RT},                  UOP_BAD_OPCODE, false},
+        {"msubu",     ISA_R,      0x1c,   0x05,   {FLD_RS, FLD_RT},                  UOP_BAD_OPCODE, false},
+        {"nor",       ISA_R,      0x00,   0x27,   {FLD_RD, FLD_RS, FLD_RT},          UOP_NOR,        false},
+        {"or",        ISA_R,      0x00,   0x25,   {FLD_RD, FLD_RS, FLD_RT},          UOP_OR,         false},
+        {"ori",       ISA_I,      0x0d,   0x00,   {FLD_RT, FLD_RS, FLD_UIMM},        UOP_ORI,        false},
+        {"sll",       ISA_R,      0x00,   0x00,   {FLD_RD, FLD_RT, FLD_SHAMT},       UOP_SLL,        false},
+        {"sllv",      ISA_R,      0x00,   0x04,   {FLD_RD, FLD_RT, FLD_RS},          UOP_SLLV,       false},
+        {"sra",       ISA_R,      0x00,   0x03,   {FLD_RD, FLD_RT, FLD_SHAMT},       UOP_SRA,        false},
+        {"srav",      ISA_R,      0x00,   0x07,   {FLD_RD, FLD_RT, FLD_RS},          UOP_SRAV,       false},
+        {"srl",       ISA_R,      0x00,   0x02,   {FLD_RD, FLD_RT, FLD_SHAMT},       UOP_SRL,        false},
+        {"srlv",      ISA_R,      0x00,   0x06,   {FLD_RD, FLD_RT, FLD_RS},          UOP_SRLV,       false},
+        {"sub",       ISA_R,      0x00,   0x22,   {FLD_RD, FLD_RS, FLD_RT},          UOP_SUB,        false},
+        {"subu",      ISA_R,      0x00,   0x23,   {FLD_RD, FLD_RS, FLD_RT},          UOP_SUBU,       false},
+        {"xor",       ISA_R,      0x00,   0x26,   {FLD_RD, FLD_RS, FLD_RT},          UOP_XOR,        false},
+        {"xori",      ISA_I,      0x0e,   0x00,   {FLD_RT, FLD_RS, FLD_UIMM},        UOP_XORI,       false},
+        {"lui",       ISA_I,      0x0f,   0x00,   {FLD_RT, FLD_UIMM},                UOP_LUI,        false},
+        {"slt",       ISA_R,      0x00,   0x2a,   {FLD_RD, FLD_RS, FLD_RT},          UOP_SLT,        false},
+        {"sltu",      ISA_R,      0x00,   0x2b,   {FLD_RD, FLD_RS, FLD_RT},          UOP_SLTU,       false},
+        {"slti",      ISA_I,      0x0a,   0x00,   {FLD_RT, FLD_RS, FLD_IMM},         UOP_SLTI,       false},
+        {"sltiu",     ISA_I,      0x0b,   0x00,   {FLD_RT, FLD_RS, FLD_IMM},         UOP_SLTIU,      false},
+        {"beq",       ISA_I,      0x04,   0x00,   {FLD_RS, FLD_RT, FLD_BRANCH},      UOP_BEQ,        false},
+        {"bgez",      ISA_REGIMM, 0x01,   0x01,   {FLD_RS, FLD_BRANCH},              UOP_BGEZ,       false},
+        {"bgezal",    ISA_REGIMM, 0x01,   0x11,   {FLD_RS, FLD_BRANCH},              UOP_BGEZAL,     false},
+        {"bgtz",      ISA_I,      0x07,   0x00,   {FLD_RS, FLD_BRANCH},              UOP_BGTZ,       false},
+        {"blez",      ISA_I,      0x06,   0x00,   {FLD_RS, FLD_BRANCH},              UOP_BLEZ,       false},
+        {"bltzal",    ISA_REGIMM, 0x01,   0x10,   {FLD_RS, FLD_BRANCH},              UOP_BLTZAL,     false},
+        {"bltz",      ISA_REGIMM, 0x01,   0x00,   {FLD_RS, FLD_BRANCH},              UOP_BLTZ,       false},
+        {"bne",       ISA_I,      0x05,   0x00,   {FLD_RS, FLD_RT, FLD_BRANCH},      UOP_BNE,        false},
+        {"j",         ISA_J,      0x02,   0x00,   {FLD_TARGET},                      UOP_J,          false},
+        {"jal",       ISA_J,      0x03,   0x00,   {FLD_TARGET},                      UOP_JAL,        false},
+        {"jalr",      ISA_R,      0x00,   0x09,   {FLD_RS, FLD_RD},                  UOP_JALR,       false},
+        {"jr",        ISA_R,      0x00,   0x08,   {FLD_RS},                          UOP_JR,         false},
+        {"teq",       ISA_R,      0x00,   0x34,   {FLD_RS, FLD_RT},                  UOP_TEQ,        false},
+        {"teqi",      ISA_REGIMM, 0x01,   0x0c,   {FLD_RS, FLD_IMM},                 UOP_BAD_RBT,    false},
+        {"tne",       ISA_R,      0x00,   0x36,   {FLD_RS, FLD_RT},                  UOP_TNE,        false},
+        {"tnei",      ISA_REGIMM, 0x01,   0x0e,   {FLD_RS, FLD_IMM},                 UOP_TNEI,       false},
+        {"tge",       ISA_R,      0x00,   0x30,   {FLD_RS, FLD_RT},                  UOP_TGE,        false},
+        {"tgeu",      ISA_R,      0x00,   0x31,   {FLD_RS, FLD_RT},                  UOP_TGEU,       false},
+        {"tgei",      ISA_REGIMM, 0x01,   0x08,   {FLD_RS, FLD_IMM},                 UOP_TGEI,       false},
+        {"tgeiu",     ISA_REGIMM, 0x01,   0x09,   {FLD_RS, FLD_IMM},                 UOP_TGEIU,      false},
+        {"tlt",       ISA_R,      0x00,   0x32,   {FLD_RS, FLD_RT},                  UOP_TLT,        false},
+        {"tltu",      ISA_R,      0x00,   0x33,   {FLD_RS, FLD_RT},                  UOP_TLTU,       false},
+        {"tlti",      ISA_REGIMM, 0x01,   0x0a,   {FLD_RS, FLD_IMM},                 UOP_TLTI,       false},
+        {"tltiu",     ISA_REGIMM, 0x01,   0x0b,   {FLD_RS, FLD_IMM},                 UOP_TLTIU,      false},
+        {"lb",        ISA_I,      0x20,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LB,         false},
+        {"lbu",       ISA_I,      0x24,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LBU,        false},
+        {"lh",        ISA_I,      0x21,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LH,         false},
+        {"lhu",       ISA_I,      0x25,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LHU,        false},
+        {"lw",        ISA_I,      0x23,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LW,         false},
+        {"lwl",       ISA_I,      0x22,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LWL,        false},
+        {"lwr",       ISA_I,      0x26,   0x00,   {FLD_RT, FLD_ADDR},                UOP_LWR,        false},
+        {"ll",        ISA_I,      0x30,   0x00,   {FLD_RT, FLD_ADDR},                UOP_BAD_OPCODE, false},
+        {"sb",        ISA_I,      0x28,   0x00,   {FLD_RT, FLD_ADDR},                UOP_SB,         false},
+        {"sh",        ISA_I,      0x29,   0x00,   {FLD_RT, FLD_ADDR},                UOP_SH,         false},
+        {"sw",        ISA_I,      0x2b,   0x00,   {FLD_RT, FLD_ADDR},                UOP_SW,         false},
+        {"swl",       ISA_I,      0x2a,   0x00,   {FLD_RT, FLD_ADDR},                UOP_SWL,        false},
+        {"swr",       ISA_I,      0x2e,   0x00,   {FLD_RT, FLD_ADDR},                UOP_SWR,        false},
+        {"sc",        ISA_I,      0x38,   0x00,   {FLD_RT, FLD_ADDR},                UOP_BAD_OPCODE, false},
+        {"mfhi",      ISA_R,      0x00,   0x10,   {FLD_RD},                          UOP_MFHI,       false},
+        {"mflo",      ISA_R,      0x00,   0x12,   {FLD_RD},                          UOP_MFLO,       false},
+        {"mthi",      ISA_R,      0x00,   0x11,   {FLD_RS},                          UOP_MTHI,       false},
+        {"mtlo",      ISA_R,      0x00,   0x13,   {FLD_RS},                          UOP_MTLO,       false},
+        {"syscall",   ISA_R,      0x00,   0x0c,   {},                                UOP_SYSCALL,    false},
+
+        // pseudo-instructions, each one word with the operands it leaves out as $zero or 0
+        {"nop",       ISA_R,      0x00,   0x00,   {},                                UOP_SLL,        true},   // sll $zero, $zero, 0
+        {"move",      ISA_R,      0x00,   0x21,   {FLD_RD, FLD_RS},                  UOP_ADDU,       true},   // addu rd, rs, $zero
+        {"not",       ISA_R,      0x00,   0x27,   {FLD_RD, FLD_RS},                  UOP_NOR,        true},   // nor rd, rs, $zero
+        {"neg",       ISA_R,      0x00,   0x22,   {FLD_RD, FLD_RT},                  UOP_SUB,        true},   // sub rd, $zero, rt
+        {"b",         ISA_I,      0x04,   0x00,   {FLD_BRANCH},                      UOP_BEQ,        true},   // beq $zero, $zero, label
+        {"beqz",      ISA_I,      0x04,   0x00,   {FLD_RS, FLD_BRANCH},              UOP_BEQ,        true},   // beq rs, $zero, label
+        {"bnez",      ISA_I,      0x05,   0x00,   {FLD_RS, FLD_BRANCH},              UOP_BNE,        true},   // bne rs, $zero, label
+};
+
+static constexpr uint32_t ISA_NUM = sizeof(isa_table) / sizeof(isa_table[0]);
+
+static_assert(ISA_NUM < ISA_NONE, "descriptor indices are bytes");
+
+// the table is generated at compile time, an index per slot or per code
+// from a search of isa_table; C++11 has no std::index_sequence of its own
+
+template<uint32_t... I>
+struct IsaSeq {
+};
+
+template<uint32_t N, uint32_t... I>
+struct IsaMakeSeq : IsaMakeSeq<N - 1, N - 1, I...> {
+};
+
+template<uint32_t... I>
+struct IsaMakeSeq<0, I...> {
+    typedef IsaSeq<I...> type;
+};
+
+template<uint32_t N>
+struct IsaIndex {
+    uint8_t index[N];
+};
+
+static constexpr uint32_t __isa_slot(unsigned int h) {
+    return (uint32_t) (h * ISA_HASH_SEED) >> (32 - ISA_HASH_BITS);
+}
+
+/* entry whose mnemonic hashes to slot */
+static constexpr uint8_t __isa_by_slot(uint32_t slot, uint32_t i = 0) {
+    return i == ISA_NUM ? ISA_NONE
+           : __isa_slot(hash(isa_table[i].mnemonic)) == slot ? (uint8_t) i
+           : __isa_by_slot(slot, i + 1);
+}
+
+/* what tells the instruction apart once its opcode is known */
+static constexpr uint32_t __isa_key(const OpcodeDesc &desc) {
+    return desc.format == ISA_R || desc.format == ISA_REGIMM ? desc.funct : ISA_NO_FUNCT;
+}
+
+/* real instruction of an opcode and key */
+static constexpr uint8_t __isa_by_code(uint32_t opcode, uint32_t key, uint32_t i = 0) {
+    return i == ISA_NUM ? ISA_NONE
+           : !isa_table[i].pseudo && isa_table[i].opcode == opcode && __isa_key(isa_table[i]) == key
+             ? (uint8_t) i
+           : __isa_by_code(opcode, key, i + 1);
+}
+
+/* every mnemonic finds itself, and so does every encoding */
+static constexpr bool __isa_check(uint32_t i = 0) {
+    return i == ISA_NUM
+           || (__isa_by_slot(__isa_slot(hash(isa_table[i].mnemonic))) == i
+               && (isa_table[i].pseudo || __isa_by_code(isa_table[i].opcode, __isa_key(isa_table[i])) == i)
+               && __isa_check(i + 1));
+}
+
+static_assert(__isa_check(), "two mnemonics share a slot, try another ISA_HASH_SEED, or two instructions an encoding");
+
+template<uint32_t... S>
+static constexpr IsaIndex<sizeof...(S)> __isa_slots(IsaSeq<S...>) {
+    return {{__isa_by_slot(S)...}};
+}
+
+template<uint32_t... K>
+static constexpr IsaIndex<sizeof...(K)> __isa_codes(uint32_t opcode, IsaSeq<K...>) {
+    return {{__isa_by_code(opcode, K)...}};
+}
+
+template<uint32_t... O>
+static constexpr IsaIndex<sizeof...(O)> __isa_opcodes(IsaSeq<O...>) {
+    return {{__isa_by_code(O, ISA_NO_FUNCT)...}};
+}
+
+static constexpr IsaIndex<1 << ISA_HASH_BITS> isa_slots = __isa_slots(IsaMakeSeq<1 << ISA_HASH_BITS>::type());
+static constexpr IsaIndex<64> isa_opcodes = __isa_opcodes(IsaMakeSeq<64>::type());
+static constexpr IsaIndex<64> isa_special = __isa_codes(0x00, IsaMakeSeq<64>::type());     // by funct
+static constexpr IsaIndex<64> isa_special2 = __isa_codes(0x1c, IsaMakeSeq<64>::type());    // by funct
+static constexpr IsaIndex<32> isa_regimm = __isa_codes(0x01, IsaMakeSeq<32>::type());      // by rt
+
+const OpcodeDesc *isa_lookup(const char *mnemonic, uint32_t size, uint32_t h) {
+    uint8_t i = isa_slots.index[__isa_slot(h)];
+    if (i == ISA_NONE)
+        return NULL;
+
+    const OpcodeDesc *desc = &isa_table[i];
+    if (strncmp(desc->mnemonic, mnemonic, size) != 0 || desc->mnemonic[size] != '\0')
+        return NULL;
+    return desc;
+}
+
+const OpcodeDesc *isa_decode(uint32_t word) {
+    uint32_t opcode = word >> 26;
+    uint8_t i;
+    switch (opcode) {
+        case 0x00:
+            i = isa_special.index[word & 0x3F];
+            break;
+        case 0x01:
+            i = isa_regimm.index[(word >> 16) & 0x1F];
+            break;
+        case 0x1c:
+            i = isa_special2.index[word & 0x3F];
+            break;
+        default:
+            i = isa_opcodes.index[opcode];
+            break;
+    }
+    return i == ISA_NONE ? NULL : &isa_table[i];
+}
+
+bool isa_disassemble(uint32_t word, uint32_t pc, char *buf, size_t size) {
+    const OpcodeDesc *desc = isa_decode(word);
+    if (!desc) {
+        snprintf(buf, size, ".word 0x%08X", word);
+        return false;
+    }
+
+    uint32_t rs = (word >> 21) & 0x1F, rt = (word >> 16) & 0x1F, rd = (word >> 11) & 0x1F;
+    int16_t imm = (int16_t) (word & 0xFFFF);
+    size_t n = snprintf(buf, size, "%s", desc->mnemonic);
+    for (uint32_t i = 0; i < ISA_MAX_OPERANDS && desc->fields[i] != FLD_NONE && n < size; i++) {
+        const char *sep = i ? ", " : " ";
+        switch (desc->fields[i]) {
+            case FLD_RS:
+                n += snprintf(buf + n, size - n, "%s$%s", sep, register_names[rs]);
+                break;
+            case FLD_RT:
+                n += snprintf(buf + n, size - n, "%s$%s", sep, register_names[rt]);
+                break;
+            case FLD_RD:
+                n += snprintf(buf + n, size - n, "%s$%s", sep, register_names[rd]);
+                break;
+            case FLD_SHAMT:
+                n += snprintf(buf + n, size - n, "%s%u", sep, (word >> 6) & 0x1F);
+                break;
+            case FLD_IMM:
+                n += snprintf(buf + n, size - n, "%s%d", sep, imm);
+                break;
+            case FLD_UIMM:
+                n += snprintf(buf + n, size - n, "%s0x%X", sep, (uint16_t) imm);
+                break;
+            case FLD_BRANCH:
+                n += snprintf(buf + n, size - n, "%s0x%08X", sep, pc + 4 + (int32_t) imm * 4);
+                break;
+            case FLD_TARGET:
+                n += snprintf(buf + n, size - n, "%s0x%08X", sep, (word & 0x3FFFFFF) << 2);
+                break;
+            case FLD_ADDR:
+                n += snprintf(buf + n, size - n, "%s%d($%s)", sep, imm, register_names[rs]);
+                break;
+        }
+    }
+    return true;
+}
@@ -7,6 +7,7 @@
  */
 
 #include "options.hh"
+#include "jit.hh"
 
 bool verbose = false;
 
@@ -42,6 +43,122 @@ static void print_usage(char *prg_name) {
            "               Specify the path to the standard\n"
            "               output file of the program      \n"
            "                                               \n"
+           "  --engine [ENGINE]                            \n"
+           "               Select the execution engine of  \n"
+           "               the simulation: predecode,      \n"
+           "               threaded (computed-goto dispatch),\n"
+           "               block (chained basic blocks) or \n"
+           "               jit (block with x86-64 translation\n"
+           "               of hot blocks)                  \n"
+           "               (default to predecode)          \n"
+           "                                               \n"
+           "  --jit_threshold [N]                          \n"
+           "               Executions of a block before the\n"
+           "               jit engine translates it        \n"
+           "               (default to 64)                 \n"
+           "                                               \n"
+           "  --jit_cache_size [KB]                        \n"
+           "               Size limit of the translated code\n"
+           "               cache, in KiB                   \n"
+           "               (default to 16384)              \n"
+           "                                               \n"
+           "  --layout [DESCRIPTOR]                        \n"
+           "               Guest address-space layout, as  \n"
+           "               comma separated key=value pairs \n"
+           "               over mem_size, text_start,      \n"
+           "               text_size, data_start,          \n"
+           "               stack_start and stack_top       \n"
+           "               (default to mem_size=0x80000000,\n"
+           "               text_start=0x400000,            \n"
+           "               text_size=0x100000,             \n"
+           "               data_start=0x500000,            \n"
+           "               stack_start=0xA00000,           \n"
+           "               stack_top=0x1000000)            \n"
+           "                                               \n"
+           "  --guard_pages                                \n"
+           "               Surround guest memory and the   \n"
+           "               stack with inaccessible guard   \n"
+           "               pages: loads and stores skip the\n"
+           "               bounds check and an access out of\n"
+           "               range stops the simulation with \n"
+           "               a fault report                  \n"
+           "                                               \n"
+           "  --huge_pages                                 \n"
+           "               Ask for 2 MiB transparent huge  \n"
+           "               pages behind guest memory, and  \n"
+           "               report how many were obtained at\n"
+           "               exit (falls back to normal pages)\n"
+           "                                               \n"
+           "  --max_instructions [N]                       \n"
+           "               Stop the simulation once N      \n"
+           "               instructions retired, report the\n"
+           "               pc it stopped at and exit with  \n"
+           "               125 (default to unlimited)      \n"
+           "                                               \n"
+           "  --timeout [MS]                               \n"
+           "               Stop the simulation after MS    \n"
+           "               milliseconds of wall-clock time,\n"
+           "               report the pc it stopped at and \n"
+           "               exit with 124 (default to       \n"
+           "               unlimited)                      \n"
+           "                                               \n"
+           "  --batch [MANIFEST]                           \n"
+           "               Run every job of the manifest in\n"
+           "               this process on a pool of worker\n"
+           "               threads, one job per line:      \n"
+           "               ASM INPUT|- EXPECTED|- [BUDGET  \n"
+           "               [TIMEOUT_MS [FILES|-]]], and    \n"
+           "               report them in manifest order;  \n"
+           "               FILES replaces --vfs_expect for \n"
+           "               the job                         \n"
+           "                                               \n"
+           "  --fork_server [INPUT_LIST]                   \n"
+           "               Assemble and load the --ELF     \n"
+           "               program once, then fork a child \n"
+           "               per input file of the list (one \n"
+           "               path per line) and report their \n"
+           "               exit status and stdout in list  \n"
+           "               order                           \n"
+           "                                               \n"
+           "  --jobs [N]                                   \n"
+           "               Worker threads of --batch and   \n"
+           "               of the assembler, or children   \n"
+           "               alive at once with --fork_server\n"
+           "               (default to the number of cores)\n"
+           "                                               \n"
+           "  --job_budget [N]                             \n"
+           "               Instructions a batch job may    \n"
+           "               retire unless its manifest line \n"
+           "               sets one (default to unlimited) \n"
+           "                                               \n"
+           "  --job_timeout [MS]                           \n"
+           "               Wall-clock limit of a batch job \n"
+           "               unless its manifest line sets   \n"
+           "               one (default to unlimited)      \n"
+           "                                               \n"
+           "  --vfs [DIR|MANIFEST]                         \n"
+           "               Serve the file syscalls from    \n"
+           "               memory, preloaded with the files\n"
+           "               under DIR or of a manifest of   \n"
+           "               GUEST_PATH HOST_PATH lines; the \n"
+           "               files written are kept in memory\n"
+           "               (every batch job gets its own)  \n"
+           "                                               \n"
+           "  --vfs_dump [DIR]                             \n"
+           "               Write the files captured by --vfs\n"
+           "               under DIR at exit (ignored by   \n"
+           "               --batch and --fork_server)      \n"
+           "                                               \n"
+           "  --vfs_expect [DIR]                           \n"
+           "               Compare the files left by --vfs \n"
+           "               with those under DIR at exit: a \n"
+           "               file missing, differing or not  \n"
+           "               expected fails a batch job      \n"
+           "                                               \n"
+           "  --stats                                      \n"
+           "               Report execution engine         \n"
+           "               statistics at exit              \n"
+           "                                               \n"
            "  --verbose                                    \n"
            "               Specify this option to enable   \n"
            "               a detailed and informative      \n"
@@ -84,7 +201,24 @@ enum opt_types {
     OP_STDIN,
     OP_FULL_FLOW,
     OP_OUTPUT_BIN,
-    OP_OUTPUT_STDOUT
+    OP_OUTPUT_STDOUT,
+    OP_ENGINE,
+    OP_STATS,
+    OP_JIT_THRESHOLD,
+    OP_JIT_CACHE_SIZE,
+    OP_GUARD_PAGES,
+    OP_HUGE_PAGES,
+    OP_LAYOUT,
+    OP_BATCH,
+    OP_JOBS,
+    OP_JOB_BUDGET,
+    OP_JOB_TIMEOUT,
+    OP_FORK_SERVER,
+    OP_VFS,
+    OP_VFS_DUMP,
+    OP_VFS_EXPECT,
+    OP_MAX_INSTRUCTIONS,
+    OP_TIMEOUT
 };
 
 static struct option parch_long_opts[] = {
@@ -98,19 +232,60 @@ static struct option parch_long_opts[] = {
         {"full_flow", no_argument, 0, OP_FULL_FLOW},
         {"output_bin", required_argument, 0, OP_OUTPUT_BIN},
         {"output_stdout", required_argument, 0, OP_OUTPUT_STDOUT},
+        {"engine", required_argument, 0, OP_ENGINE},
+        {"stats", no_argument, 0, OP_STATS},
+        {"jit_threshold", required_argument, 0, OP_JIT_THRESHOLD},
+        {"jit_cache_size", required_argument, 0, OP_JIT_CACHE_SIZE},
+        {"guard_pages", no_argument, 0, OP_GUARD_PAGES},
+        {"huge_pages", no_argument, 0, OP_HUGE_PAGES},
+        {"layout", required_argument, 0, OP_LAYOUT},
+        {"batch", required_argument, 0, OP_BATCH},
+        {"jobs", required_argument, 0, OP_JOBS},
+        {"job_budget", required_argument, 0, OP_JOB_BUDGET},
+        {"job_timeout", required_argument, 0, OP_JOB_TIMEOUT},
+        {"fork_server", required_argument, 0, OP_FORK_SERVER},
+        {"vfs", required_argument, 0, OP_VFS},
+        {"vfs_dump", required_argument, 0, OP_VFS_DUMP},
+        {"vfs_expect", required_argument, 0, OP_VFS_EXPECT},
+        {"max_instructions", required_argument, 0, OP_MAX_INSTRUCTIONS},
+        {"timeout", required_argument, 0, OP_TIMEOUT},
+        {0, 0, 0, 0}
 };
 
 void options_init(Options *options) {
     options->ELF = NULL;
+    options->ASM = NULL;
+    options->input_file = NULL;
+    options->output_bin = NULL;
+    options->output_stdout = NULL;
+    options->layout = NULL;
+    options->batch = NULL;
+    options->fork_server = NULL;
+    options->vfs = NULL;
+    options->vfs_dump = NULL;
+    options->vfs_expect = NULL;
     options->from_elf = false;
     options->from_std_in = false;
     options->full_flow = false;
     options->from_asm = false;
+    options->assembly_only = false;
+    options->input_from_file = false;
     options->function_only = false;
     options->enable_OoOE = false;
     options->enable_hazard = false;
     options->require_output_bin = false;
     options->require_output_stdout = false;
+    options->report_stats = false;
+    options->guard_pages = false;
+    options->huge_pages = false;
+    options->engine = ENGINE_PREDECODE;
+    options->jit_threshold = JIT_DEFAULT_THRESHOLD;
+    options->jit_cache_kb = JIT_DEFAULT_CACHE_KB;
+    options->jobs = 0;
+    options->job_budget = 0;
+    options->job_timeout_ms = 0;
+    options->max_instructions = 0;
+    options->timeout_ms = 0;
 }
 
 void options_free(Options *options) {
@@ -133,6 +308,11 @@ void options_free(Options *options) {
 bool options_validate(Options *options) {
     PRINTF_DEBUG_VERBOSE(verbose, "[OPT]\tvalidate options\n");
 
+    if (options->batch) {
+        PRINTF_DEBUG_VERBOSE(verbose, "[OPT]\tOption enabled: batch from %s\n", options->batch);
+        return 0;
+    }
+
     if (!(options->from_elf) && !(options->from_std_in) && !(options->from_asm)) {
         EXIT_WITH_MSG("[!] neither ELF, stdin or asm file is specified, please specify...\n");
     }
@@ -226,6 +406,91 @@ void options_parse(Options *options, int argc, char **argv) {
                 copy_opt(&options->output_stdout, optarg);
                 break;
 
+            case OP_ENGINE:
+                switch (hash(optarg)) {
+                    case hash("predecode"):
+                        options->engine = ENGINE_PREDECODE;
+                        break;
+                    case hash("threaded"):
+                        options->engine = ENGINE_THREADED;
+                        break;
+                    case hash("block"):
+                        options->engine = ENGINE_BLOCK;
+                        break;
+                    case hash("jit"):
+                        options->engine = ENGINE_JIT;
+                        break;
+                    default:
+                        EXIT_WITH_MSG("[!] unknown engine: %s\n", optarg);
+                }
+                break;
+
+            case OP_STATS:
+                options->report_stats = true;
+                break;
+
+            case OP_JIT_THRESHOLD:
+                options->jit_threshold = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+
+            case OP_JIT_CACHE_SIZE:
+                options->jit_cache_kb = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+
+            case OP_GUARD_PAGES:
+                options->guard_pages = true;
+                break;
+
+            case OP_HUGE_PAGES:
+                options->huge_pages = true;
+                break;
+
+            case OP_LAYOUT:
+                copy_opt(&options->layout, optarg);
+                break;
+
+            case OP_BATCH:
+                copy_opt(&options->batch, optarg);
+                break;
+
+            case OP_JOBS:
+                options->jobs = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+
+            case OP_JOB_BUDGET:
+                options->job_budget = strtoull(optarg, NULL, 0);
+                break;
+
+            case OP_JOB_TIMEOUT:
+                options->job_timeout_ms = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+
+            case OP_FORK_SERVER:
+                copy_opt(&options->fork_server, optarg);
+                // the static data is only loaded for a full flow
+                options->full_flow = true;
+                break;
+
+            case OP_VFS:
+                copy_opt(&options->vfs, optarg);
+                break;
+
+            case OP_VFS_DUMP:
+                copy_opt(&options->vfs_dump, optarg);
+                break;
+
+            case OP_VFS_EXPECT:
+                copy_opt(&options->vfs_expect, optarg);
+                break;
+
+            case OP_MAX_INSTRUCTIONS:
+                options->max_instructions = strtoull(optarg, NULL, 0);
+                break;
+
+            case OP_TIMEOUT:
+                options->timeout_ms = (uint32_t) strtoul(optarg, NULL, 0);
+                break;
+
             case '?':
                 break;
 
@@ -6,46 +6,98 @@
  * @date: 2/20/2021
  */
 
+#include <new>
+#include <mutex>
+
 #include "psim.hh"
+#include "batch.hh"
+#include "forkserver.hh"
 
 void load_input(Simulator *simulator) {
-    if (!isFileExist(simulator->user_options.input_file)) {
+    if (!input_open(&simulator->input, simulator->user_options.input_file)) {
         EXIT_WITH_MSG("[SIM]\tFailed to read input file\n");
     }
+}
 
-    std::ifstream infile(simulator->user_options.input_file);
-    std::string line;
-    while (std::getline(infile, line)) {
-        simulator->inputs.push_back(line);
-    }
+static void __simulator_clear_run(Simulator *simulator) {
+    input_close(&simulator->input);
+    vfs_reset(&simulator->vfs);
+    simulator->output = NULL;
+    simulator->limited = false;
+    simulator->retired = 0;
+    simulator->run_pc = 0;
+    simulator->budget = SIM_NO_BUDGET;
+    simulator->deadline = 0;
+    simulator->stop = SIM_STOP_NONE;
+    simulator->trap = SIM_TRAP_NONE;
+    simulator->trap_pc = 0;
+    simulator->fault_uop = NULL;
+}
+
+void simulator_prepare(Simulator *simulator) {
+    MemLayout layout;
+    mmbar_layout_default(&layout);
+    if (simulator->user_options.layout)
+        mmbar_layout_parse(&layout, simulator->user_options.layout);
+
+    if (simulator->user_options.guard_pages)
+        mmbar_init_guarded(&simulator->mmBar, &layout);
+    else
+        mmbar_init(&simulator->mmBar, &layout);
+    if (simulator->user_options.huge_pages)
+        mmbar_advise_huge(&simulator->mmBar);
+
+    __simulator_clear_run(simulator);
+}
+
+void simulator_reset(Simulator *simulator) {
+    console_close(&simulator->console);
+    jit_free(&simulator->jit);
+    mmbar_reset(&simulator->mmBar);
+    __simulator_clear_run(simulator);
+}
+
+void *Simulator::operator new(size_t size) {
+    void *ptr = NULL;
+    if (posix_memalign(&ptr, alignof(Simulator), size))
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void Simulator::operator delete(void *ptr) {
+    free(ptr);
 }
 
 void simulator_init(Simulator *simulator, int argc, char **argv) {
     options_init(&simulator->user_options);
     options_parse(&simulator->user_options, argc, argv);
+    if (simulator->user_options.batch)
+        return;
 
-    mmbar_init(&simulator->mmBar);
-
+    simulator_prepare(simulator);
     assembler_init(&simulator->assembler,
                    std::string(simulator->user_options.ELF),
                    simulator->user_options.from_elf);
     simulator->assembler.user_options = &simulator->user_options;
     simulator->assembler.mmBar = &simulator->mmBar;
+    simulator->bin = &simulator->assembler.bin;
 
     if (simulator->user_options.input_from_file) {
         load_input(simulator);
     }
 
-    simulator->current_input = 0;
+    if (simulator->user_options.vfs) {
+        vfs_image_load(&simulator->vfs_image, simulator->user_options.vfs);
+        vfs_init(&simulator->vfs, &simulator->vfs_image);
+    }
 }
 
 #define get_opcode(bin) (bin >> 26)
 
-std::string get_input(Simulator *simulator) {
-    if (simulator->current_input >= simulator->inputs.size()) {
+static void __next_input(Simulator *simulator, const char **line, size_t *n) {
+    if (!input_next_line(&simulator->input, line, n)) {
         EXIT_WITH_MSG("[SIM]\tFailed to get input from file\n");
     }
-    return simulator->inputs[simulator->current_input++];
 }
 
 int32_t art_rshift(int x, int n) {
@@ -55,27 +107,93 @@ int32_t art_rshift(int x, int n) {
         return x >> n;
 }
 
+static void __simulator_vfs_report(Simulator *simulator) {
+    if (simulator->user_options.vfs_dump)
+        vfs_dump(&simulator->vfs, simulator->user_options.vfs_dump);
+
+    if (simulator->user_options.vfs_expect) {
+        std::string report;
+        if (vfs_compare(&simulator->vfs, simulator->user_options.vfs_expect, &report))
+            PRINTF_ERR_STAMP("[SIM]\t[VFS]\tcaptured files match %s\n", simulator->user_options.vfs_expect);
+        else
+            PRINTF_ERR_STAMP("[SIM]\t[VFS]\tcaptured files differ from %s:\n%s",
+                             simulator->user_options.vfs_expect, report.c_str());
+    }
+}
+
+void __simulator_report(Simulator *simulator) {
+    if (vfs_enabled(&simulator->vfs))
+        __simulator_vfs_report(simulator);
+
+    if (simulator->mmBar.huge) {
+        PRINTF_ERR_STAMP("[SIM]\t[MMBAR]\thuge pages: %lu of %lu KiB\n",
+                         (unsigned long) mmbar_huge_pages(&simulator->mmBar),
+                         MEM_HUGE_PAGE_SIZE >> 10);
+    }
+
+    if (!simulator->user_options.report_stats)
+        return;
+
+    if (simulator->user_options.engine == ENGINE_BLOCK || simulator->user_options.engine == ENGINE_JIT) {
+        BlockStats *st = &simulator->block_stats;
+        PRINTF_ERR_STAMP("[SIM]\t[BLOCK]\tblocks: %lu translated, %lu executed\n",
+                         (unsigned long) simulator->blocks.size(), (unsigned long) st->executed);
+        PRINTF_ERR_STAMP("[SIM]\t[BLOCK]\tentries: %lu chained (%.2f%%), %lu lookup hits, %lu misses\n",
+                         (unsigned long) st->chain_hits,
+                         st->executed ? 100.0 * st->chain_hits / st->executed : 0.0,
+                         (unsigned long) st->lookup_hits, (unsigned long) st->misses);
+        PRINTF_ERR_STAMP("[SIM]\t[BLOCK]\tlinks: %lu, flushes: %lu\n",
+                         (unsigned long) st->links, (unsigned long) st->flushes);
+    }
+
+    if (simulator->user_options.engine == ENGINE_JIT) {
+        JitStats *st = &simulator->jit.stats;
+        PRINTF_ERR_STAMP("[SIM]\t[JIT]\tblocks: %lu translated, %lu rejected, %lu native runs\n",
+                         (unsigned long) st->translated, (unsigned long) st->rejected,
+                         (unsigned long) st->native_runs);
+        PRINTF_ERR_STAMP("[SIM]\t[JIT]\tcode cache: %lu of %lu bytes used, %lu flushes\n",
+                         (unsigned long) simulator->jit.used, (unsigned long) simulator->jit.size,
+                         (unsigned long) st->flushes);
+    }
+}
+
+int __simulator_report_stop(Simulator *simulator) {
+    switch (simulator->stop) {
+        case SIM_STOP_BUDGET:
+            PRINTF_ERR_STAMP("[SIM]\tInstruction budget exceeded: %lu instructions retired, stopped at pc 0x%08X\n",
+                             (unsigned long) simulator->retired, simulator->cpu.pc);
+            return SIM_EXIT_BUDGET;
+        case SIM_STOP_TIMEOUT:
+            PRINTF_ERR_STAMP("[SIM]\tTimed out: %lu instructions retired, stopped at pc 0x%08X\n",
+                             (unsigned long) simulator->retired, simulator->cpu.pc);
+            return SIM_EXIT_TIMEOUT;
+        default:
+            return 0;
+    }
+}
+
+/* print float/double formatted as std::cout does */
+static void __print_double(Console *console, double d) {
+    std::ostringstream os;
+    os << d;
+    std::string s = os.str();
+    console_write(console, s.data(), s.size());
+}
+
 void syscall(Simulator *simulator) {
+    CPUContext *cpu = &simulator->cpu;
     PRINTF_DEBUG_VERBOSE(verbose,
                          "[SIM]\tInvoking system call!\n");
 
-    switch (register_file[v0]) {
+    switch (cpu->regs[v0]) {
 
         case 1: {
             // print int
             PRINTF_DEBUG_VERBOSE(verbose,
                                  "[SIM]\t[SYSCALL]\tprint int\n");
-            if (simulator->user_options.require_output_stdout) {
-                std::ofstream of(simulator->user_options.output_stdout, std::ios_base::app);
-                if (of.is_open()) {
-                    of << register_file[a0];
-                    of.close();
-                } else {
-                    EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", simulator->user_options.output_stdout);
-                }
-            } else {
-                printf("%d", register_file[a0]);
-            }
+            char s[16];
+            int n = snprintf(s, sizeof(s), "%d", cpu->regs[a0]);
+            console_write(&simulator->console, s, n);
             break;
         }
 
@@ -83,17 +201,7 @@ void syscall(Simulator *simulator) {
             // print float
             PRINTF_DEBUG_VERBOSE(verbose,
                                  "[SIM]\t[SYSCALL]\tprint float\n");
-            if (simulator->user_options.require_output_stdout) {
-                std::ofstream of(simulator->user_options.output_stdout, std::ios_base::app);
-                if (of.is_open()) {
-                    of << f_register_file[f12];
-                    of.close();
-                } else {
-                    EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", simulator->user_options.output_stdout);
-                }
-            } else {
-                std::cout << f_register_file[f12];
-            }
+            __print_double(&simulator->console, cpu->f_regs[f12]);
             break;
         }
 
@@ -101,17 +209,7 @@ void syscall(Simulator *simulator) {
             // print double
             PRINTF_DEBUG_VERBOSE(verbose,
                                  "[SIM]\t[SYSCALL]\tprint double\n");
-            if (simulator->user_options.require_output_stdout) {
-                std::ofstream of(simulator->user_options.output_stdout);
-                if (of.is_open()) {
-                    of << f_register_file[f12];
-                    of.close();
-                } else {
-                    EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", simulator->user_options.output_stdout);
-                }
-            } else {
-                std::cout << f_register_file[f12];
-            }
+            __print_double(&simulator->console, cpu->f_regs[f12]);
             break;
         }
 
@@ -119,25 +217,10 @@ void syscall(Simulator *simulator) {
             // print string
             PRINTF_DEBUG_VERBOSE(verbose,
                                  "[SIM]\t[SYSCALL]\tprint string\n");
-            uint32_t _s = register_file[a0];
-
-            if (simulator->user_options.require_output_stdout) {
-                std::ofstream of(simulator->user_options.output_stdout, std::ios_base::app);
-                if (of.is_open()) {
-                    char c;
-                    while ((c = mmbar_read(&simulator->mmBar, _s++)) != '\0') {
-                        of << c;
-                    }
-                    of.close();
-                } else {
-                    EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", simulator->user_options.output_stdout);
-                }
-            } else {
-                char c;
-                while ((c = mmbar_read(&simulator->mmBar, _s++)) != '\0') {
-                    printf("%c", c);
-                }
-            }
+            uint32_t n = mmbar_strlen(&simulator->mmBar, cpu->regs[a0], NULL);
+            if (n)
+                console_write(&simulator->console,
+                              (const char *) mmbar_span(&simulator->mmBar, cpu->regs[a0], n), n);
             break;
         }
 
@@ -145,13 +228,19 @@ void syscall(Simulator *simulator) {
             // read int
             if (simulator->user_options.input_from_file) {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread int (from input file)\n");
-                int n = arbstoi(get_input(simulator));
-                register_file[v0] = n;
+                const char *line;
+                size_t len;
+                int32_t n;
+                __next_input(simulator, &line, &len);
+                if (!input_parse_int(line, len, &n))
+                    EXIT_WITH_MSG("[SIM]\tInvalid integer input: %.*s\n", (int) len, line);
+                cpu->regs[v0] = n;
             } else {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread int (from stdin)\n");
+                console_flush(&simulator->console);
                 int n;
                 std::cin >> n;
-                register_file[v0] = n;
+                cpu->regs[v0] = n;
             }
 
             break;
@@ -161,13 +250,19 @@ void syscall(Simulator *simulator) {
             // read float
             if (simulator->user_options.input_from_file) {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread float (from input file)\n");
-                float n = std::stof(get_input(simulator));
-                f_register_file[f0] = n;
+                const char *line;
+                size_t len;
+                float n;
+                __next_input(simulator, &line, &len);
+                if (!input_parse_float(line, len, &n))
+                    EXIT_WITH_MSG("[SIM]\tInvalid float input: %.*s\n", (int) len, line);
+                cpu->f_regs[f0] = n;
             } else {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread float (from stdin)\n");
+                console_flush(&simulator->console);
                 float n;
                 std::cin >> n;
-                f_register_file[f0] = n;
+                cpu->f_regs[f0] = n;
             }
 
             break;
@@ -177,13 +272,19 @@ void syscall(Simulator *simulator) {
             // read double
             if (simulator->user_options.input_from_file) {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread double (from input file)\n");
-                double n = std::stod(get_input(simulator));
-                f_register_file[f0] = n;
+                const char *line;
+                size_t len;
+                double n;
+                __next_input(simulator, &line, &len);
+                if (!input_parse_double(line, len, &n))
+                    EXIT_WITH_MSG("[SIM]\tInvalid double input: %.*s\n", (int) len, line);
+                cpu->f_regs[f0] = n;
             } else {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread double (from stdin)\n");
+                console_flush(&simulator->console);
                 double n;
                 std::cin >> n;
-                f_register_file[f0] = n;
+                cpu->f_regs[f0] = n;
             }
 
             break;
@@ -193,25 +294,28 @@ void syscall(Simulator *simulator) {
             // read string
             if (simulator->user_options.input_from_file) {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread string (from input file)\n");
-                std::string s = get_input(simulator);
-                char cs[s.length()];
-                strcpy(cs, s.c_str());
-                if (register_file[a1] <= s.length())
-                    memcpy((char *) &simulator->mmBar._memory[register_file[a0]], cs, register_file[a1]);
-                else
-                    memcpy((char *) &simulator->mmBar._memory[register_file[a0]], cs, s.length());
+                const char *line;
+                size_t len;
+                __next_input(simulator, &line, &len);
+                // at most a1 bytes, without a terminator
+                if ((uint32_t) cpu->regs[a1] < len)
+                    len = (uint32_t) cpu->regs[a1];
+                mmbar_copy_in(&simulator->mmBar, cpu->regs[a0], line, len);
             } else {
                 PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread string (from stdin)\n");
-                fgets((char *) &simulator->mmBar._memory[register_file[a0]], register_file[a1], stdin);
+                console_flush(&simulator->console);
+                char *buffer = (char *) mmbar_span(&simulator->mmBar, cpu->regs[a0], cpu->regs[a1]);
+                if (buffer && (int32_t) cpu->regs[a1] > 0 && fgets(buffer, cpu->regs[a1], stdin))
+                    mmbar_span_written(&simulator->mmBar, cpu->regs[a0], strlen(buffer) + 1);
             }
             break;
         }
 
         case 9: {
             // sbrk
-            register_file[v0] = mmbar_allocate(&simulator->mmBar, register_file[a0]);
+            cpu->regs[v0] = mmbar_allocate(&simulator->mmBar, cpu->regs[a0], cpu->regs[sp]);
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tAllocate memory: %d\n",
-                                 register_file[v0]);
+                                 cpu->regs[v0]);
             break;
         }
 
@@ -219,23 +323,15 @@ void syscall(Simulator *simulator) {
             // exit
             PRINTF_DEBUG_VERBOSE(verbose,
                                  "[SIM]\t[SYSCALL]\texit\n");
-            exit(0);
+            console_flush(&simulator->console);
+            __simulator_report(simulator);
+            exit_or_trap(0, false);
         }
 
         case 11: {
             // print char
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tprint char");
-            if (simulator->user_options.require_output_stdout) {
-                std::ofstream of(simulator->user_options.output_stdout, std::ios_base::app);
-                if (of.is_open()) {
-                    of << register_file[a0];
-                    of.close();
-                } else {
-                    EXIT_WITH_MSG("[SIM]\tFailed to open output log: %s\n", simulator->user_options.output_stdout);
-                }
-            } else {
-                printf("%c", (char) register_file[a0]);
-            }
+            console_putc(&simulator->console, (char) cpu->regs[a0]);
             break;
         }
 
@@ -244,12 +340,15 @@ void syscall(Simulator *simulator) {
             if (simulator->user_options.input_from_file) {
                 PRINTF_DEBUG_VERBOSE(verbose,
                                      "[SIM]\t[SYSCALL]\tread char (from file)\n");
-                char gc = get_input(simulator).c_str()[0];
-                register_file[v0] = gc;
+                const char *line;
+                size_t len;
+                __next_input(simulator, &line, &len);
+                cpu->regs[v0] = len ? line[0] : '\0';
             } else {
                 PRINTF_DEBUG_VERBOSE(verbose,
                                      "[SIM]\t[SYSCAL]\tread char (from stdin)\n");
-                register_file[v0] = getchar();
+                console_flush(&simulator->console);
+                cpu->regs[v0] = getchar();
             }
 
             break;
@@ -258,66 +357,99 @@ void syscall(Simulator *simulator) {
         case 13: {
             // open
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\topen file\n");
-            register_file[a0] = open((char *) &simulator->mmBar._memory[register_file[a0]], register_file[a1],
-                                     register_file[a2]);
+            bool terminated;
+            mmbar_strlen(&simulator->mmBar, cpu->regs[a0], &terminated);
+            const char *path = (const char *) mmbar_span(&simulator->mmBar, cpu->regs[a0], 1);
+            if (!terminated)
+                cpu->regs[a0] = -1;
+            else if (vfs_enabled(&simulator->vfs))
+                cpu->regs[a0] = vfs_open(&simulator->vfs, path, cpu->regs[a1]);
+            else
+                cpu->regs[a0] = open(path, cpu->regs[a1], cpu->regs[a2]);
             break;
         }
 
         case 14: {
             // read
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tread file\n");
-            char *tmp_buffer = SMALLOC(char, register_file[a2]);
-
-            register_file[a0] = read(register_file[a0], tmp_buffer, register_file[a2]);
+            // straight into guest memory, a buffer out of range fails like EFAULT
+            char *buffer = (char *) mmbar_span(&simulator->mmBar, cpu->regs[a1], cpu->regs[a2]);
+            if (!buffer) {
+                cpu->regs[a0] = -1;
+                break;
+            }
 
-            for (uint32_t i = 0; i < register_file[a2]; i++)
-                mmbar_write(&simulator->mmBar, register_file[a1] + i, tmp_buffer[i]);
+            ssize_t n;
+            if (vfs_owns(&simulator->vfs, cpu->regs[a0])) {
+                n = vfs_read(&simulator->vfs, cpu->regs[a0], buffer, cpu->regs[a2]);
+            } else {
+                if (cpu->regs[a0] == STDIN_FILENO)
+                    console_flush(&simulator->console);
+                n = read(cpu->regs[a0], buffer, cpu->regs[a2]);
+            }
+            cpu->regs[a0] = (uint32_t) n;
+            if (n <= 0)
+                break;
+            mmbar_span_written(&simulator->mmBar, cpu->regs[a1], (uint32_t) n);
 
             if (verbose) {
                 PRINTF_DEBUG_VERBOSE(verbose,
                                      "\t\tContent:");
-                for (uint32_t i = 0; i < register_file[a2]; i++)
-                    printf("%c", tmp_buffer[i]);
+                log_sync();
+                fwrite(buffer, 1, n, stdout);
             }
-
-            SFREE(tmp_buffer);
             break;
         }
 
         case 15: {
             // write
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\twrite file\n");
-            char *tmp_buffer = SMALLOC(char, register_file[a2]);
-            for (uint32_t i = 0; i < register_file[a2]; i++)
-                tmp_buffer[i] = mmbar_read(&simulator->mmBar, register_file[a1] + i);
+            const char *buffer = (const char *) mmbar_span(&simulator->mmBar, cpu->regs[a1], cpu->regs[a2]);
+            if (!buffer) {
+                cpu->regs[a0] = -1;
+                break;
+            }
 
             if (verbose) {
                 PRINTF_DEBUG_VERBOSE(verbose, "\t\tContent:");
-                for (uint32_t i = 0; i < register_file[a2]; i++)
-                    printf("%c", tmp_buffer[i]);
+                log_sync();
+                fwrite(buffer, 1, cpu->regs[a2], stdout);
             }
 
-            register_file[a0] = write(register_file[a0], tmp_buffer, register_file[a2]);
-            SFREE(tmp_buffer);
+            if (vfs_owns(&simulator->vfs, cpu->regs[a0])) {
+                cpu->regs[a0] = vfs_write(&simulator->vfs, cpu->regs[a0], buffer, cpu->regs[a2]);
+            } else if (cpu->regs[a0] == STDOUT_FILENO && console_is_stdout(&simulator->console)) {
+                // keep guest stdout in order with the print syscalls
+                console_write(&simulator->console, buffer, cpu->regs[a2]);
+                cpu->regs[a0] = cpu->regs[a2];
+            } else {
+                cpu->regs[a0] = write(cpu->regs[a0], buffer, cpu->regs[a2]);
+            }
             break;
         }
 
         case 16: {
             // close
             PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[SYSCALL]\tclose file\n");
-            close(register_file[a0]);
+            // with --vfs the host's stdin, stdout and stderr stay open
+            if (vfs_enabled(&simulator->vfs))
+                vfs_close(&simulator->vfs, cpu->regs[a0]);
+            else
+                close(cpu->regs[a0]);
             break;
         }
 
         case 17: {
             // exit2
             PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[SYSCALL]\texit with signal: %d\n", register_file[a0]);
-            exit(register_file[a0]);
+                                 "[SIM]\t[SYSCALL]\texit with signal: %d\n", cpu->regs[a0]);
+            console_flush(&simulator->console);
+            __simulator_report(simulator);
+            exit_or_trap(cpu->regs[a0], false);
         }
 
         default: {
-            PRINTF_ERR_STAMP("[SIM]\t[SYSCALL]\tUnknown system call: %d\n", register_file[v0]);
+            PRINTF_ERR_STAMP("[SIM]\t[SYSCALL]\tUnknown system call: %d\n", cpu->regs[v0]);
             break;
         }
 
@@ -325,928 +457,1565 @@ void syscall(Simulator *simulator) {
 
 }
 
-bool __decode_rcluster(Simulator *simulator, uint32_t bin) {
-#define get_funct(bin) (bin & 0x3F)
-#define get_rs(bin) ((bin >> 21) & 0x1F)
-#define get_rt(bin) ((bin >> 16) & 0x1F)
-#define get_rd(bin) ((bin >> 11) & 0x1F)
-#define get_shamt(bin) ((bin >> 6) & 0x1F)
+void debug_dump_registers(const CPUContext *cpu) {
+    std::map<std::string, uint32_t> rgm = create_regparse_map();
+    PRINTF_DEBUG_VERBOSE(verbose, "\t\tREG(");
+    uint32_t i = 0;
+    for (std::map<std::string, uint32_t>::reverse_iterator it = rgm.rbegin(); it != rgm.rend(); it++) {
+        i++;
+        log_sync();
+        printf("%s(%d) = %d, ", it->first.c_str(), it->second, cpu->regs[it->second]);
+        if (i % 8 == 0) {
+            printf("\n");
+            PRINTF_DEBUG_VERBOSE(verbose, "\t\t\t");
+        }
+    }
+    log_sync();
+    printf(")\n");
+    PRINTF_DEBUG_VERBOSE(verbose, "\n");
+}
 
-    uint32_t funct = get_funct(bin);
-    uint32_t rs = get_rs(bin);
-    uint32_t rt = get_rt(bin);
-    uint32_t rd = get_rd(bin);
-    uint32_t shamt = get_shamt(bin);
+// ========================================================================== //
+// micro-op handlers
+//
+// Each handler executes one predecoded instruction. Operands come already
+// extracted from the instruction word (see decoder.hh for the meaning of imm),
+// and the engine advances pc by 4 after the handler returns. F is the
+// sim_features set the handler is instantiated for.
+// ========================================================================== //
+
+/* the block and jit engines do not keep pc per instruction, a micro-op of the
+ * icache tells which one it is; outside the text pc is exact */
+static uint32_t __uop_pc(Simulator *simulator, const MicroOp *uop) {
+    const MicroOp *icache = simulator->icache.data();
+    if (uop >= icache && uop < icache + simulator->icache.size())
+        return simulator->mmBar.layout.text_start + ((uint32_t) (uop - icache) << 2);
+    return simulator->cpu.pc;
+}
 
-    switch (funct) {
+/* EXIT_WITH_MSG of a handler, recording the trap for simulator_try_run */
+#define RAISE_WITH_MSG(kind, format, ...) \
+    do { \
+        cpu->simulator->trap = kind; \
+        cpu->simulator->trap_pc = __uop_pc(cpu->simulator, uop); \
+        EXIT_WITH_MSG(format, ##__VA_ARGS__); \
+    } while (0)
+
+/* Loads and stores of the handlers. With SIM_FEAT_GUARD the bounds check is
+ * left to the guard pages, and the micro-op is recorded so that a fault can
+ * be traced back to its instruction */
+#define GUEST_LOAD(name, type) \
+    template<uint32_t F> \
+    static inline type __guest_##name(CPUContext *cpu, const MicroOp *uop, uint32_t addr) { \
+        if (F & SIM_FEAT_GUARD) { \
+            cpu->simulator->fault_uop = uop; \
+            return mmbar_##name##_unchecked(&cpu->simulator->mmBar, addr); \
+        } \
+        return mmbar_##name(&cpu->simulator->mmBar, addr); \
+    }
 
-        case 0: {
-            // sll
-            register_file[rd] = (unsigned) register_file[rt] << shamt;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: sll %d, %d, %d\n",
-                                 rd, rt, shamt);
-            break;
-        }
+#define GUEST_STORE(name, type) \
+    template<uint32_t F> \
+    static inline void __guest_##name(CPUContext *cpu, const MicroOp *uop, uint32_t addr, type e) { \
+        if (F & SIM_FEAT_GUARD) { \
+            cpu->simulator->fault_uop = uop; \
+            mmbar_##name##_unchecked(&cpu->simulator->mmBar, addr, e); \
+        } else { \
+            mmbar_##name(&cpu->simulator->mmBar, addr, e); \
+        } \
+    }
 
-        case 2: {
-            // srl
-            register_file[rd] = (unsigned) register_file[rt] >> shamt;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: srl %d, %d, %d\n",
-                                 rd, rt, shamt);
-            break;
-        }
+GUEST_LOAD(read, uint8_t)
+GUEST_LOAD(readu16, uint16_t)
+GUEST_LOAD(readu32, uint32_t)
+GUEST_STORE(write, uint8_t)
+GUEST_STORE(writeu16, uint16_t)
+GUEST_STORE(writeu32, uint32_t)
+
+#undef GUEST_LOAD
+#undef GUEST_STORE
+
+#define UOP_HANDLER(name) \
+    template<uint32_t F> \
+    static inline void __exec_##name(CPUContext *cpu, const MicroOp *uop)
+
+UOP_HANDLER(sll) {
+    uint32_t rd = uop->rd, rt = uop->rt, shamt = uop->imm;
+    cpu->regs[rd] = (unsigned) cpu->regs[rt] << shamt;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: sll %d, %d, %d\n",
+                         rd, rt, shamt);
+}
 
-        case 3: {
-            // sra
-            register_file[rd] = art_rshift(register_file[rt], shamt);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: sra %d, %d, %d\n",
-                                 rd, rt, shamt);
-            break;
-        }
+UOP_HANDLER(srl) {
+    uint32_t rd = uop->rd, rt = uop->rt, shamt = uop->imm;
+    cpu->regs[rd] = (unsigned) cpu->regs[rt] >> shamt;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: srl %d, %d, %d\n",
+                         rd, rt, shamt);
+}
 
-        case 4: {
-            // sllv
-            register_file[rd] = (unsigned) register_file[rt] << register_file[rs];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: sllv %d, %d, %d\n",
-                                 rd, rt, rs);
-            break;
-        }
+UOP_HANDLER(sra) {
+    uint32_t rd = uop->rd, rt = uop->rt, shamt = uop->imm;
+    cpu->regs[rd] = art_rshift(cpu->regs[rt], shamt);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: sra %d, %d, %d\n",
+                         rd, rt, shamt);
+}
 
-        case 6: {
-            // srlv
-            register_file[rd] = (unsigned) register_file[rt] >> register_file[rs];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution srlv %d, %d, %d\n",
-                                 rd, rt, rs);
-            break;
-        }
+UOP_HANDLER(sllv) {
+    uint32_t rd = uop->rd, rt = uop->rt, rs = uop->rs;
+    cpu->regs[rd] = (unsigned) cpu->regs[rt] << cpu->regs[rs];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: sllv %d, %d, %d\n",
+                         rd, rt, rs);
+}
 
-        case 7: {
-            // srav
-            register_file[rd] = art_rshift(register_file[rt], register_file[rs]);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: srav %d, %d, %d(%d)\n",
-                                 rd, rt, rs, register_file[rs]);
-            break;
-        }
+UOP_HANDLER(srlv) {
+    uint32_t rd = uop->rd, rt = uop->rt, rs = uop->rs;
+    cpu->regs[rd] = (unsigned) cpu->regs[rt] >> cpu->regs[rs];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution srlv %d, %d, %d\n",
+                         rd, rt, rs);
+}
 
-        case 8: {
-            // jr
-            simulator->pc = ((register_file[rs] - 1) << 2);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: jr %d(%d)\n", rs, register_file[rs] << 2);
-            break;
-        }
+UOP_HANDLER(srav) {
+    uint32_t rd = uop->rd, rt = uop->rt, rs = uop->rs;
+    cpu->regs[rd] = art_rshift(cpu->regs[rt], cpu->regs[rs]);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: srav %d, %d, %d(%d)\n",
+                         rd, rt, rs, cpu->regs[rs]);
+}
 
-        case 9: {
-            // jalr
-            register_file[rd] = (simulator->pc + 4) >> 2;
-            simulator->pc = (register_file[rs] << 2) - 4;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: jalr %d(%d), %d(%d)\n",
-                                 rs, register_file[rs] << 2, rd, register_file[rd]);
-            break;
-        }
+UOP_HANDLER(jr) {
+    uint32_t rs = uop->rs;
+    cpu->pc = ((cpu->regs[rs] - 1) << 2);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: jr %d(%d)\n", rs, cpu->regs[rs] << 2);
+}
 
-        case 12: {
-            // syscall
-            syscall(simulator);
-            break;
-        }
+UOP_HANDLER(jalr) {
+    uint32_t rd = uop->rd, rs = uop->rs;
+    cpu->regs[rd] = (cpu->pc + 4) >> 2;
+    cpu->pc = (cpu->regs[rs] << 2) - 4;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: jalr %d(%d), %d(%d)\n",
+                         rs, cpu->regs[rs] << 2, rd, cpu->regs[rd]);
+}
 
-        case 16: {
-            // mfhi
-            register_file[rd] = register_file[HI];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: mfhi %d\n", rd);
-            break;
-        }
+UOP_HANDLER(syscall) {
+    // also tells simulator_try_run which instruction exited
+    cpu->simulator->fault_uop = uop;
+    syscall(cpu->simulator);
+}
 
-        case 17: {
-            // mthi
-            register_file[HI] = register_file[rs];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: mthi %d(%d)\n", rs, register_file[rs]);
-            break;
-        }
+UOP_HANDLER(mfhi) {
+    uint32_t rd = uop->rd;
+    cpu->regs[rd] = cpu->regs[HI];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: mfhi %d\n", rd);
+}
 
-        case 18: {
-            // mflo
-            register_file[rd] = register_file[LO];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: mflo %d\n", rd);
-            break;
-        }
+UOP_HANDLER(mthi) {
+    uint32_t rs = uop->rs;
+    cpu->regs[HI] = cpu->regs[rs];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: mthi %d(%d)\n", rs, cpu->regs[rs]);
+}
 
-        case 19: {
-            // mtlo
-            register_file[LO] = register_file[rs];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: mtlo %d(%d)\n", rs, register_file[rs]);
-            break;
-        }
+UOP_HANDLER(mflo) {
+    uint32_t rd = uop->rd;
+    cpu->regs[rd] = cpu->regs[LO];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: mflo %d\n", rd);
+}
 
-        case 24: {
-            // mult
-            int64_t result = (int32_t) register_file[rs] * (int32_t) register_file[rt];
-            register_file[HI] = result >> 32;
-            register_file[LO] = result & 0xFFFFFFFF;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: mult %d(%d), %d(%d)\n",
-                                 rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(mtlo) {
+    uint32_t rs = uop->rs;
+    cpu->regs[LO] = cpu->regs[rs];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: mtlo %d(%d)\n", rs, cpu->regs[rs]);
+}
 
-        case 25: {
-            // multu
-            int64_t result = (uint32_t) register_file[rs] * (uint32_t) register_file[rt];
-            register_file[HI] = result >> 32;
-            register_file[LO] = result & 0xFFFFFFFF;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: multu %d(%d), %d(%d)\n",
-                                 rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(mult) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int64_t result = (int32_t) cpu->regs[rs] * (int32_t) cpu->regs[rt];
+    cpu->regs[HI] = result >> 32;
+    cpu->regs[LO] = result & 0xFFFFFFFF;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: mult %d(%d), %d(%d)\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 26: {
-            // div
-            if (register_file[rt] == 0) {
-                EXIT_WITH_MSG("OVERFLOW: division result overflow!\n");
-            }
+UOP_HANDLER(multu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int64_t result = (uint32_t) cpu->regs[rs] * (uint32_t) cpu->regs[rt];
+    cpu->regs[HI] = result >> 32;
+    cpu->regs[LO] = result & 0xFFFFFFFF;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: multu %d(%d), %d(%d)\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-            int32_t c = (int32_t) register_file[rs] / (int32_t) register_file[rt];
-            int32_t d = (int32_t) register_file[rs] % (int32_t) register_file[rt];
-            register_file[HI] = c;
-            register_file[LO] = d;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: div %d(%d), %d(%d)\n",
-                                 rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(div) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rt] == 0) {
+        RAISE_WITH_MSG(SIM_TRAP_DIVIDE, "OVERFLOW: division result overflow!\n");
+    }
 
-        case 27: {
-            // divu
-            if (register_file[rt] == 0) {
-                EXIT_WITH_MSG("OVERFLOW: division result overflow!\n");
-            }
+    int32_t c = (int32_t) cpu->regs[rs] / (int32_t) cpu->regs[rt];
+    int32_t d = (int32_t) cpu->regs[rs] % (int32_t) cpu->regs[rt];
+    cpu->regs[HI] = c;
+    cpu->regs[LO] = d;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: div %d(%d), %d(%d)\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-            uint32_t c = (uint32_t) register_file[rs] / (uint32_t) register_file[rt];
-            uint32_t d = (uint32_t) register_file[rs] % (uint32_t) register_file[rt];
-            register_file[HI] = c;
-            register_file[LO] = d;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: divu %d(%d), %d(%d)\n",
-                                 rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(divu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rt] == 0) {
+        RAISE_WITH_MSG(SIM_TRAP_DIVIDE, "OVERFLOW: division result overflow!\n");
+    }
 
-        case 32: {
-            // add
-            int64_t result = register_file[rs] + register_file[rt];
-            if ((result & ~(0xFFFFFFFF)) != 0) {
-                EXIT_WITH_MSG("OVERFLOW: addition result overflow!\n");
-            }
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: add %d(%d), %d(%d), %d(%d)\n",
-                                 rd, result, rs, register_file[rs], rt, register_file[rt]);
-            register_file[rd] = (int32_t) result;
-            break;
-        }
+    uint32_t c = (uint32_t) cpu->regs[rs] / (uint32_t) cpu->regs[rt];
+    uint32_t d = (uint32_t) cpu->regs[rs] % (uint32_t) cpu->regs[rt];
+    cpu->regs[HI] = c;
+    cpu->regs[LO] = d;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: divu %d(%d), %d(%d)\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 33: {
-            // addu
-            register_file[rd] = register_file[rs] + register_file[rt];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: addu %d, %d(%d), %d(%d)\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(add) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    int64_t result = cpu->regs[rs] + cpu->regs[rt];
+    if ((result & ~(0xFFFFFFFF)) != 0) {
+        RAISE_WITH_MSG(SIM_TRAP_OVERFLOW, "OVERFLOW: addition result overflow!\n");
+    }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: add %d(%d), %d(%d), %d(%d)\n",
+                         rd, (int32_t) result, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+    cpu->regs[rd] = (int32_t) result;
+}
 
-        case 34: {
-            // sub
-            int64_t result = register_file[rs] - register_file[rt];
-            if ((result & ~(0xFFFFFFFF)) != 0) {
-                EXIT_WITH_MSG("OVERFLOW: subtraction result overflow!\n");
-            }
+UOP_HANDLER(addu) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = cpu->regs[rs] + cpu->regs[rt];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: addu %d, %d(%d), %d(%d)\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-            register_file[rd] = (int32_t) result;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: sub %d, %d(%d), %d(%d)\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(sub) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    int64_t result = cpu->regs[rs] - cpu->regs[rt];
+    if ((result & ~(0xFFFFFFFF)) != 0) {
+        RAISE_WITH_MSG(SIM_TRAP_OVERFLOW, "OVERFLOW: subtraction result overflow!\n");
+    }
 
-        case 35: {
-            // subu
-            register_file[rd] = register_file[rs] - register_file[rt];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: subu %d, %d(%d), %d(%d)\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+    cpu->regs[rd] = (int32_t) result;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: sub %d, %d(%d), %d(%d)\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 36: {
-            // and
-            register_file[rd] = register_file[rs] & register_file[rt];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: and %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(subu) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = cpu->regs[rs] - cpu->regs[rt];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: subu %d, %d(%d), %d(%d)\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 37: {
-            // or
-            register_file[rd] = register_file[rs] | register_file[rt];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: or %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(and) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = cpu->regs[rs] & cpu->regs[rt];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: and %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 38: {
-            // xor
-            register_file[rd] = register_file[rs] ^ register_file[rt];
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: xor %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(or) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = cpu->regs[rs] | cpu->regs[rt];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: or %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 39: {
-            // nor
-            register_file[rd] = ~(register_file[rs] | register_file[rt]);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: nor %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(xor) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = cpu->regs[rs] ^ cpu->regs[rt];
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: xor %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 42: {
-            // slt
-            if (register_file[rs] < register_file[rt])
-                register_file[rd] = 1;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: slt %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(nor) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    cpu->regs[rd] = ~(cpu->regs[rs] | cpu->regs[rt]);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: nor %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 43: {
-            // sltu
-            if ((uint32_t) register_file[rs] < (uint32_t) register_file[rt])
-                register_file[rd] = 1;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[R]\tExecution: sltu %d, %d(%d), %d(%d)\\n\",\n",
-                                 rd, rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(slt) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rs] < cpu->regs[rt])
+        cpu->regs[rd] = 1;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: slt %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 48: {
-            // tge
-            if (register_file[rs] >= register_file[rt])
-                EXIT_WITH_MSG("TRAP: tge %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(sltu) {
+    uint32_t rd = uop->rd, rs = uop->rs, rt = uop->rt;
+    if ((uint32_t) cpu->regs[rs] < (uint32_t) cpu->regs[rt])
+        cpu->regs[rd] = 1;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[R]\tExecution: sltu %d, %d(%d), %d(%d)\\n\",\n",
+                         rd, rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 49: {
-            // tltu
-            if ((uint32_t) register_file[rs] >= (uint32_t) register_file[rt])
-                EXIT_WITH_MSG("TRAP: tgeu %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(tge) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rs] >= cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tge %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 50: {
-            // tlt
-            if (register_file[rs] < register_file[rt])
-                EXIT_WITH_MSG("TRAP: tlt %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(tgeu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if ((uint32_t) cpu->regs[rs] >= (uint32_t) cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tgeu %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 51: {
-            // tltu
-            if ((uint32_t) register_file[rs] < (uint32_t) register_file[rt])
-                EXIT_WITH_MSG("TRAP: tltu %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(tlt) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rs] < cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tlt %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 52: {
-            // teq
-            if (register_file[rs] == register_file[rt])
-                EXIT_WITH_MSG("TRAP: teq %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(tltu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if ((uint32_t) cpu->regs[rs] < (uint32_t) cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tltu %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        case 54: {
-            // tne
-            if (register_file[rs] != register_file[rt])
-                EXIT_WITH_MSG("TRAP: tne %d(%d) %d(%d)\n",
-                              rs, register_file[rs], rt, register_file[rt]);
-            break;
-        }
+UOP_HANDLER(teq) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rs] == cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: teq %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-        default: {
-            PRINTF_ERR_STAMP("[SIM]\t[R]\tUnrecognized funct domain: %d\n", funct);
-            return 0;
-        }
+UOP_HANDLER(tne) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    if (cpu->regs[rs] != cpu->regs[rt])
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tne %d(%d) %d(%d)\n",
+                                           rs, cpu->regs[rs], rt, cpu->regs[rt]);
+}
 
-    }
+UOP_HANDLER(bltz) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if (cpu->regs[rs] < 0)
+        cpu->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[RBT]\tExecution: bltz %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
 
-#undef get_funct
-#undef get_rs
-#undef get_rt
-#undef get_rd
-#undef get_shamt
+UOP_HANDLER(bgez) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if (cpu->regs[rs] >= 0)
+        cpu->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[RBT]\tExecution: bgez %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
 
-    return 1;
+UOP_HANDLER(tgei) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if (cpu->regs[rs] >= imm)
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tgei %d(%d), %d\n",
+                                           rs, cpu->regs[rs], imm);
 }
 
-void debug_dump_registers() {
-    std::map<std::string, uint32_t> rgm = create_regparse_map();
-    PRINTF_DEBUG_VERBOSE(verbose, "\t\tREG(");
-    uint32_t i = 0;
-    for (std::map<std::string, uint32_t>::reverse_iterator it = rgm.rbegin(); it != rgm.rend(); it++) {
-        i++;
-        printf("%s(%d) = %d, ", it->first.c_str(), it->second, register_file[it->second]);
-        if (i % 8 == 0) {
-            printf("\n");
-            PRINTF_DEBUG_VERBOSE(verbose, "\t\t\t");
-        }
-    }
-    printf(")\n");
-    PRINTF_DEBUG_VERBOSE(verbose, "\n");
+UOP_HANDLER(tgeiu) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if ((uint32_t) cpu->regs[rs] >= (uint16_t) imm)
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tgeiu %d(%d), %d\n",
+                                           rs, cpu->regs[rs], imm);
 }
 
-bool __decode_branch_trap(Simulator *simulator, uint32_t bin) {
-#define get_rs(bin) ((bin >> 21) & 0x1F)
-#define get_rt(bin) ((bin >> 16) & 0x1F)
-#define get_imm(bin) ((int16_t)(bin & 0xFFFF))
+UOP_HANDLER(tlti) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if (cpu->regs[rs] < imm)
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tlti %d(%d), %d\n",
+                                           rs, cpu->regs[rs], imm);
+}
 
-    int16_t imm = get_imm(bin);
-    uint32_t rs = get_rs(bin);
-    uint32_t rt = get_rt(bin);
+UOP_HANDLER(tltiu) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if ((uint32_t) cpu->regs[rs] < (uint16_t) imm)
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tltiu %d(%d), %d\n",
+                                           rs, cpu->regs[rs], imm);
+}
 
-    switch (rt) {
+UOP_HANDLER(tnei) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    if (cpu->regs[rs] != imm)
+        RAISE_WITH_MSG(SIM_TRAP_CONDITION, "TRAP: tnei %d(%d), %d\n",
+                                           rs, cpu->regs[rs], imm);
+}
 
-        case 0: {
-            // bltz
-            if (register_file[rs] < 0)
-                simulator->pc += 4 * imm;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[RBT]\tExecution: bltz %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(bltzal) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    cpu->regs[ra] = (cpu->pc + 4) >> 2;
+    if (cpu->regs[rs] < 0)
+        cpu->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[RBT]\tExecution: bltzal %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
 
-        case 1: {
-            // bgez
-            if (register_file[rs] >= 0)
-                simulator->pc += 4 * imm;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[RBT]\tExecution: bgez %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(bgezal) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+    cpu->regs[ra] = (cpu->pc + 4) >> 2;
+    if (cpu->regs[rs] >= 0)
+        cpu->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[RBT]\tExecution: bgezal %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
 
-        case 8: {
-            // tgei
-            if (register_file[rs] >= imm)
-                EXIT_WITH_MSG("TRAP: tgei %d(%d), %d\n",
-                              rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(j) {
+    uint32_t offset = uop->imm;
+    cpu->pc = (offset << 2) - 4;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: j %d\n", offset << 2);
+}
 
-        case 9: {
-            // tgeiu
-            if ((uint32_t) register_file[rs] >= (uint16_t) imm)
-                EXIT_WITH_MSG("TRAP: tgeiu %d(%d), %d\n",
-                              rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(jal) {
+    cpu->regs[ra] = (cpu->pc >> 2) + 1;
+    uint32_t offset = uop->imm;
+    cpu->pc = (offset << 2) - 4;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: jal %d\n", offset << 2);
+}
 
-        case 10: {
-            // tlti
-            if (register_file[rs] < imm)
-                EXIT_WITH_MSG("TRAP: tlti %d(%d), %d\n",
-                              rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(beq) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 11: {
-            // tltiu
-            if ((uint32_t) register_file[rs] < (uint16_t) imm)
-                EXIT_WITH_MSG("TRAP: tltiu %d(%d), %d\n",
-                              rs, register_file[rs], imm);
-            break;
-        }
+    if (cpu->regs[rs] == cpu->regs[rt])
+        cpu->pc += 4 * imm;
 
-        case 14: {
-            // tnei
-            if (register_file[rs] != imm)
-                EXIT_WITH_MSG("TRAP: tnei %d(%d), %d\n",
-                              rs, register_file[rs], imm);
-            break;
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: beq %d(%d), %d(%d), %d\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt], imm);
+}
 
-        case 16: {
-            // bltzal
-            register_file[ra] = (simulator->pc + 4) >> 2;
-            if (register_file[rs] < 0)
-                simulator->pc += 4 * imm;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[RBT]\tExecution: bltzal %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(bne) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 17: {
-            // bgezal
-            register_file[ra] = (simulator->pc + 4) >> 2;
-            if (register_file[rs] >= 0)
-                simulator->pc += 4 * imm;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[RBT]\tExecution: bgezal %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+    if (cpu->regs[rs] != cpu->regs[rt])
+        cpu->pc += 4 * imm;
 
-        default: {
-            PRINTF_ERR_STAMP("[SIM]\t[RBT]\tUnrecognized imm domain: %d\n", imm);
-            break;
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: bne %d(%d), %d(%d), %d\n",
+                         rs, cpu->regs[rs], rt, cpu->regs[rt], imm);
+}
+
+UOP_HANDLER(blez) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+
+    if (cpu->regs[rs] <= 0)
+        cpu->pc += 4 * imm;
+
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: blez %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
+
+UOP_HANDLER(bgtz) {
+    uint32_t rs = uop->rs;
+    int16_t imm = uop->imm;
+
+    if (cpu->regs[rs] > 0)
+        cpu->pc += 4 * imm;
+
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: bgtz %d(%d), %d\n",
+                         rs, cpu->regs[rs], imm);
+}
+
+UOP_HANDLER(addi) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+
+    int64_t result = cpu->regs[rs] + imm;
+    if ((result & ~(0xFFFFFFFF)) != 0) {
+        RAISE_WITH_MSG(SIM_TRAP_OVERFLOW, "OVERFLOW: addition result overflow!\n");
     }
+    cpu->regs[rt] = (int32_t) result;
+
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: addi %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
+}
+
+UOP_HANDLER(addiu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-#undef get_rs
-#undef get_rt
-#undef get_imm
+    cpu->regs[rt] = cpu->regs[rs] + imm;
 
-    return 1;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: addiu %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
 }
 
-bool decode(Simulator *simulator, uint32_t b) {
-    switch (get_opcode(b)) {
+UOP_HANDLER(slti) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 0x0: {
-            return __decode_rcluster(simulator, b);
-        }
+    if (cpu->regs[rs] < imm)
+        cpu->regs[rt] = 1;
+    else
+        cpu->regs[rt] = 0;
 
-        case 0x1: {
-            return __decode_branch_trap(simulator, b);
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: slti %d(%d), %d(%d), %d\n",
+                         rt, cpu->regs[rt], rs, cpu->regs[rs], imm);
+}
 
-        case 0x2: {
-            // j target
-            uint32_t offset = b & 0x3FFFFFF;
-            simulator->pc = (offset << 2) - 4;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: j %d\n", offset << 2);
-            break;
-        }
+UOP_HANDLER(sltiu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    uint16_t imm = uop->imm;
 
-        case 0x3: {
-            // jal target
-            register_file[ra] = (simulator->pc >> 2) + 1;
-            uint32_t offset = b & 0x3FFFFFF;
-            simulator->pc = (offset << 2) - 4;
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: jal %d\n", offset << 2);
-            break;
-        }
+    if ((uint32_t) cpu->regs[rs] < imm)
+        cpu->regs[rt] = 1;
+    else
+        cpu->regs[rt] = 0;
 
-#define get_rs(bin) ((bin >> 21) & 0x1F)
-#define get_rt(bin) ((bin >> 16) & 0x1F)
-#define get_imm(bin) ((int16_t)(bin & 0xFFFF))
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: sltiu %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
+}
 
-        case 0x4: {
-            // beq rs, rt, offset
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+UOP_HANDLER(andi) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    uint16_t imm = uop->imm;
 
-            if (register_file[rs] == register_file[rt])
-                simulator->pc += 4 * imm;
+    cpu->regs[rt] = cpu->regs[rs] & imm;
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: beq %d(%d), %d(%d), %d\n",
-                                 rs, register_file[rs], rt, register_file[rt], imm);
-            break;
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: andi %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
+}
 
-        case 0x5: {
-            // bne, rs, rt, offset
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+UOP_HANDLER(ori) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    uint16_t imm = uop->imm;
 
-            if (register_file[rs] != register_file[rt])
-                simulator->pc += 4 * imm;
+    cpu->regs[rt] = cpu->regs[rs] | imm;
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: bne %d(%d), %d(%d), %d\n",
-                                 rs, register_file[rs], rt, register_file[rt], imm);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: ori %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
+}
 
-            break;
-        }
+UOP_HANDLER(xori) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    uint16_t imm = uop->imm;
 
-        case 0x6: {
-            // blez, rs, 0x0, offset
-            uint32_t rs = get_rs(b);
-            int16_t imm = get_imm(b);
+    cpu->regs[rt] = cpu->regs[rs] ^ imm;
 
-            if (register_file[rs] <= 0)
-                simulator->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: xori %d, %d(%d), %d\n",
+                         rt, rs, cpu->regs[rs], imm);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: blez %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lui) {
+    uint32_t rt = uop->rt;
 
-        case 0x7: {
-            // bgtz, rs, 0x0, offset
-            uint32_t rs = get_rs(b);
-            int16_t imm = get_imm(b);
+    cpu->regs[rt] = uop->imm;
 
-            if (register_file[rs] > 0)
-                simulator->pc += 4 * imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lui %d, %d\n",
+                         rt, (uint32_t) uop->imm >> 16);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: bgtz %d(%d), %d\n",
-                                 rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lb) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 0x8: {
-            // addi, rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+    cpu->regs[rt] = (int8_t) __guest_read<F>(cpu, uop, imm + cpu->regs[rs]);
 
-            int64_t result = register_file[rs] + imm;
-            if ((result & ~(0xFFFFFFFF)) != 0) {
-                EXIT_WITH_MSG("OVERFLOW: addition result overflow!\n");
-            }
-            register_file[rt] = (int32_t) result;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lb %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: addi %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lh) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 0x9: {
-            // addiu rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+    cpu->regs[rt] = (int16_t) __guest_readu16<F>(cpu, uop, imm + cpu->regs[rs]);
 
-            register_file[rt] = register_file[rs] + imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lh %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: addiu %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lwl) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    uint16_t addr = imm + cpu->regs[rs];
+
+    uint32_t mmc = 4 - addr % 4;
+    uint32_t result = 0x0;
+    uint32_t mask = 0x0;
+    for (uint32_t i = 0; i < mmc; i++) {
+        result |= (mmbar_read(&cpu->simulator->mmBar, addr + i) << (i * 8));
+        mask |= 0xFF << (i * 8);
+    }
+    cpu->regs[rt] = (result) & (~mask & cpu->regs[rt]);
 
-        case 0xa: {
-            // slti rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lwl %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            if (register_file[rs] < imm)
-                register_file[rt] = 1;
-            else
-                register_file[rt] = 0;
+UOP_HANDLER(lw) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: slti %d(%d), %d(%d), %d\n",
-                                 rt, register_file[rt], rs, register_file[rs], imm);
-            break;
-        }
+    cpu->regs[rt] = (int32_t) __guest_readu32<F>(cpu, uop, imm + cpu->regs[rs]);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lw %d, %d[%d(%d)], (%d)\n",
+                         rt, imm, rs, cpu->regs[rs], cpu->regs[rt]);
+}
 
-        case 0xb: {
-            // sltiu rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            uint16_t imm = (uint16_t) get_imm(b);
+UOP_HANDLER(lbu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-            if ((uint32_t) register_file[rs] < (uint16_t) imm)
-                register_file[rt] = 1;
-            else
-                register_file[rt] = 0;
+    cpu->regs[rt] = (unsigned) __guest_readu16<F>(cpu, uop, imm + cpu->regs[rs]);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lbu %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: sltiu %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lhu) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
 
-        case 0xc: {
-            // andi rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            uint16_t imm = (uint16_t) get_imm(b);
+    cpu->regs[rt] = (uint16_t) __guest_readu16<F>(cpu, uop, imm + cpu->regs[rs]);
 
-            register_file[rt] = register_file[rs] & imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lhu %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: andi %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(lwr) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    uint16_t addr = imm + cpu->regs[rs];
+
+    uint32_t mmc = addr % 4;
+    uint32_t result = 0x0;
+    uint32_t mask = 0x0;
+    for (uint32_t i = 0; i < mmc + 1; i++) {
+        result |= (mmbar_read(&cpu->simulator->mmBar, addr - i) << ((mmc - i) * 8));
+        mask |= 0xFF << ((mmc - i) * 8);
+    }
+    cpu->regs[rt] = (result) & (~mask & cpu->regs[rt]);
 
-        case 0xd: {
-            // ori rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            uint16_t imm = (uint16_t) get_imm(b);
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: lwr %d, %d[%d(%d)]\n",
+                         rt, imm, rs, cpu->regs[rs]);
+}
 
-            register_file[rt] = register_file[rs] | imm;
+UOP_HANDLER(sb) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    __guest_write<F>(cpu, uop, imm + cpu->regs[rs], 0xFF & cpu->regs[rt]);
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: ori %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: sb %d(%d), %d[%d(%d)]\n",
+                         rt, cpu->regs[rt], imm, rs, cpu->regs[rs]);
+}
 
-        case 0xe: {
-            // xori rs, rt, imm
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            uint16_t imm = (uint16_t) get_imm(b);
+UOP_HANDLER(sh) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    __guest_writeu16<F>(cpu, uop, imm + cpu->regs[rs], 0xFFFF & cpu->regs[rt]);
 
-            register_file[rt] = register_file[rs] ^ imm;
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: sh %d(%d), %d[%d(%d)]\n",
+                         rt, cpu->regs[rt], imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: xori %d, %d(%d), %d\n",
-                                 rt, rs, register_file[rs], imm);
-            break;
-        }
+UOP_HANDLER(swl) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    uint16_t addr = imm + cpu->regs[rs];
 
-        case 0xf: {
-            // lui 0x0, rt, imm
-            uint32_t rt = get_rt(b);
-            uint16_t imm = (uint16_t) get_imm(b);
+    uint32_t mmc = 4 - addr % 4;
+    for (uint32_t i = 0; i < mmc; i++) {
+        mmbar_write(&cpu->simulator->mmBar,
+                    addr + i,
+                    0xFF & (cpu->regs[rt] >> (((addr + i) % 4) * 8)));
+    }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: swl %d(%d), %d[%d(%d)]\n",
+                         rt, cpu->regs[rt], imm, rs, cpu->regs[rs]);
+}
 
-            register_file[rt] = (imm << 16);
+UOP_HANDLER(sw) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    __guest_writeu32<F>(cpu, uop, imm + cpu->regs[rs], (uint32_t) cpu->regs[rt]);
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lui %d, %d\n",
-                                 rt, imm);
-            break;
-        }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: sw %d(%d), %d[%d(%d)]\n",
+                         rt, cpu->regs[rt], imm, rs, cpu->regs[rs]);
+}
 
-        case 0x20: {
-            // lb
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+UOP_HANDLER(swr) {
+    uint32_t rs = uop->rs, rt = uop->rt;
+    int16_t imm = uop->imm;
+    uint16_t addr = imm + cpu->regs[rs];
 
-            register_file[rt] = (int8_t) mmbar_read(&simulator->mmBar, imm + register_file[rs]);
+    uint32_t mmc = addr % 4;
+    for (uint32_t i = 0; i < mmc + 1; i++) {
+        mmbar_write(&cpu->simulator->mmBar,
+                    addr - i,
+                    0xFF & (cpu->regs[rt] >> (((addr - i) % 4) * 8)));
+    }
+    PRINTF_DEBUG_VERBOSE(F & SIM_FEAT_VERBOSE,
+                         "[SIM]\t[D]\tExecution: swr %d(%d), %d[%d(%d)]\n",
+                         rt, cpu->regs[rt], imm, rs, cpu->regs[rs]);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lb %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
-        }
+UOP_HANDLER(bad_rbt) {
+    (void) cpu;
+    PRINTF_ERR_STAMP("[SIM]\t[RBT]\tUnrecognized imm domain: %d\n", (int16_t) uop->imm);
+}
 
-        case 0x21: {
-            // lh
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+UOP_HANDLER(bad_funct) {
+    uint32_t b = uop->imm;
+    PRINTF_ERR_STAMP("[SIM]\t[R]\tUnrecognized funct domain: %d\n", b & 0x3F);
+    RAISE_WITH_MSG(SIM_TRAP_DECODE, "[SIM]\tfailed to decode instruction: %s\n\t\texit...\n",
+                                    std::bitset<32>(b).to_string().c_str());
+}
 
-            register_file[rt] = (int16_t) mmbar_readu16(&simulator->mmBar, imm + register_file[rs]);
+UOP_HANDLER(bad_opcode) {
+    uint32_t b = uop->imm;
+    PRINTF_ERR_STAMP("[SIM]\tUnrecognized opcode: %d\n", get_opcode(b));
+    RAISE_WITH_MSG(SIM_TRAP_DECODE, "[SIM]\tfailed to decode instruction: %s\n\t\texit...\n",
+                                    std::bitset<32>(b).to_string().c_str());
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lh %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
-        }
+static void __predecode(Simulator *simulator, uint32_t b, MicroOp *uop);
+static void __icache_runs(Simulator *simulator, uint32_t idx);
 
-        case 0x22: {
-            // lwl
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            uint16_t addr = imm + register_file[rs];
-
-            uint32_t mmc = 4 - addr % 4;
-            uint32_t result = 0x0;
-            uint32_t mask = 0x0;
-            for (uint32_t i = 0; i < mmc; i++) {
-                result |= (mmbar_read(&simulator->mmBar, addr + i) << (i * 8));
-                mask |= 0xFF << (i * 8);
-            }
-            register_file[rt] = (result) & (~mask & register_file[rt]);
+UOP_HANDLER(stale) {
+    // the word was overwritten since it was predecoded, decode it again
+    MicroOp *entry = const_cast<MicroOp *>(uop);
+    __predecode(cpu->simulator, mmbar_readu32(&cpu->simulator->mmBar, cpu->pc), entry);
+    __icache_runs(cpu->simulator, (uint32_t) (entry - cpu->simulator->icache.data()));
+    entry->handler(cpu, entry);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lwl %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
-        }
+#undef UOP_HANDLER
+#undef RAISE_WITH_MSG
+
+#define UOP_HANDLER_ENTRY(KIND, name) __exec_##name<F>,
+
+template<uint32_t F>
+struct UopHandlers {
+    static const uop_handler_t table[UOP_NUM];
+};
+
+template<uint32_t F>
+const uop_handler_t UopHandlers<F>::table[UOP_NUM] = {
+        UOP_LIST(UOP_HANDLER_ENTRY)
+};
+
+#undef UOP_HANDLER_ENTRY
+
+// the simulator running on this thread, batch jobs fault on their own thread
+static thread_local Simulator *__guard_simulator = NULL;
+
+// the handler is process wide: installed by the first thread with a guarded
+// run, the handlers it replaced restored once the last one released its run
+static std::mutex __guard_lock;
+static uint32_t __guard_threads = 0;
+static struct sigaction __guard_saved_segv;
+static struct sigaction __guard_saved_bus;
+
+/* hand a fault that is not the guest's to the handler the guard replaced */
+static void __guard_chain(int sig, siginfo_t *info, void *context) {
+    const struct sigaction *saved = sig == SIGBUS ? &__guard_saved_bus : &__guard_saved_segv;
+    if (saved->sa_flags & SA_SIGINFO) {
+        saved->sa_sigaction(sig, info, context);
+    } else if (saved->sa_handler != SIG_DFL && saved->sa_handler != SIG_IGN) {
+        saved->sa_handler(sig);
+    } else {
+        // returning runs the faulting access again, which now ends the process
+        signal(sig, SIG_DFL);
+    }
+}
 
-        case 0x23: {
-            // lw
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+/* SIGSEGV/SIGBUS handler of the guard mode: a fault inside the guest
+ * reservation is a guest access out of range, report it against the
+ * instruction that made it; anything else is a host crash. Under
+ * simulator_try_run the ExitTrap is thrown from here, which unwinds through
+ * the frame of the faulting access: the handlers and the mmbar accessors are
+ * built with asynchronous unwind tables and keep no objects to destroy */
+static void __guard_fault_handler(int sig, siginfo_t *info, void *context) {
+    Simulator *simulator = __guard_simulator;
+    uint64_t addr;
+    if (!simulator || !mmbar_fault_addr(&simulator->mmBar, info->si_addr, &addr)) {
+        __guard_chain(sig, info, context);
+        return;
+    }
 
-            register_file[rt] = (int32_t) mmbar_readu32(&simulator->mmBar, imm + register_file[rs]);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lw %d, %d[%d(%d)], (%d)\n",
-                                 rt, imm, rs, register_file[rs], register_file[rt]);
-            break;
-        }
+    // the recorded micro-op tells which instruction faulted
+    uint32_t pc = __uop_pc(simulator, simulator->fault_uop);
+    simulator->trap = SIM_TRAP_FAULT;
+    simulator->trap_pc = pc;
+
+    uint32_t b = mmbar_readu32(&simulator->mmBar, pc);
+    char text[64];
+    isa_disassemble(b, pc, text, sizeof(text));
+
+    const char *region = (addr >= mmbar_stack_guard_start(&simulator->mmBar) &&
+                          addr < simulator->mmBar.layout.stack_start)
+                         ? "stack overflow" : "address out of range";
+    PRINTF_ERR_STAMP("[SIM]\t[FAULT]\t%s at 0x%lX\n", region, (unsigned long) addr);
+    EXIT_WITH_MSG("[SIM]\t[FAULT]\tpc: 0x%X, instruction: 0x%08X (%s)\n\t\texit...\n",
+                  pc, b, text);
+}
 
-        case 0x24: {
-            // lbu
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+static void __guard_install(Simulator *simulator) {
+    simulator->fault_uop = NULL;
+    std::lock_guard<std::mutex> guard(__guard_lock);
+    bool counted = __guard_simulator != NULL;
+    __guard_simulator = simulator;
+    if (counted || __guard_threads++)
+        return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = __guard_fault_handler;
+    // the handler leaves by throwing the ExitTrap, not by returning, so the
+    // signal must not stay blocked after it
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGSEGV, &sa, &__guard_saved_segv);
+    sigaction(SIGBUS, &sa, &__guard_saved_bus);
+}
 
-            register_file[rt] = (unsigned) mmbar_readu16(&simulator->mmBar, imm + register_file[rs]);
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lbu %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
-        }
+/* forget the run of this thread, and give the signals back to the handlers
+ * the guard replaced once no thread has a guarded run */
+static void __guard_release(Simulator *simulator) {
+    std::lock_guard<std::mutex> guard(__guard_lock);
+    if (__guard_simulator != simulator)
+        return;
+    __guard_simulator = NULL;
+    if (--__guard_threads)
+        return;
+
+    sigaction(SIGSEGV, &__guard_saved_segv, NULL);
+    sigaction(SIGBUS, &__guard_saved_bus, NULL);
+}
 
-        case 0x25: {
-            // lhu
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
+static void __predecode(Simulator *simulator, uint32_t b, MicroOp *uop) {
+    decoder_predecode(b, uop);
+    uop->handler = simulator->handlers[uop->kind];
+}
 
-            register_file[rt] = (uint16_t) mmbar_readu16(&simulator->mmBar, imm + register_file[rs]);
+bool decode(Simulator *simulator, uint32_t b) {
+    MicroOp uop;
+    __predecode(simulator, b, &uop);
+    uop.handler(&simulator->cpu, &uop);
+    return uop.kind != UOP_BAD_FUNCT && uop.kind != UOP_BAD_OPCODE;
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lhu %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
-        }
+static inline bool __is_block_terminator(uint32_t kind) {
+    switch (kind) {
+        case UOP_JR:
+        case UOP_JALR:
+        case UOP_SYSCALL:
+        case UOP_BLTZ:
+        case UOP_BGEZ:
+        case UOP_BLTZAL:
+        case UOP_BGEZAL:
+        case UOP_J:
+        case UOP_JAL:
+        case UOP_BEQ:
+        case UOP_BNE:
+        case UOP_BLEZ:
+        case UOP_BGTZ:
+        case UOP_STALE:
+            return true;
+        default:
+            return false;
+    }
+}
 
-        case 0x26: {
-            // lwr
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            uint16_t addr = imm + register_file[rs];
-
-            uint32_t mmc = addr % 4;
-            uint32_t result = 0x0;
-            uint32_t mask = 0x0;
-            for (uint32_t i = 0; i < mmc + 1; i++) {
-                result |= (mmbar_read(&simulator->mmBar, addr - i) << ((mmc - i) * 8));
-                mask |= 0xFF << ((mmc - i) * 8);
-            }
-            register_file[rt] = (result) & (~mask & register_file[rt]);
+/* Count again the runs that end at or pass through entry idx, whose kind
+ * changed: an entry holds the number of instructions from it up to and
+ * including the next block terminator or the end of the text */
+static void __icache_runs(Simulator *simulator, uint32_t idx) {
+    const MicroOp *icache = simulator->icache.data();
+    uint32_t *runs = simulator->icache_runs.data();
+    uint32_t n = 1;
+    if (!__is_block_terminator(icache[idx].kind) && idx + 1 < simulator->icache_runs.size())
+        n = runs[idx + 1] + 1;
+    runs[idx] = n;
+    while (idx > 0 && !__is_block_terminator(icache[idx - 1].kind))
+        runs[--idx] = ++n;
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: lwr %d, %d[%d(%d)]\n",
-                                 rt, imm, rs, register_file[rs]);
-            break;
+static void __icache_invalidate(void *ctx, uint32_t addr) {
+    Simulator *simulator = (Simulator *) ctx;
+    uint32_t idx = (addr - simulator->mmBar.layout.text_start) >> 2;
+    MicroOp *entry = &simulator->icache[idx];
+    entry->kind = UOP_STALE;
+    entry->handler = simulator->handlers[UOP_STALE];
+    __icache_runs(simulator, idx);
+
+    // translated blocks may now have the wrong boundaries: end the running
+    // block right after the store and drop the cache before the next one
+    simulator->block_end = simulator->icache.data();
+    simulator->block_flush = true;
+}
+
+void __simulator_icache_build(Simulator *simulator) {
+    uint32_t text_start = simulator->mmBar.layout.text_start;
+    uint32_t n_words = (simulator->mmBar.text_end_addr - text_start) >> 2;
+    simulator->icache.resize(n_words);
+    for (uint32_t i = 0; i < n_words; i++) {
+        __predecode(simulator, mmbar_readu32(&simulator->mmBar, text_start + (i << 2)),
+                    &simulator->icache[i]);
+    }
+    simulator->icache_runs.resize(n_words);
+    for (uint32_t i = n_words; i > 0; i--) {
+        bool last = __is_block_terminator(simulator->icache[i - 1].kind) || i == n_words;
+        simulator->icache_runs[i - 1] = last ? 1 : simulator->icache_runs[i] + 1;
+    }
+    mmbar_set_text_hook(&simulator->mmBar, __icache_invalidate, simulator);
+    PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\tPredecoded %d instructions\n", n_words);
+
+    simulator->blocks.clear();
+    simulator->blocks.reserve(n_words);
+    simulator->block_map.assign(n_words, NULL);
+    simulator->block_end = NULL;
+    simulator->block_flush = false;
+    memset(&simulator->block_stats, 0, sizeof(BlockStats));
+
+    memset(&simulator->jit, 0, sizeof(Jit));
+    if (simulator->user_options.engine == ENGINE_JIT) {
+        if (verbose) {
+            // translated code does not log, keep the per-instruction trace
+            PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[JIT]\tVerbose run, hot blocks stay interpreted\n");
+        } else {
+            jit_init(&simulator->jit, simulator->user_options.jit_threshold,
+                     simulator->user_options.jit_cache_kb);
         }
+    }
+}
 
-        case 0x28: {
-            // sb
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            mmbar_write(&simulator->mmBar, imm + register_file[rs], 0xFF & register_file[rt]);
+void __simulator_exec_init(Simulator *simulator) {
+    cpu_reset(&simulator->cpu, simulator, simulator->mmBar.layout.text_start,
+              simulator->mmBar.layout.stack_top);
+    console_open(&simulator->console,
+                 simulator->user_options.require_output_stdout ? simulator->user_options.output_stdout : NULL,
+                 simulator->output, !verbose);
+    mmbar_load_text(&simulator->mmBar, *simulator->bin);
+    __simulator_icache_build(simulator);
+    if (simulator->mmBar.guarded)
+        __guard_install(simulator);
+
+    simulator->retired = 0;
+    simulator->run_pc = simulator->cpu.pc;
+    simulator->stop = SIM_STOP_NONE;
+    simulator->clock_check = simulator->deadline > 0 ? SIM_CLOCK_INTERVAL : SIM_NO_BUDGET;
+    simulator->limit_check = std::min(simulator->budget, simulator->clock_check);
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: sb %d(%d), %d[%d(%d)]\n",
-                                 rt, register_file[rt], imm, rs, register_file[rs]);
-            break;
-        }
+/* Budget and deadline of SIM_FEAT_LIMIT runs. The engines ask before retiring
+ * n instructions; the fast path compares against the nearer of the budget and
+ * the next clock reading, so the clock is read once per SIM_CLOCK_INTERVAL */
+static bool __limit_slow(Simulator *simulator, uint32_t n) {
+    if (simulator->retired + n > simulator->clock_check) {
+        if (get_timestamp() >= simulator->deadline) {
+            simulator->stop = SIM_STOP_TIMEOUT;
+            return true;
+        }
+        simulator->clock_check = simulator->retired + SIM_CLOCK_INTERVAL;
+        simulator->limit_check = std::min(simulator->budget, simulator->clock_check);
+    }
+    if (simulator->retired + n > simulator->budget) {
+        simulator->stop = SIM_STOP_BUDGET;
+        return true;
+    }
+    return false;
+}
 
-        case 0x29: {
-            // sh
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            mmbar_writeu16(&simulator->mmBar, imm + register_file[rs], 0xFFFF & register_file[rt]);
+/* The run loops keep the count and the limit it is compared with in locals,
+ * so the check stays in registers across the handler calls. They check once
+ * per run of sequential instructions, up to the next block terminator, and
+ * store simulator->retired only at the start of a run, along with run_pc,
+ * which gives the count of a run that leaves through a trap, and on return */
+#define LIMIT_LOCALS() \
+    uint64_t retired = simulator->retired; \
+    uint64_t limit_check = simulator->limit_check
+
+static inline bool __limit_reached(Simulator *simulator, uint64_t retired, uint64_t *limit_check, uint32_t n) {
+    if (__builtin_expect(retired + n <= *limit_check, 1))
+        return false;
+    simulator->retired = retired;
+    if (__limit_slow(simulator, n))
+        return true;
+    *limit_check = simulator->limit_check;
+    return false;
+}
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: sh %d(%d), %d[%d(%d)]\n",
-                                 rt, register_file[rt], imm, rs, register_file[rs]);
-            break;
+/* the run of n instructions from pc retires, known to be within the limit */
+#define LIMIT_COUNT(pc, n) \
+    do { \
+        if (F & SIM_FEAT_LIMIT) { \
+            simulator->retired = retired; \
+            simulator->run_pc = (pc); \
+            retired += n; \
+        } \
+    } while (0)
+
+/* the run of n instructions from pc is about to retire: stop the engine if it
+ * is over the limit, otherwise count it */
+#define LIMIT_RUN(pc, n) \
+    do { \
+        if ((F & SIM_FEAT_LIMIT) && __limit_reached(simulator, retired, &limit_check, n)) \
+            return; \
+        LIMIT_COUNT(pc, n); \
+    } while (0)
+
+/* the run reached the end of the text */
+#define LIMIT_END() \
+    do { \
+        if (F & SIM_FEAT_LIMIT) \
+            simulator->retired = retired; \
+    } while (0)
+
+template<uint32_t F>
+void __simulator_exec_run(Simulator *simulator) {
+    CPUContext *cpu = &simulator->cpu;
+    const MicroOp *icache = simulator->icache.data();
+    const uint32_t text_start = simulator->mmBar.layout.text_start;
+    const uint32_t text_size = simulator->mmBar.text_end_addr - text_start;
+    const uint32_t *runs = simulator->icache_runs.data();
+    LIMIT_LOCALS();
+
+    while (cpu->pc != simulator->mmBar.text_end_addr) {
+        uint32_t offset = cpu->pc - text_start;
+        if (offset >= text_size) {
+            LIMIT_RUN(cpu->pc, 1);
+            // pc left the loaded text, fall back to fetch and decode
+            decode(simulator, mmbar_readu32(&simulator->mmBar, cpu->pc));
+            cpu->pc += 4;
+            continue;
+        }
+
+        const MicroOp *uop = &icache[offset >> 2];
+        if (!(F & SIM_FEAT_LIMIT)) {
+            uop->handler(cpu, uop);
+            cpu->pc += 4;
+            continue;
+        }
+
+        // a limited run retires up to the next block terminator at once, as
+        // __simulator_exec_run_block does, or one instruction when that could
+        // cross the limit; a store into the text ends it through block_end
+        uint32_t n = runs[offset >> 2];
+        if (retired + n > limit_check) {
+            n = 1;
+            LIMIT_RUN(cpu->pc, 1);
+        } else {
+            LIMIT_COUNT(cpu->pc, n);
+        }
+        const MicroOp *first = uop;
+        const MicroOp *last = uop + n - 1;
+        simulator->block_end = last;
+        while (uop < simulator->block_end) {
+            uop->handler(cpu, uop);
+            uop++;
+        }
+        cpu->pc += (uint32_t) (uop - first) << 2;
+        if (simulator->block_end == last) {
+            last->handler(cpu, last);
+            cpu->pc += 4;
+        } else {
+            retired -= n - (uop - first);
         }
+    }
+    LIMIT_END();
+}
 
-        case 0x2a: {
-            // swl
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            uint16_t addr = imm + register_file[rs];
-
-            uint32_t mmc = 4 - addr % 4;
-            for (uint32_t i = 0; i < mmc; i++) {
-                mmbar_write(&simulator->mmBar,
-                            addr + i,
-                            0xFF & (register_file[rt] >> (((addr + i) % 4) * 8)));
-            }
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: swl %d(%d), %d[%d(%d)]\n",
-                                 rt, register_file[rt], imm, rs, register_file[rs]);
+#if defined(__GNUC__)
+
+/* Direct-threaded variant of __simulator_exec_run: every handler body ends
+ * with its own copy of the dispatch, so control jumps from one handler
+ * straight to the next through a computed goto (labels-as-values). A limited
+ * run checks the limit only in the dispatch of the block terminators, for the
+ * run that follows, and counts a run by its pc once it reaches its end */
+template<uint32_t F>
+void __simulator_exec_run_threaded(Simulator *simulator) {
+#define UOP_LABEL_ENTRY(KIND, name) &&do_##name,
+    static const void *dispatch[UOP_NUM] = {
+            UOP_LIST(UOP_LABEL_ENTRY)
+    };
+#undef UOP_LABEL_ENTRY
+
+    CPUContext *cpu = &simulator->cpu;
+    const MicroOp *icache = simulator->icache.data();
+    const uint32_t text_start = simulator->mmBar.layout.text_start;
+    const uint32_t text_size = simulator->mmBar.text_end_addr - text_start;
+    const uint32_t *runs = simulator->icache_runs.data();
+    const MicroOp *uop;
+    uint32_t offset;
+    uint32_t run_pc = cpu->pc;
+    LIMIT_LOCALS();
+
+#define DISPATCH() \
+    do { \
+        offset = cpu->pc - text_start; \
+        if (offset >= text_size) \
+            goto run_out_of_text; \
+        uop = &icache[offset >> 2]; \
+        goto *dispatch[uop->kind]; \
+    } while (0)
+
+#define DISPATCH_RUN() \
+    do { \
+        offset = cpu->pc - text_start; \
+        if (offset >= text_size) \
+            goto out_of_text; \
+        if (F & SIM_FEAT_LIMIT) { \
+            if (retired + runs[offset >> 2] > limit_check) \
+                goto limit_step; \
+            run_pc = cpu->pc; \
+            simulator->retired = retired; \
+            simulator->run_pc = run_pc; \
+        } \
+        uop = &icache[offset >> 2]; \
+        goto *dispatch[uop->kind]; \
+    } while (0)
+
+#define UOP_LABEL_BODY(KIND, name) \
+    do_##name: \
+        if ((F & SIM_FEAT_LIMIT) && __is_block_terminator(UOP_##KIND)) \
+            retired += ((cpu->pc - run_pc) >> 2) + 1; \
+        __exec_##name<F>(cpu, uop); \
+        cpu->pc += 4; \
+        if (__is_block_terminator(UOP_##KIND)) \
+            DISPATCH_RUN(); \
+        DISPATCH();
+
+    DISPATCH_RUN();
+
+    UOP_LIST(UOP_LABEL_BODY)
+
+    limit_step:
+    // the run could cross the limit, retire it one instruction at a time
+    for (;;) {
+        LIMIT_RUN(cpu->pc, 1);
+        uop = &icache[offset >> 2];
+        bool last = __is_block_terminator(uop->kind);
+        uop->handler(cpu, uop);
+        cpu->pc += 4;
+        offset = cpu->pc - text_start;
+        if (last || offset >= text_size)
             break;
-        }
+    }
+    DISPATCH_RUN();
 
-        case 0x2b: {
-            // sw
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            mmbar_writeu32(&simulator->mmBar, imm + register_file[rs], (uint32_t) register_file[rt]);
+    run_out_of_text:
+    // the run went on past the end of the text
+    if (F & SIM_FEAT_LIMIT)
+        retired += (cpu->pc - run_pc) >> 2;
 
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: sw %d(%d), %d[%d(%d)]\n",
-                                 rt, register_file[rt], imm, rs, register_file[rs]);
+    out_of_text:
+    if (cpu->pc == simulator->mmBar.text_end_addr) {
+        LIMIT_END();
+        return;
+    }
+    LIMIT_RUN(cpu->pc, 1);
+    // pc left the loaded text, fall back to fetch and decode
+    decode(simulator, mmbar_readu32(&simulator->mmBar, cpu->pc));
+    cpu->pc += 4;
+    DISPATCH_RUN();
+
+#undef UOP_LABEL_BODY
+#undef DISPATCH_RUN
+#undef DISPATCH
+}
+
+#else
+
+template<uint32_t F>
+void __simulator_exec_run_threaded(Simulator *simulator) {
+    PRINTF_ERR_STAMP("[SIM]\tComputed goto is not supported by this compiler, "
+                     "falling back to the predecode engine\n");
+    __simulator_exec_run<F>(simulator);
+}
+
+#endif
+
+static void __block_flush(Simulator *simulator) {
+    if (simulator->jit.enabled)
+        jit_flush(&simulator->jit, simulator);
+    simulator->blocks.clear();
+    std::fill(simulator->block_map.begin(), simulator->block_map.end(), (TranslatedBlock *) NULL);
+    simulator->block_flush = false;
+    simulator->block_stats.flushes++;
+    PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[BLOCK]\tText written, block cache flushed\n");
+}
+
+/* translate the block starting at word index idx of the text segment */
+static TranslatedBlock *__block_translate(Simulator *simulator, uint32_t idx) {
+    uint32_t n_words = simulator->icache.size();
+    uint32_t end = idx;
+    for (;;) {
+        MicroOp *uop = &simulator->icache[end];
+        if (uop->kind == UOP_STALE) {
+            __predecode(simulator, mmbar_readu32(&simulator->mmBar,
+                                                 simulator->mmBar.layout.text_start + (end << 2)), uop);
+            __icache_runs(simulator, end);
+        }
+        end++;
+        if (__is_block_terminator(uop->kind) || end == n_words)
             break;
+    }
+
+    simulator->blocks.push_back(TranslatedBlock());
+    TranslatedBlock *block = &simulator->blocks.back();
+    block->start = simulator->mmBar.layout.text_start + (idx << 2);
+    block->length = end - idx;
+    block->uops = &simulator->icache[idx];
+    block->succ[0] = block->succ[1] = NULL;
+    block->succ_pc[0] = block->succ_pc[1] = 0;
+    block->hotness = 0;
+    block->native = NULL;
+    block->native_length = 0;
+    simulator->block_map[idx] = block;
+
+    PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\t[BLOCK]\tTranslated block 0x%X (%d instructions)\n",
+                         block->start, block->length);
+    return block;
+}
+
+static TranslatedBlock *__block_lookup(Simulator *simulator, uint32_t pc) {
+    uint32_t idx = (pc - simulator->mmBar.layout.text_start) >> 2;
+    TranslatedBlock *block = simulator->block_map[idx];
+    if (block) {
+        simulator->block_stats.lookup_hits++;
+        return block;
+    }
+    simulator->block_stats.misses++;
+    return __block_translate(simulator, idx);
+}
+
+static inline void __block_link(Simulator *simulator, TranslatedBlock *from, TranslatedBlock *to) {
+    // keep the most recent successor in the second slot, so that a block
+    // with a stable fall-through and a varying target keeps both chained
+    uint32_t slot = from->succ[0] ? 1 : 0;
+    from->succ[slot] = to;
+    from->succ_pc[slot] = to->start;
+    simulator->block_stats.links++;
+}
+
+/* Block variant of __simulator_exec_run: executes whole translated blocks and
+ * follows successor links, so only the instruction ending a block needs pc.
+ * The jit engine is this loop with native code attached to hot blocks */
+template<uint32_t F>
+void __simulator_exec_run_block(Simulator *simulator) {
+    CPUContext *cpu = &simulator->cpu;
+    const uint32_t text_start = simulator->mmBar.layout.text_start;
+    const uint32_t text_size = simulator->mmBar.text_end_addr - text_start;
+    TranslatedBlock *block = NULL;
+    LIMIT_LOCALS();
+
+    while (cpu->pc != simulator->mmBar.text_end_addr) {
+        if (simulator->block_flush) {
+            __block_flush(simulator);
+            block = NULL;
+        }
+
+        if (cpu->pc - text_start >= text_size) {
+            LIMIT_RUN(cpu->pc, 1);
+            // pc left the loaded text, fall back to fetch and decode
+            decode(simulator, mmbar_readu32(&simulator->mmBar, cpu->pc));
+            cpu->pc += 4;
+            block = NULL;
+            continue;
+        }
+
+        TranslatedBlock *next;
+        if (block && block->succ[0] && block->succ_pc[0] == cpu->pc) {
+            next = block->succ[0];
+            if (F & SIM_FEAT_STATS)
+                simulator->block_stats.chain_hits++;
+        } else if (block && block->succ[1] && block->succ_pc[1] == cpu->pc) {
+            next = block->succ[1];
+            if (F & SIM_FEAT_STATS)
+                simulator->block_stats.chain_hits++;
+        } else {
+            next = __block_lookup(simulator, cpu->pc);
+            if (block)
+                __block_link(simulator, block, next);
+        }
+        block = next;
+
+        if ((F & SIM_FEAT_LIMIT) && retired + block->length > limit_check) {
+            // the block could cross the limit: retire one instruction at a
+            // time, as __simulator_exec_run does, so the stop is exact
+            LIMIT_RUN(cpu->pc, 1);
+            block->uops->handler(cpu, block->uops);
+            cpu->pc += 4;
+            block = NULL;
+            continue;
+        }
+        if (F & SIM_FEAT_STATS)
+            simulator->block_stats.executed++;
+
+        if (simulator->jit.enabled && !block->native && block->hotness < simulator->jit.threshold
+            && ++block->hotness == simulator->jit.threshold) {
+            block->native = jit_translate(&simulator->jit, simulator, block);
+        }
+
+        if (block->native) {
+            LIMIT_COUNT(block->start, block->native_length);
+            if (F & SIM_FEAT_STATS)
+                simulator->jit.stats.native_runs++;
+            cpu->pc = block->native(cpu);
+            // native code leaves right after a store into the text
+            if ((F & SIM_FEAT_LIMIT) && simulator->block_flush)
+                retired -= block->native_length - ((cpu->pc - block->start) >> 2);
+            continue;
+        }
+
+        LIMIT_COUNT(block->start, block->length);
+
+        // the body never reads pc, so it is only materialized for the last
+        // instruction; a store into the text cuts the block short through
+        // block_end, in which case pc resumes right after the store
+        const MicroOp *uop = block->uops;
+        const MicroOp *last = uop + block->length - 1;
+        simulator->block_end = last;
+        while (uop < simulator->block_end) {
+            uop->handler(cpu, uop);
+            uop++;
+        }
+        cpu->pc = block->start + ((uint32_t) (uop - block->uops) << 2);
+        if (simulator->block_end == last) {
+            last->handler(cpu, last);
+            cpu->pc += 4;
+        } else if (F & SIM_FEAT_LIMIT) {
+            retired -= block->length - (uop - block->uops);
         }
+    }
+    LIMIT_END();
+}
 
-        case 0x2e: {
-            // swr
-            uint32_t rs = get_rs(b);
-            uint32_t rt = get_rt(b);
-            int16_t imm = get_imm(b);
-            uint16_t addr = imm + register_file[rs];
-
-            uint32_t mmc = addr % 4;
-            for (uint32_t i = 0; i < mmc + 1; i++) {
-                mmbar_write(&simulator->mmBar,
-                            addr - i,
-                            0xFF & (register_file[rt] >> (((addr - i) % 4) * 8)));
-            }
-            PRINTF_DEBUG_VERBOSE(verbose,
-                                 "[SIM]\t[D]\tExecution: swr %d(%d), %d[%d(%d)]\n",
-                                 rt, register_file[rt], imm, rs, register_file[rs]);
+#undef LIMIT_END
+#undef LIMIT_RUN
+#undef LIMIT_COUNT
+
+void simulator_release(Simulator *simulator) {
+    __guard_release(simulator);
+    console_close(&simulator->console);
+    vfs_reset(&simulator->vfs);
+    jit_free(&simulator->jit);
+    mmbar_free(&simulator->mmBar);
+}
+
+void __simulator_exec_finalize(Simulator *simulator) {
+    __simulator_report(simulator);
+    simulator_release(simulator);
+}
+
+template<uint32_t F>
+static void __simulator_exec_engine(Simulator *simulator) {
+    switch (simulator->user_options.engine) {
+        case ENGINE_THREADED:
+            __simulator_exec_run_threaded<F>(simulator);
             break;
-        }
+        case ENGINE_BLOCK:
+        case ENGINE_JIT:
+            __simulator_exec_run_block<F>(simulator);
+            break;
+        default:
+            __simulator_exec_run<F>(simulator);
+            break;
+    }
+}
 
-#undef get_rs
-#undef get_rt
-#undef get_imm
+static uint32_t __simulator_features(Simulator *simulator) {
+    uint32_t features = 0;
+    if (verbose)
+        features |= SIM_FEAT_VERBOSE;
+    if (simulator->user_options.report_stats)
+        features |= SIM_FEAT_STATS;
+    if (simulator->mmBar.guarded)
+        features |= SIM_FEAT_GUARD;
+    if (simulator->limited)
+        features |= SIM_FEAT_LIMIT;
+    return features;
+}
 
-        default: {
-            PRINTF_ERR_STAMP("[SIM]\tUnrecognized opcode: %d\n", get_opcode(b));
-            return 0;
-        }
+/* every combination of sim_features, handlers and engines exist for each */
+#define FEATURE_SETS(X) \
+    X(0x0) X(0x1) X(0x2) X(0x3) X(0x4) X(0x5) X(0x6) X(0x7) \
+    X(0x8) X(0x9) X(0xA) X(0xB) X(0xC) X(0xD) X(0xE) X(0xF)
 
+void simulator_load(Simulator *simulator) {
+#define HANDLERS_CASE(F) \
+    case F: \
+        simulator->handlers = UopHandlers<F>::table; \
+        break;
+
+    switch (__simulator_features(simulator)) {
+        FEATURE_SETS(HANDLERS_CASE)
     }
-    return 1;
+
+#undef HANDLERS_CASE
+    __simulator_exec_init(simulator);
 }
 
-void __simulator_exec_init(Simulator *simulator) {
-    simulator->pc = MEM_TEXT_START;
-    mmbar_load_text(&simulator->mmBar, simulator->bin);
-    memset(register_file, 0, sizeof(uint32_t) * REG_NUM);
-    register_file[sp] = 0x1000000;
+void simulator_resume(Simulator *simulator) {
+#define ENGINE_CASE(F) \
+    case F: \
+        __simulator_exec_engine<F>(simulator); \
+        break;
+
+    switch (__simulator_features(simulator)) {
+        FEATURE_SETS(ENGINE_CASE)
+    }
+
+#undef ENGINE_CASE
 }
 
-void __simulator_exec_run(Simulator *simulator) {
-    while (simulator->pc != simulator->mmBar.text_end_addr) {
-        uint32_t b = mmbar_readu32(&simulator->mmBar, simulator->pc);
+#undef FEATURE_SETS
 
-//        PRINTF_DEBUG_VERBOSE(verbose, "[SIM]\tInstruction fetch: %d\n", simulator->pc);
+void simulator_run(Simulator *simulator) {
+    simulator_load(simulator);
+    simulator_resume(simulator);
+}
 
-        if (!decode(simulator, b)) {
-            EXIT_WITH_MSG("[SIM]\tfailed to decode instruction: %s\n\t\texit...\n",
-                          std::bitset<32>(b).to_string().c_str());
+static void __try_run_result(Simulator *simulator, const ExitTrap *trap, bool trapped, RunResult *result) {
+    result->exit_code = 0;
+    result->trap = SIM_TRAP_NONE;
+    result->pc = simulator->cpu.pc;
+    result->retired = simulator->retired;
+    result->message.clear();
+
+    if (!trapped) {
+        result->status = simulator->stop == SIM_STOP_BUDGET ? RUN_BUDGET
+                       : simulator->stop == SIM_STOP_TIMEOUT ? RUN_TIMEOUT : RUN_EXITED;
+    } else if (!trap->error) {
+        result->status = RUN_EXITED;
+        result->exit_code = trap->status;
+        result->pc = __uop_pc(simulator, simulator->fault_uop);
+    } else {
+        result->status = RUN_TRAPPED;
+        result->message = trap->message;
+        if (simulator->trap != SIM_TRAP_NONE) {
+            result->trap = simulator->trap;
+            result->pc = simulator->trap_pc;
+        } else {
+            // e.g. a syscall ran out of input
+            result->trap = SIM_TRAP_ERROR;
+            if (simulator->fault_uop)
+                result->pc = __uop_pc(simulator, simulator->fault_uop);
         }
+    }
 
-        if (verbose) {
-//            debug_dump_registers();
-        }
+    // the engine left inside a run, which retired up to the instruction of the trap
+    if (trapped && simulator->limited && result->pc >= simulator->run_pc)
+        result->retired = simulator->retired + ((result->pc - simulator->run_pc) >> 2) + 1;
+}
 
-        simulator->pc += 4;
-    }
+void simulator_limit(Simulator *simulator, uint64_t budget, uint32_t timeout_ms) {
+    simulator->limited = budget || timeout_ms;
+    simulator->budget = budget ? budget : SIM_NO_BUDGET;
+    simulator->deadline = timeout_ms ? get_timestamp() + timeout_ms / 1000.0 : 0;
+    simulator->clock_check = simulator->deadline > 0 ? simulator->retired + SIM_CLOCK_INTERVAL : SIM_NO_BUDGET;
+    simulator->limit_check = std::min(simulator->budget, simulator->clock_check);
 }
 
-void __simulator_exec_finalize(Simulator *simulator) {
-    mmbar_free(&simulator->mmBar);
+void simulator_try_run(Simulator *simulator, RunResult *result) {
+    ExitTrap trap;
+    ExitTrap *outer = exit_trap;
+    trap.message[0] = '\0';
+
+    exit_trap = &trap;
+    try {
+        simulator_run(simulator);
+        __try_run_result(simulator, &trap, false, result);
+    } catch (const ExitTrap &) {
+        __try_run_result(simulator, &trap, true, result);
+    }
+    exit_trap = outer;
+    console_flush(&simulator->console);
 }
 
 void simulator_exec(Simulator *simulator) {
-    if (!simulator->user_options.from_asm) {
+    if (simulator->user_options.batch) {
+        if (!batch_exec(&simulator->user_options))
+            exit(1);
+        return;
+    }
+
+    if (!simulator->user_options.from_asm)
         assembler_exec(&simulator->assembler);
-        simulator->bin = simulator->assembler.bin;
+
+    if (simulator->user_options.fork_server) {
+        if (!fork_server_exec(simulator))
+            exit(1);
+        return;
     }
 
     if (simulator->user_options.full_flow) {
-        __simulator_exec_init(simulator);
-        __simulator_exec_run(simulator);
+        if (simulator->user_options.max_instructions || simulator->user_options.timeout_ms)
+            simulator_limit(simulator, simulator->user_options.max_instructions,
+                            simulator->user_options.timeout_ms);
+        simulator_run(simulator);
         __simulator_exec_finalize(simulator);
+
+        int status = __simulator_report_stop(simulator);
+        if (status)
+            exit(status);
     }
 }
 
@@ -8,5 +8,9 @@
 
 #include "register.hh"
 
-int32_t register_file[REG_NUM] = {0};
-double f_register_file[2] = {0};
\ No newline at end of file
+void cpu_reset(CPUContext *cpu, Simulator *simulator, uint32_t pc, uint32_t stack_top) {
+    memset(cpu, 0, sizeof(CPUContext));
+    cpu->simulator = simulator;
+    cpu->pc = pc;
+    cpu->regs[sp] = stack_top;
+}
@@ -15,7 +15,7 @@
 /* get timestamp to the precision of miliseconds since the program starts */
 double get_timestamp() {
     static double __init_stamp = -1;
-    static struct timeval __cur_time;
+    struct timeval __cur_time;
 
     if (-1 == __init_stamp) {
         gettimeofday(&__cur_time, NULL);
@@ -28,6 +28,19 @@ double get_timestamp() {
 
 #undef TIMEVAL2F
 
+thread_local ExitTrap *exit_trap = NULL;
+
+void exit_or_trap(int status, bool error) {
+    ExitTrap *trap = exit_trap;
+    if (!trap)
+        exit(status);
+    // disarm first, an error while the caller recovers must not loop back
+    exit_trap = NULL;
+    trap->status = status;
+    trap->error = error;
+    throw *trap;
+}
+
 /* function: safe_malloc
  * usage: abort if malloc failed
  * arguments: size, number of bytes to allocate
@@ -0,0 +1,275 @@
+/**
+ * @filename: vfs.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: in-memory file system behind the file syscalls
+ * @date: 3/31/2021
+ */
+
+#include "vfs.hh"
+
+#include <sstream>
+#include <algorithm>
+#include <fcntl.h>
+#include <dirent.h>
+
+static bool __read_file(const std::string &path, std::string *content) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open())
+        return false;
+    std::ostringstream os;
+    os << file.rdbuf();
+    *content = os.str();
+    return true;
+}
+
+/* guest paths are looked up as given, apart from a leading "./" */
+static std::string __guest_path(const std::string &path) {
+    size_t start = 0;
+    while (path.compare(start, 2, "./") == 0)
+        start += 2;
+    return path.substr(start);
+}
+
+/* the regular files under dir, by their path relative to it; false and the
+ * directory in failed if one cannot be read */
+static bool __list_dir(const std::string &dir, const std::string &prefix, std::vector<std::string> *paths,
+                       std::string *failed) {
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        *failed = dir;
+        return false;
+    }
+
+    bool ok = true;
+    struct dirent *entry;
+    while (ok && (entry = readdir(d))) {
+        std::string name(entry->d_name);
+        if (name == "." || name == "..")
+            continue;
+
+        std::string host = dir + "/" + name;
+        struct stat st;
+        if (stat(host.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            ok = __list_dir(host, prefix + name + "/", paths, failed);
+        else if (S_ISREG(st.st_mode))
+            paths->push_back(prefix + name);
+    }
+    closedir(d);
+    return ok;
+}
+
+static void __load_dir(VfsImage *image, const std::string &dir) {
+    std::vector<std::string> paths;
+    std::string failed;
+    if (!__list_dir(dir, std::string(), &paths, &failed))
+        EXIT_WITH_MSG("[VFS]\tFailed to read directory: %s\n", failed.c_str());
+
+    for (const std::string &path: paths) {
+        if (!__read_file(dir + "/" + path, &image->files[path]))
+            EXIT_WITH_MSG("[VFS]\tFailed to read file: %s/%s\n", dir.c_str(), path.c_str());
+    }
+}
+
+static void __load_manifest(VfsImage *image, const char *path) {
+    std::string dir(path);
+    size_t slash = dir.rfind('/');
+    dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+
+    std::ifstream manifest(path);
+    std::string line;
+    uint32_t n_line = 0;
+    while (std::getline(manifest, line)) {
+        n_line++;
+        std::istringstream fields(line.substr(0, line.find('#')));
+        std::string guest, host;
+        if (!(fields >> guest))
+            continue;
+        if (!(fields >> host))
+            EXIT_WITH_MSG("[VFS]\tManifest line %u: expected GUEST_PATH HOST_PATH\n", n_line);
+
+        if (host[0] != '/')
+            host = dir + host;
+        if (!__read_file(host, &image->files[__guest_path(guest)]))
+            EXIT_WITH_MSG("[VFS]\tFailed to read file: %s\n", host.c_str());
+    }
+}
+
+void vfs_image_load(VfsImage *image, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0)
+        EXIT_WITH_MSG("[VFS]\tFailed to read %s\n", path);
+
+    if (S_ISDIR(st.st_mode))
+        __load_dir(image, path);
+    else
+        __load_manifest(image, path);
+    PRINTF_DEBUG_VERBOSE(verbose, "[VFS]\tPreloaded %lu files from %s\n",
+                         (unsigned long) image->files.size(), path);
+}
+
+void vfs_reset(Vfs *vfs) {
+    vfs->files.clear();
+    vfs->handles.clear();
+}
+
+void vfs_init(Vfs *vfs, const VfsImage *image) {
+    vfs_reset(vfs);
+    vfs->image = image;
+}
+
+static VfsHandle *__handle(Vfs *vfs, int32_t fd) {
+    if (fd < VFS_FD_BASE || (uint32_t) (fd - VFS_FD_BASE) >= vfs->handles.size())
+        return NULL;
+    VfsHandle *handle = &vfs->handles[fd - VFS_FD_BASE];
+    return handle->file ? handle : NULL;
+}
+
+static const std::string &__content(const VfsFile *file) {
+    return file->base ? *file->base : file->data;
+}
+
+int32_t vfs_open(Vfs *vfs, const char *path, int flags) {
+    std::string name = __guest_path(path);
+    if (name.empty())
+        return -1;
+
+    std::map<std::string, VfsFile>::iterator it = vfs->files.find(name);
+    if (it == vfs->files.end()) {
+        std::map<std::string, std::string>::const_iterator preloaded = vfs->image->files.find(name);
+        if (preloaded == vfs->image->files.end() && !(flags & O_CREAT)) {
+            PRINTF_DEBUG_VERBOSE(verbose, "[VFS]\tNo such file: %s\n", name.c_str());
+            return -1;
+        }
+
+        VfsFile file;
+        file.base = preloaded == vfs->image->files.end() ? NULL : &preloaded->second;
+        file.written = !file.base;
+        it = vfs->files.insert(std::make_pair(name, file)).first;
+    }
+
+    VfsFile *file = &it->second;
+    if ((flags & O_TRUNC) && (flags & O_ACCMODE) != O_RDONLY) {
+        file->base = NULL;
+        file->data.clear();
+        file->written = true;
+    }
+
+    // lowest free descriptor, as the host would
+    uint32_t i = 0;
+    while (i < vfs->handles.size() && vfs->handles[i].file)
+        i++;
+    if (i == vfs->handles.size())
+        vfs->handles.push_back(VfsHandle());
+    vfs->handles[i].file = file;
+    vfs->handles[i].pos = 0;
+    vfs->handles[i].flags = flags;
+    return VFS_FD_BASE + (int32_t) i;
+}
+
+int32_t vfs_read(Vfs *vfs, int32_t fd, void *dst, uint32_t n) {
+    VfsHandle *handle = __handle(vfs, fd);
+    if (!handle || (handle->flags & O_ACCMODE) == O_WRONLY)
+        return -1;
+
+    const std::string &content = __content(handle->file);
+    if (handle->pos >= content.size())
+        return 0;
+    if (n > content.size() - handle->pos)
+        n = (uint32_t) (content.size() - handle->pos);
+    memcpy(dst, content.data() + handle->pos, n);
+    handle->pos += n;
+    return (int32_t) n;
+}
+
+int32_t vfs_write(Vfs *vfs, int32_t fd, const void *src, uint32_t n) {
+    VfsHandle *handle = __handle(vfs, fd);
+    if (!handle || (handle->flags & O_ACCMODE) == O_RDONLY)
+        return -1;
+
+    VfsFile *file = handle->file;
+    if (file->base) {
+        file->data = *file->base;
+        file->base = NULL;
+    }
+    if (handle->flags & O_APPEND)
+        handle->pos = (uint32_t) file->data.size();
+    if (file->data.size() < (size_t) handle->pos + n)
+        file->data.resize((size_t) handle->pos + n);
+    memcpy(&file->data[handle->pos], src, n);
+    handle->pos += n;
+    file->written = true;
+    return (int32_t) n;
+}
+
+int32_t vfs_close(Vfs *vfs, int32_t fd) {
+    VfsHandle *handle = __handle(vfs, fd);
+    if (!handle)
+        return -1;
+    handle->file = NULL;
+    return 0;
+}
+
+static void __make_parents(const std::string &path) {
+    for (size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1))
+        mkdir(path.substr(0, slash).c_str(), 0755);
+}
+
+void vfs_dump(const Vfs *vfs, const char *dir) {
+    for (std::map<std::string, VfsFile>::const_iterator it = vfs->files.begin(); it != vfs->files.end(); ++it) {
+        if (!it->second.written)
+            continue;
+
+        std::string path = std::string(dir) + "/" + it->first;
+        __make_parents(path);
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        const std::string &content = __content(&it->second);
+        if (!file.is_open() || !file.write(content.data(), content.size()))
+            EXIT_WITH_MSG("[VFS]\tFailed to write file: %s\n", path.c_str());
+    }
+}
+
+/* what a guest path holds at the end of the run, NULL if there is no such file */
+static const std::string *__final_content(const Vfs *vfs, const std::string &path) {
+    std::map<std::string, VfsFile>::const_iterator it = vfs->files.find(path);
+    if (it != vfs->files.end())
+        return &__content(&it->second);
+
+    std::map<std::string, std::string>::const_iterator preloaded = vfs->image->files.find(path);
+    return preloaded == vfs->image->files.end() ? NULL : &preloaded->second;
+}
+
+bool vfs_compare(const Vfs *vfs, const char *dir, std::string *report) {
+    std::vector<std::string> paths;
+    std::string failed;
+    if (!__list_dir(dir, std::string(), &paths, &failed)) {
+        report->append(failed + ": cannot be read\n");
+        return false;
+    }
+    std::sort(paths.begin(), paths.end());
+
+    bool matched = true;
+    for (const std::string &path: paths) {
+        const std::string *content = __final_content(vfs, path);
+        std::string expected;
+        const char *status = NULL;
+        if (!content)
+            status = "missing";
+        else if (!__read_file(std::string(dir) + "/" + path, &expected) || expected != *content)
+            status = "differs";
+        if (status) {
+            matched = false;
+            report->append(path + ": " + status + "\n");
+        }
+    }
+
+    for (std::map<std::string, VfsFile>::const_iterator it = vfs->files.begin(); it != vfs->files.end(); ++it) {
+        if (it->second.written && !std::binary_search(paths.begin(), paths.end(), it->first)) {
+            matched = false;
+            report->append(it->first + ": not expected\n");
+        }
+    }
+    return matched;
+}
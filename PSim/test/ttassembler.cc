@@ -11,8 +11,10 @@
 #include <iostream>
 #include <vector>
 #include <bitset>
+#include <sstream>
 
 #include "assembler.hh"
+#include "lexer.hh"
 #include "utils.hh"
 
 struct testparam_t {
@@ -25,6 +27,10 @@ struct testparam_t {
     std::string tst_file;
 };
 
+void PrintTo(const testparam_t &param, std::ostream *os) {
+    *os << param.ELF_file;
+}
+
 class AssemblerTest : public ::testing::TestWithParam<testparam_t> {
 };
 
@@ -48,8 +54,18 @@ TEST_P(AssemblerTest, HandleTrueReturn) {
         }
     }
 
+    Options options;
+    options_init(&options);
+    options.full_flow = true;
+    MemLayout layout;
+    mmbar_layout_default(&layout);
+    MMBar mmBar;
+    mmbar_init(&mmBar, &layout);
+
     Assembler assembler;
     assembler_init(&assembler, param.ELF_file, true);
+    assembler.user_options = &options;
+    assembler.mmBar = &mmBar;
     assembler_exec(&assembler);
 
     ASSERT_EQ(tst_bin.size(), assembler.bin.size())
@@ -62,10 +78,11 @@ TEST_P(AssemblerTest, HandleTrueReturn) {
                             << "Line: " << i << "\n\t"
                             << "TST Bin: " << tst_bin[i] << "\n\t"
                             << "ASM Bin: " << std::bitset<32>(assembler.bin[i]) << "\n\t"
-                            << "ASM Text: " << assembler.text_section[i] << "\n\n";
+                            << "ASM Text: " << span_str(assembler.text[i].source) << "\n\n";
     }
 
     assembler_free(&assembler);
+    mmbar_free(&mmBar);
 }
 
 INSTANTIATE_TEST_SUITE_P (
@@ -83,11 +100,236 @@ INSTANTIATE_TEST_SUITE_P (
                 testparam_t("testfiles/ttassembler/9.in", "testfiles/ttassembler/9.out"),
                 testparam_t("testfiles/ttassembler/10.in", "testfiles/ttassembler/10.out"),
                 testparam_t("testfiles/ttassembler/11.in", "testfiles/ttassembler/11.out"),
-                testparam_t("testfiles/ttassembler/12.in", "testfiles/ttassembler/12.out")
+                testparam_t("testfiles/ttassembler/12.in", "testfiles/ttassembler/12.out"),
+                testparam_t("testfiles/ttassembler/13.in", "testfiles/ttassembler/13.out")
         )
 );
 
+/* assemble the program at path with a number of encoding workers; data, when
+ * given, is filled with the first words of the data segment, as many as it holds */
+static void __assemble(const std::string &path, uint32_t jobs, std::vector<uint32_t> *bin,
+                       std::vector<uint32_t> *data = NULL) {
+    Options options;
+    options_init(&options);
+    options.full_flow = true;
+    options.jobs = jobs;
+    MemLayout layout;
+    mmbar_layout_default(&layout);
+    MMBar mmBar;
+    mmbar_init(&mmBar, &layout);
+
+    Assembler assembler;
+    assembler_init(&assembler, path, true);
+    assembler.user_options = &options;
+    assembler.mmBar = &mmBar;
+    assembler_exec(&assembler);
+    *bin = assembler.bin;
+    for (uint32_t i = 0; data && i < data->size(); i++)
+        (*data)[i] = mmbar_readu32(&mmBar, layout.data_start + (i << 2));
+
+    assembler_free(&assembler);
+    mmbar_free(&mmBar);
+}
+
+static void __write_program(const std::string &path, const std::string &source) {
+    std::ofstream file(path);
+    file << source;
+}
+
+/* the encoding pass gives the same words for any number of workers, with
+ * branches and jumps reaching into the chunks of other workers */
+TEST(AssemblerJobsTest, SameBinary) {
+    const uint32_t blocks = 6000;
+    std::ostringstream source;
+    source << ".text\n";
+    for (uint32_t i = 0; i < blocks; i++) {
+        source << "L" << i << ":\n"
+               << "    addi $t0, $t0, " << (int32_t) (i % 200) - 100 << "\n"
+               << "    lw $t1, " << (i % 64) * 4 << "($sp)\n"
+               << "    add $t2, $t0, $t1\n"
+               << "    sll $t3, $t2, " << i % 32 << "\n"
+               << "    sw $t3, " << (i % 32) * 4 << "($gp)\n"
+               << "    beq $t0, $t1, L" << (i * 7 + 3) % blocks << "\n"
+               << "    jal L" << (blocks - 1 - i) << "\n";
+    }
+    std::string path = "testfiles/ttassembler/assembler-jobs.asm";
+    __write_program(path, source.str());
+
+    std::vector<uint32_t> reference;
+    __assemble(path, 1, &reference);
+    ASSERT_EQ(blocks * 7, reference.size());
+    for (uint32_t jobs : {2u, 4u, 16u}) {
+        std::vector<uint32_t> bin;
+        __assemble(path, jobs, &bin);
+        ASSERT_EQ(reference.size(), bin.size()) << jobs << " workers";
+        for (uint32_t i = 0; i < bin.size(); i++)
+            ASSERT_EQ(reference[i], bin[i]) << jobs << " workers, word " << i;
+    }
+}
+
+/* diagnostics of the encoding pass carry the prefix of the assembler */
+TEST(AssemblerJobsTest, DiagnosticPrefix) {
+    std::vector<uint32_t> bin;
+    __write_program("testfiles/ttassembler/undefined-label.asm", ".text\nmain:\n    j nowhere\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/undefined-label.asm", 2, &bin), ::testing::ExitedWithCode(255),
+                "\\[ASM\\]\tUndefined label: nowhere");
+    __write_program("testfiles/ttassembler/unknown-instruction.asm", ".text\nmain:\n    frobnicate $t0\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/unknown-instruction.asm", 2, &bin), ::testing::ExitedWithCode(255),
+                "\\[ASM\\]\tUnrecognized instruction: frobnicate");
+}
+
+/* errors found by the workers of different chunks are reported in source
+ * order, the first 32 of them, and the rest counted */
+TEST(AssemblerJobsTest, DiagnosticOrder) {
+    // 3 chunks of 16384 instructions: 2 errors in the first, 1 in the second
+    // and 40 in the last, which the other workers reach first
+    const uint32_t n = 3 * 16384;
+    std::ostringstream source;
+    source << ".text\nmain:\n";
+    uint32_t missing = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (i == 100 || i == 200 || i == 20000 || (i >= 40000 && i < 40040))
+            source << "    j missing_" << missing++ << "\n";
+        else
+            source << "    addi $t0, $t0, 1\n";
+    }
+    __write_program("testfiles/ttassembler/diagnostic-order.asm", source.str());
+
+    std::string expected;
+    for (uint32_t i = 0; i < 32; i++)
+        expected += "Undefined label: missing_" + std::to_string(i) + "\n.*";
+    expected += "11 more errors not shown";
+    std::vector<uint32_t> bin;
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/diagnostic-order.asm", 4, &bin), ::testing::ExitedWithCode(255),
+                expected);
+}
+
+/* registers by name or by number, HI and LO are none of the operands */
+TEST(AssemblerRegisterTest, Names) {
+    std::vector<uint32_t> by_name, by_number;
+    __write_program("testfiles/ttassembler/registers-by-name.asm", ".text\nadd $t0, $ra, $zero\n");
+    __assemble("testfiles/ttassembler/registers-by-name.asm", 1, &by_name);
+    __write_program("testfiles/ttassembler/registers-by-number.asm", ".text\nadd $8, $31, $0\n");
+    __assemble("testfiles/ttassembler/registers-by-number.asm", 1, &by_number);
+    EXPECT_EQ(by_name, by_number);
+
+    std::vector<uint32_t> bin;
+    __write_program("testfiles/ttassembler/registers-hi-lo.asm", ".text\nadd $t0, $HI, $LO\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/registers-hi-lo.asm", 1, &bin), ::testing::ExitedWithCode(255),
+                "Unknown register: \\$HI");
+    __write_program("testfiles/ttassembler/registers-32.asm", ".text\nadd $t0, $32, $t1\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/registers-32.asm", 1, &bin), ::testing::ExitedWithCode(255),
+                "Unknown register: \\$32");
+}
+
+static void __lex(const char *source, LexLine *line) {
+    ASSERT_TRUE(lex_line(source, source + strlen(source), line)) << source;
+}
+
+/* '#' starts a comment outside a string only, and neither it nor the '\r' of
+ * a CRLF line ends up in a token */
+TEST(LexerTest, Lines) {
+    LexLine line;
+    __lex("msg: .asciiz \"a # b\" # c", &line);
+    EXPECT_EQ("msg", span_str(line.label));
+    EXPECT_EQ(".asciiz \"a # b\"", span_str(line.body));
+    ASSERT_EQ(2u, line.n_tokens);
+    EXPECT_EQ((uint32_t) TOK_STRING, line.tokens[1].kind);
+    EXPECT_EQ("\"a # b\"", span_str(line.tokens[1].text));
+
+    for (const char *source : {".word 0x10 # sixteen", ".word 0x10#sixteen", ".word 0x10\r"}) {
+        __lex(source, &line);
+        ASSERT_EQ(2u, line.n_tokens) << source;
+        EXPECT_EQ((uint32_t) TOK_IMMEDIATE, line.tokens[1].kind) << source;
+        EXPECT_EQ(16, line.tokens[1].value) << source;
+    }
+
+    __lex("loop: add $t0, $t1, $t2\r", &line);
+    EXPECT_EQ("loop", span_str(line.label));
+    ASSERT_EQ(4u, line.n_tokens);
+    EXPECT_EQ("t2", span_str(line.tokens[3].reg));
+    __lex("main:\r", &line);
+    EXPECT_EQ("main", span_str(line.label));
+    EXPECT_EQ(0u, line.n_tokens);
+}
+
+/* decimal or 0x hexadecimal with an optional sign, anything from INT32_MIN
+ * to UINT32_MAX, the offset of an address included */
+TEST(LexerTest, Numbers) {
+    const struct {
+        const char *text;
+        int32_t value;
+    } valid[] = {
+            {"0", 0}, {"+7", 7}, {"-7", -7}, {"010", 10}, {"0x1F", 31}, {"0Xff", 255}, {"-0x1", -1},
+            {"2147483647", INT32_MAX}, {"-2147483648", INT32_MIN}, {"4294967295", -1},
+            {"0x80000000", INT32_MIN}, {"0xFFFFFFFF", -1},
+    };
+    for (auto number: valid) {
+        int32_t value = 0;
+        EXPECT_TRUE(lex_int(span_of(number.text, strlen(number.text)), &value)) << number.text;
+        EXPECT_EQ(number.value, value) << number.text;
+    }
+    for (const char *text : {"", "-", "+", "0x", "0xg", "0x1g", "12a", "1.5", "--1",
+                             "4294967296", "-2147483649", "0x100000000"}) {
+        int32_t value = 0;
+        EXPECT_FALSE(lex_int(span_of(text, strlen(text)), &value)) << text;
+    }
+
+    Token token;
+    lex_operand(span_of("0x10($sp)", 9), &token);
+    EXPECT_EQ((uint32_t) TOK_ADDRESS, token.kind);
+    EXPECT_EQ(16, token.value);
+    EXPECT_EQ("sp", span_str(token.reg));
+    lex_operand(span_of("-0x4($t0)", 9), &token);
+    EXPECT_EQ((uint32_t) TOK_ADDRESS, token.kind);
+    EXPECT_EQ(-4, token.value);
+    lex_operand(span_of("0x1g($t0)", 9), &token);
+    EXPECT_EQ((uint32_t) TOK_SYMBOL, token.kind);
+}
+
+/* the same program with CRLF line ends, comments after hexadecimal numbers and
+ * hexadecimal offsets assembles to the same words as without */
+TEST(LexerTest, Sources) {
+    const std::string source = ".data\n"
+                               "X: .word 0x10 # sixteen\n"
+                               "Y: .word -2147483648\n"
+                               "Z: .word 4294967295\n"
+                               ".text\n"
+                               "main:\n"
+                               "    lw $t0, 0x10($sp) # hexadecimal offset\n"
+                               "    addi $t1, $zero, 0x7FFF#no space\n";
+    std::string crlf;
+    for (char c : source)
+        crlf += c == '\n' ? std::string("\r\n") : std::string(1, c);
+
+    std::vector<uint32_t> bin, data(3), crlf_bin, crlf_data(3);
+    __write_program("testfiles/ttassembler/lexer-lf.asm", source);
+    __assemble("testfiles/ttassembler/lexer-lf.asm", 1, &bin, &data);
+    __write_program("testfiles/ttassembler/lexer-crlf.asm", crlf);
+    __assemble("testfiles/ttassembler/lexer-crlf.asm", 1, &crlf_bin, &crlf_data);
+
+    EXPECT_EQ(std::vector<uint32_t>({0x10, 0x80000000, 0xFFFFFFFF}), data);
+    EXPECT_EQ(std::vector<uint32_t>({0x8FA80010, 0x20097FFF}), bin);
+    EXPECT_EQ(data, crlf_data);
+    EXPECT_EQ(bin, crlf_bin);
+}
+
+/* a number that does not lex is an error, not 0 */
+TEST(LexerTest, InvalidNumbers) {
+    std::vector<uint32_t> bin;
+    __write_program("testfiles/ttassembler/lexer-invalid-word.asm", ".data\nX: .word 0x1g\n.text\nmain:\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/lexer-invalid-word.asm", 1, &bin),
+                ::testing::ExitedWithCode(255), "Invalid number: 0x1g");
+    __write_program("testfiles/ttassembler/lexer-invalid-immediate.asm", ".text\naddi $t0, $t0, 4294967296\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/lexer-invalid-immediate.asm", 1, &bin),
+                ::testing::ExitedWithCode(255), "Expected a immediate as operand 3");
+    __write_program("testfiles/ttassembler/lexer-invalid-offset.asm", ".text\nlw $t0, 0x1g($sp)\n");
+    EXPECT_EXIT(__assemble("testfiles/ttassembler/lexer-invalid-offset.asm", 1, &bin),
+                ::testing::ExitedWithCode(255), "0x1g\\(\\$sp\\)");
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
     return RUN_ALL_TESTS();
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+/**
+ * @filename: ttbatch.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: batch runner: manifest, report order, expected output and limits
+ * @date: 4/2/2021
+ */
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "batch.hh"
+
+#define FIXTURES "testfiles/ttsimulator/"
+
+static void __write_file(const std::string &path, const char *content) {
+    std::ofstream file(path);
+    file << content;
+}
+
+/* run the batch of manifest with its own options, the report goes to report */
+static bool __run_batch(const std::string &manifest, Options *options, std::string *report) {
+    options->batch = (char *) manifest.c_str();
+
+    testing::internal::CaptureStdout();
+    bool passed = batch_exec(options);
+    fflush(stdout);
+    *report = testing::internal::GetCapturedStdout();
+    return passed;
+}
+
+/* run the batch of manifest, the report goes to report */
+static bool __run_batch(const std::string &manifest, uint32_t jobs, std::string *report) {
+    Options options;
+    options_init(&options);
+    options.jobs = jobs;
+    return __run_batch(manifest, &options, report);
+}
+
+/* the report line of job n, empty if there is none */
+static std::string __job_line(const std::string &report, uint32_t n) {
+    std::string prefix = "[BATCH]\tjob " + std::to_string(n) + ": ";
+    std::istringstream lines(report);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, prefix.size(), prefix) == 0)
+            return line.substr(prefix.size());
+    }
+    return std::string();
+}
+
+static bool __contains(const std::string &s, const std::string &part) {
+    return s.find(part) != std::string::npos;
+}
+
+TEST(BatchTest, ExpectedOutput) {
+    __write_file(FIXTURES "wrong.out", "0\n");
+    __write_file(FIXTURES "batch-expected.txt",
+                 "# asm input expected, relative to the manifest\n"
+                 "\n"
+                 "a-plus-b.asm a-plus-b.in a-plus-b.out\n"
+                 "fib.asm fib.in fib.out   # fib(20)\n"
+                 "memcpy-hello-world.asm - memcpy-hello-world.out\n"
+                 "a-plus-b.asm a-plus-b.in wrong.out\n");
+
+    std::string report;
+    EXPECT_FALSE(__run_batch(FIXTURES "batch-expected.txt", 2, &report));
+
+    EXPECT_TRUE(__contains(__job_line(report, 1), "exited (0)")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 1), "PASS, " FIXTURES "a-plus-b.asm < " FIXTURES "a-plus-b.in"))
+                        << report;
+    EXPECT_TRUE(__contains(__job_line(report, 2), "PASS, " FIXTURES "fib.asm")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 3), "PASS, " FIXTURES "memcpy-hello-world.asm < -")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 4), "exited (0)")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 4), "FAIL")) << report;
+    EXPECT_TRUE(__job_line(report, 5).empty()) << report;
+    EXPECT_TRUE(__contains(report, "[BATCH]\t3 of 4 jobs passed, 3 programs")) << report;
+}
+
+/* the report is in manifest order however many workers ran the jobs */
+TEST(BatchTest, ManifestOrder) {
+    std::string manifest;
+    for (int i = 0; i < 12; i++)
+        manifest += i % 2 ? "fib.asm fib.in fib.out\n" : "a-plus-b.asm a-plus-b.in a-plus-b.out\n";
+    __write_file(FIXTURES "batch-order.txt", manifest.c_str());
+
+    std::string reference;
+    EXPECT_TRUE(__run_batch(FIXTURES "batch-order.txt", 1, &reference));
+    for (uint32_t jobs : {2u, 5u, 12u}) {
+        std::string report;
+        EXPECT_TRUE(__run_batch(FIXTURES "batch-order.txt", jobs, &report));
+        for (uint32_t n = 1; n <= 12; n++) {
+            std::string line = __job_line(report, n);
+            EXPECT_TRUE(__contains(line, n % 2 ? "a-plus-b.asm" : "fib.asm")) << jobs << " workers: " << line;
+            EXPECT_TRUE(__contains(line, "PASS")) << jobs << " workers: " << line;
+        }
+    }
+}
+
+/* a job stops on its own budget or timeout, the others run to their end */
+TEST(BatchTest, BudgetAndTimeout) {
+    __write_file(FIXTURES "spin.asm",
+                 ".text\n"
+                 "main:\n"
+                 "    addi $t0, $zero, 1\n"
+                 "loop:\n"
+                 "    addi $t1, $t1, 1\n"
+                 "    j loop\n");
+    __write_file(FIXTURES "batch-limits.txt",
+                 "spin.asm - - 1000\n"
+                 "spin.asm - - 0 50\n"
+                 "a-plus-b.asm a-plus-b.in a-plus-b.out 100000\n");
+
+    std::string report;
+    EXPECT_FALSE(__run_batch(FIXTURES "batch-limits.txt", 2, &report));
+    EXPECT_TRUE(__contains(__job_line(report, 1), "budget exceeded at 0x00400008, 1000 instructions")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 2), "timed out at 0x0040000")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 3), "exited (0), 11 instructions")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 3), "PASS")) << report;
+}
+
+/* an error ends its own job, not the batch; any exit status of the guest passes */
+TEST(BatchTest, ErrorsStayInTheirJob) {
+    __write_file(FIXTURES "bad.asm", ".text\nnonsense instruction here\n");
+    __write_file(FIXTURES "exit-7.asm",
+                 ".text\n"
+                 "main:\n"
+                 "    addi $a0, $zero, 7\n"
+                 "    addi $v0, $zero, 17\n"
+                 "    syscall\n");
+    __write_file(FIXTURES "batch-errors.txt",
+                 "bad.asm - -\n"
+                 "exit-7.asm - -\n"
+                 "a-plus-b.asm a-plus-b.in a-plus-b.out\n");
+
+    std::string report;
+    EXPECT_FALSE(__run_batch(FIXTURES "batch-errors.txt", 2, &report));
+    EXPECT_TRUE(__contains(__job_line(report, 1), "error")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 2), "exited (7)")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 3), "PASS")) << report;
+    EXPECT_TRUE(__contains(report, "[BATCH]\t2 of 3 jobs passed")) << report;
+}
+
+/* every job appends to its own copy of the preloaded file, and its files are
+ * checked against --vfs_expect or the directory of its manifest line */
+TEST(BatchTest, VfsFiles) {
+    mkdir(FIXTURES "batch-vfs", 0755);
+    __write_file(FIXTURES "batch-vfs/log.txt", "base\n");
+    mkdir(FIXTURES "batch-vfs-expect", 0755);
+    __write_file(FIXTURES "batch-vfs-expect/log.txt", "base\nx\n");
+    mkdir(FIXTURES "batch-vfs-wrong", 0755);
+    __write_file(FIXTURES "batch-vfs-wrong/log.txt", "base\n");
+    __write_file(FIXTURES "batch-vfs-wrong/out.txt", "x\n");
+    // open("log.txt", O_WRONLY | O_APPEND), write "x\n"
+    __write_file(FIXTURES "vfs-append.asm",
+                 ".data\n"
+                 "TEXT: .asciiz \"x\\n\"\n"
+                 "PATH: .asciiz \"log.txt\"\n"
+                 ".text\n"
+                 "main:\n"
+                 "    lui $a0, 80\n"
+                 "    ori $a0, $a0, 4\n"
+                 "    addi $a1, $zero, 1025\n"
+                 "    addi $v0, $zero, 13\n"
+                 "    syscall\n"
+                 "    lui $a1, 80\n"
+                 "    addi $a2, $zero, 2\n"
+                 "    addi $v0, $zero, 15\n"
+                 "    syscall\n");
+    std::string manifest;
+    for (int i = 0; i < 8; i++)
+        manifest += "vfs-append.asm - -\n";
+    manifest += "vfs-append.asm - - 0 0 batch-vfs-wrong\n"
+                "a-plus-b.asm a-plus-b.in a-plus-b.out 0 0 batch-vfs\n";
+    __write_file(FIXTURES "batch-vfs.txt", manifest.c_str());
+
+    Options options;
+    options_init(&options);
+    options.jobs = 4;
+    options.vfs = (char *) FIXTURES "batch-vfs";
+    options.vfs_expect = (char *) FIXTURES "batch-vfs-expect";
+    std::string report;
+    EXPECT_FALSE(__run_batch(FIXTURES "batch-vfs.txt", &options, &report));
+    for (uint32_t n = 1; n <= 8; n++)
+        EXPECT_TRUE(__contains(__job_line(report, n), "PASS")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 9), "FAIL")) << report;
+    EXPECT_TRUE(__contains(report, "\tfile log.txt: differs\n\tfile out.txt: missing\n")) << report;
+    EXPECT_TRUE(__contains(__job_line(report, 10), "PASS")) << report;
+    EXPECT_TRUE(__contains(report, "[BATCH]\t9 of 10 jobs passed")) << report;
+
+    // expected files of a job need the files of --vfs
+    options_init(&options);
+    EXPECT_EXIT(__run_batch(FIXTURES "batch-vfs.txt", &options, &report),
+                ::testing::ExitedWithCode(255), "Manifest line 9: expected files need --vfs");
+}
+
+TEST(BatchTest, MalformedManifest) {
+    __write_file(FIXTURES "batch-malformed.txt",
+                 "a-plus-b.asm a-plus-b.in a-plus-b.out\n"
+                 "a-plus-b.asm\n");
+
+    std::string report;
+    EXPECT_EXIT(__run_batch(FIXTURES "batch-malformed.txt", 1, &report),
+                ::testing::ExitedWithCode(255), "Manifest line 2");
+    EXPECT_EXIT(__run_batch(FIXTURES "no-such-manifest.txt", 1, &report),
+                ::testing::ExitedWithCode(255), "Failed to read manifest");
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
+    return RUN_ALL_TESTS();
+}
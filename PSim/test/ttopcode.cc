@@ -0,0 +1,118 @@
+/**
+ * @filename: ttopcode.cc
+ * @author: Vito Wu <chenhaowu[at]link.cuhk.edu.cn>
+ * @version:
+ * @desc: descriptor table: lookup by mnemonic and by encoding agree
+ * @date: 4/2/2021
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <set>
+
+#include "opcode.h"
+#include "utils.hh"
+
+static const char *mnemonics[] = {
+        "add", "addu", "addi", "addiu", "and", "andi", "clo", "clz", "div", "divu", "mult", "multu",
+        "madd", "msub", "maddu", "msubu", "nor", "or", "ori", "sll", "sllv", "sra", "srav", "srl",
+        "srlv", "sub", "subu", "xor", "xori", "lui", "slt", "sltu", "slti", "sltiu", "beq", "bgez",
+        "bgezal", "bgtz", "blez", "bltzal", "bltz", "bne", "j", "jal", "jalr", "jr", "teq", "teqi",
+        "tne", "tnei", "tge", "tgeu", "tgei", "tgeiu", "tlt", "tltu", "tlti", "tltiu", "lb", "lbu",
+        "lh", "lhu", "lw", "lwl", "lwr", "ll", "sb", "sh", "sw", "swl", "swr", "sc", "mfhi", "mflo",
+        "mthi", "mtlo", "syscall",
+        "nop", "move", "not", "neg", "b", "beqz", "bnez",
+};
+
+#define ISA_INSTRUCTIONS 77                 // the descriptors above that are no pseudo-instruction
+
+static const OpcodeDesc *__lookup(const char *mnemonic) {
+    return isa_lookup(mnemonic, (uint32_t) strlen(mnemonic), hash(mnemonic));
+}
+
+/* the fixed bits of a descriptor, every register and immediate 0 */
+static uint32_t __encode(const OpcodeDesc *desc) {
+    uint32_t word = (uint32_t) desc->opcode << 26;
+    if (desc->format == ISA_R)
+        word |= desc->funct;
+    else if (desc->format == ISA_REGIMM)
+        word |= (uint32_t) desc->funct << 16;
+    return word;
+}
+
+/* the bits of the operands, which take no part in decoding */
+static uint32_t __operand_bits(const OpcodeDesc *desc) {
+    switch (desc->format) {
+        case ISA_R:
+            return 0x03FFFFC0;              // rs, rt, rd, shamt
+        case ISA_REGIMM:
+            return 0x03E0FFFF;              // rs, imm
+        default:
+            return 0x03FFFFFF;              // rs, rt, imm or the target
+    }
+}
+
+/* every mnemonic finds its descriptor, and every instruction decodes back to it */
+TEST(OpcodeTest, LookupDecodeRoundTrip) {
+    for (const char *mnemonic : mnemonics) {
+        const OpcodeDesc *desc = __lookup(mnemonic);
+        ASSERT_NE(nullptr, desc) << mnemonic;
+        EXPECT_STREQ(mnemonic, desc->mnemonic);
+        if (desc->pseudo)
+            continue;
+
+        EXPECT_EQ(desc, isa_decode(__encode(desc))) << mnemonic;
+        EXPECT_EQ(desc, isa_decode(__encode(desc) | __operand_bits(desc))) << mnemonic;
+
+        char buf[64];
+        EXPECT_TRUE(isa_disassemble(__encode(desc), 0x400000, buf, sizeof(buf))) << mnemonic;
+        EXPECT_EQ(0, strncmp(buf, mnemonic, strlen(mnemonic))) << buf;
+    }
+}
+
+/* every word that decodes at all decodes to a descriptor of its own fixed bits,
+ * one of the instructions the mnemonics find */
+TEST(OpcodeTest, DecodeSweep) {
+    std::set<const OpcodeDesc *> decoded;
+    for (uint32_t opcode = 0; opcode < 64; opcode++) {
+        for (uint32_t low = 0; low < 64; low++) {
+            for (uint32_t rt = 0; rt < 32; rt++) {
+                uint32_t word = opcode << 26 | rt << 16 | low;
+                const OpcodeDesc *desc = isa_decode(word);
+                if (!desc)
+                    continue;
+
+                EXPECT_FALSE(desc->pseudo) << desc->mnemonic;
+                EXPECT_EQ(opcode, desc->opcode) << desc->mnemonic;
+                if (desc->format == ISA_R) {
+                    EXPECT_EQ(low, desc->funct) << desc->mnemonic;
+                } else if (desc->format == ISA_REGIMM) {
+                    EXPECT_EQ(rt, desc->funct) << desc->mnemonic;
+                }
+                EXPECT_EQ(desc, __lookup(desc->mnemonic)) << desc->mnemonic;
+                decoded.insert(desc);
+            }
+        }
+    }
+    EXPECT_EQ((size_t) ISA_INSTRUCTIONS, decoded.size());
+
+    char buf[64];
+    EXPECT_FALSE(isa_disassemble(0xFC000000, 0x400000, buf, sizeof(buf)));
+    EXPECT_STREQ(".word 0xFC000000", buf);
+}
+
+/* names that are no instruction, some a prefix or an extension of one */
+TEST(OpcodeTest, UnknownMnemonics) {
+    for (const char *mnemonic : {"", "ad", "adds", "addiuu", "jalrx", "syscal", "ADD", "frobnicate", "b2", "la"}) {
+        EXPECT_EQ(nullptr, __lookup(mnemonic)) << mnemonic;
+    }
+    // the name need not end with '\0'
+    const char *line = "addi $t0";
+    EXPECT_STREQ("add", isa_lookup(line, 3, hash("add"))->mnemonic);
+    EXPECT_STREQ("addi", isa_lookup(line, 4, hash("addi"))->mnemonic);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
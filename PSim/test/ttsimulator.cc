@@ -3,10 +3,623 @@
 //
 
 #include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
+#include <limits.h>
+#include <thread>
 
 #include "psim.hh"
 
+#define FIXTURES "testfiles/ttsimulator/"
+
+static const char *fixtures[] = {"a-plus-b", "fib", "memcpy-hello-world"};
+
+static std::string __read_file(const std::string &path) {
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/* parse args as the command line of the simulator */
+static void __simulator_init(Simulator *simulator, std::vector<std::string> args) {
+    std::vector<char *> argv;
+    argv.push_back((char *) "simulator");
+    for (std::string &arg : args)
+        argv.push_back((char *) arg.c_str());
+    argv.push_back(NULL);
+
+    optind = 0;                             // every test parses a command line of its own
+    simulator_init(simulator, (int) argv.size() - 1, argv.data());
+}
+
+/* write a program next to the fixtures, for the tests that need one of their own */
+static std::string __write_program(const std::string &name, const char *source) {
+    std::string path = name + ".asm";
+    std::ofstream file(path);
+    file << source;
+    return path;
+}
+
+/* assemble and run a program with the limits of its command line, the print syscalls go to output */
+static void __run_program(const std::string &path, std::vector<std::string> args,
+                          std::string *output, RunResult *result) {
+    args.insert(args.begin(), {"--full_flow", "--ELF", path});
+    Simulator simulator{};
+    __simulator_init(&simulator, args);
+    assembler_exec(&simulator.assembler);
+    simulator.output = output;
+    if (simulator.user_options.max_instructions || simulator.user_options.timeout_ms)
+        simulator_limit(&simulator, simulator.user_options.max_instructions, simulator.user_options.timeout_ms);
+    simulator_try_run(&simulator, result);
+    simulator_release(&simulator);
+    simulator_free(&simulator);
+}
+
+/* what main does, for the exit status of a run */
+static void __simulator_main(const std::string &path, std::vector<std::string> args) {
+    args.insert(args.begin(), {"--full_flow", "--ELF", path});
+    Simulator simulator{};
+    __simulator_init(&simulator, args);
+    simulator_exec(&simulator);
+    simulator_free(&simulator);
+    exit(0);
+}
+
+static void __run_fixture(const std::string &name, std::vector<std::string> args,
+                          std::string *output, RunResult *result, bool with_input = true) {
+    if (with_input)
+        args.insert(args.begin(), {"--input_file", FIXTURES + name + ".in"});
+    __run_program(FIXTURES + name + ".asm", args, output, result);
+}
+
+static const std::vector<std::vector<std::string>> engines = {
+        {"--engine", "predecode"},
+        {"--engine", "threaded"},
+        {"--engine", "block"},
+        {"--engine", "jit", "--jit_threshold", "1"},
+        {"--guard_pages"},
+};
+
+/* every engine prints the same and retires as many instructions as predecode,
+ * which only a limited run counts */
+TEST(EngineTest, EnginesAgree) {
+    for (const char *name : fixtures) {
+        std::string expected = __read_file(FIXTURES + std::string(name) + ".out");
+        RunResult reference;
+        for (size_t i = 0; i < engines.size(); i++) {
+            std::vector<std::string> args = engines[i];
+            args.insert(args.end(), {"--max_instructions", "100000000"});
+            std::string output;
+            RunResult result;
+            __run_fixture(name, args, &output, &result);
+
+            EXPECT_EQ(RUN_EXITED, result.status) << name << " " << engines[i].back() << ": " << result.message;
+            EXPECT_EQ(expected, output) << name << " " << engines[i].back();
+            if (i == 0)
+                reference = result;
+            EXPECT_NE(0u, result.retired) << name << " " << engines[i].back();
+            EXPECT_EQ(reference.retired, result.retired) << name << " " << engines[i].back();
+            EXPECT_EQ(reference.exit_code, result.exit_code) << name << " " << engines[i].back();
+        }
+    }
+}
+
+/* a trap, here in translated code with the jit, unwinds to simulator_try_run */
+TEST(TrapTest, TrapIsReturned) {
+    std::string path = __write_program("divide-by-zero",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    addi $t0, $zero, 100\n"
+                                       "    addi $t1, $zero, 3\n"
+                                       "loop:\n"
+                                       "    div $t0, $t1\n"
+                                       "    addi $t1, $t1, -1\n"
+                                       "    j loop\n");
+    for (const std::vector<std::string> &engine : engines) {
+        std::string output;
+        RunResult result;
+        __run_program(path, engine, &output, &result);
+
+        EXPECT_EQ(RUN_TRAPPED, result.status) << engine.back();
+        EXPECT_EQ(SIM_TRAP_DIVIDE, result.trap) << engine.back();
+        EXPECT_EQ(0x400008u, result.pc) << engine.back();
+        EXPECT_EQ(NULL, exit_trap) << engine.back();
+    }
+}
+
+/* the exit syscall ends the run, not the process */
+TEST(TrapTest, ExitIsReturned) {
+    std::string path = __write_program("exit-7",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    addi $a0, $zero, 7\n"
+                                       "    addi $v0, $zero, 17\n"
+                                       "    syscall\n");
+    for (const std::vector<std::string> &engine : engines) {
+        std::string output;
+        RunResult result;
+        __run_program(path, engine, &output, &result);
+
+        EXPECT_EQ(RUN_EXITED, result.status) << engine.back();
+        EXPECT_EQ(7, result.exit_code) << engine.back();
+    }
+}
+
+/* with --guard_pages an access out of range ends the run with an error */
+TEST(GuardTest, FaultExitStatus) {
+    std::string path = __write_program("out-of-range",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    lui $t0, 0x9000\n"
+                                       "    lw $t1, 0($t0)\n");
+    EXPECT_EXIT(__simulator_main(path, {"--guard_pages"}), ::testing::ExitedWithCode(255),
+                "address out of range");
+
+    std::string output;
+    RunResult result;
+    __run_program(path, {"--guard_pages"}, &output, &result);
+    EXPECT_EQ(RUN_TRAPPED, result.status);
+    EXPECT_EQ(SIM_TRAP_FAULT, result.trap);
+    EXPECT_EQ(0x400004u, result.pc);
+}
+
+/* a run stopped by its budget or its timeout exits with a status of its own */
+TEST(LimitTest, ExitStatus) {
+    std::string path = __write_program("spin",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    addi $t0, $zero, 1\n"
+                                       "loop:\n"
+                                       "    addi $t1, $t1, 1\n"
+                                       "    j loop\n");
+    for (const std::vector<std::string> &engine : engines) {
+        std::vector<std::string> args = engine;
+        args.insert(args.end(), {"--max_instructions", "1000"});
+        EXPECT_EXIT(__simulator_main(path, args), ::testing::ExitedWithCode(SIM_EXIT_BUDGET),
+                    "Instruction budget exceeded: 1000 instructions retired, stopped at pc 0x00400008")
+                            << engine.back();
+
+        std::string output;
+        RunResult result;
+        __run_program(path, args, &output, &result);
+        EXPECT_EQ(RUN_BUDGET, result.status) << engine.back();
+        EXPECT_EQ(1000u, result.retired) << engine.back();
+        EXPECT_EQ(0x400008u, result.pc) << engine.back();
+    }
+
+    EXPECT_EXIT(__simulator_main(path, {"--timeout", "50"}), ::testing::ExitedWithCode(SIM_EXIT_TIMEOUT),
+                "Timed out: [0-9]+ instructions retired");
+
+    std::string output;
+    RunResult result;
+    __run_program(path, {"--timeout", "50"}, &output, &result);
+    EXPECT_EQ(RUN_TIMEOUT, result.status);
+}
+
+/* the limit is checked once per run of sequential instructions, yet every
+ * budget stops where predecode does, also in a block whose text the run
+ * rewrote, and a trap counts up to its instruction */
+TEST(LimitTest, RunBoundaries) {
+    // the store turns the word at 0x400024 into j 0x400034
+    std::string path = __write_program("rewrite-and-divide",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    addi $s0, $zero, 4\n"
+                                       "    lui $t1, 64\n"
+                                       "    ori $t1, $t1, 36\n"
+                                       "    lui $t3, 0x0810\n"
+                                       "    ori $t3, $t3, 13\n"
+                                       "    addi $t2, $t2, 1\n"
+                                       "    sw $t3, 0($t1)\n"
+                                       "    addi $t4, $t4, 1\n"
+                                       "    addi $t4, $t4, 1\n"
+                                       "    addi $s0, $s0, -1\n"
+                                       "    bne $s0, $zero, main\n"
+                                       "    addi $t0, $zero, 1\n"
+                                       "    addi $t0, $zero, 2\n"
+                                       "    addi $t6, $zero, 0\n"
+                                       "    div $t0, $t6\n");
+    for (uint32_t budget = 1; budget <= 13; budget++) {
+        RunResult reference;
+        for (size_t i = 0; i < engines.size(); i++) {
+            std::vector<std::string> args = engines[i];
+            args.insert(args.end(), {"--max_instructions", std::to_string(budget)});
+            std::string output;
+            RunResult result;
+            __run_program(path, args, &output, &result);
+            if (i == 0)
+                reference = result;
+            EXPECT_EQ(reference.status, result.status) << budget << " " << engines[i].back();
+            EXPECT_EQ(reference.pc, result.pc) << budget << " " << engines[i].back();
+            EXPECT_EQ(reference.retired, result.retired) << budget << " " << engines[i].back();
+        }
+        if (budget == 10) {
+            EXPECT_EQ(RUN_BUDGET, reference.status);
+            EXPECT_EQ(0x400034u, reference.pc);
+        }
+        if (budget == 13) {
+            EXPECT_EQ(RUN_TRAPPED, reference.status);
+            EXPECT_EQ(0x400038u, reference.pc);
+            EXPECT_EQ(12u, reference.retired);
+        }
+    }
+}
+
+static void __host_fault_handler(int, siginfo_t *, void *) {
+    _exit(42);
+}
+
+static void __set_host_handler() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = __host_fault_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+}
+
+static bool __host_handler_installed() {
+    struct sigaction sa;
+    sigaction(SIGSEGV, NULL, &sa);
+    return (sa.sa_flags & SA_SIGINFO) && sa.sa_sigaction == __host_fault_handler;
+}
+
+/* a fault that is not the guest's goes to the handler of the host, which a
+ * guarded run gives back when it is released */
+static void __host_fault_during_guarded_run() {
+    __set_host_handler();
+    std::string path = __write_program("spin",
+                                       ".text\n"
+                                       "main:\n"
+                                       "loop:\n"
+                                       "    j loop\n");
+    std::thread run([&path]() {
+        std::string output;
+        RunResult result;
+        __run_program(path, {"--guard_pages", "--timeout", "5000"}, &output, &result);
+    });
+    while (__host_handler_installed())
+        std::this_thread::yield();
+    raise(SIGSEGV);
+    run.join();
+}
+
+TEST(GuardTest, HostHandler) {
+    struct sigaction previous;
+    sigaction(SIGSEGV, NULL, &previous);
+    __set_host_handler();
+
+    std::string output;
+    RunResult result;
+    __run_program(FIXTURES "a-plus-b.asm", {"--guard_pages", "--input_file", FIXTURES "a-plus-b.in"},
+                  &output, &result);
+    EXPECT_EQ(RUN_EXITED, result.status);
+    EXPECT_TRUE(__host_handler_installed());
+    sigaction(SIGSEGV, &previous, NULL);
+
+    EXPECT_EXIT(__host_fault_during_guarded_run(), ::testing::ExitedWithCode(42), "");
+}
+
+/* every child of the fork server exits with the status of its run */
+TEST(ForkServerTest, ChildrenExit) {
+    std::ofstream("no-inputs.txt") << "-\n-\n";
+    EXPECT_EXIT(__simulator_main(FIXTURES "memcpy-hello-world.asm", {"--fork_server", "no-inputs.txt"}),
+                ::testing::ExitedWithCode(0), "");
+
+    std::string path = __write_program("exit-7",
+                                       ".text\n"
+                                       "main:\n"
+                                       "    addi $a0, $zero, 7\n"
+                                       "    addi $v0, $zero, 17\n"
+                                       "    syscall\n");
+    EXPECT_EXIT(__simulator_main(path, {"--fork_server", "no-inputs.txt"}),
+                ::testing::ExitedWithCode(1), "");
+}
+
+static void __write_file(const std::string &path, const std::string &content) {
+    std::ofstream(path, std::ios::binary) << content;
+}
+
+/* the files of the vfs tests: a preloaded directory and the expected one */
+static void __vfs_fixtures() {
+    mkdir(FIXTURES "vfs-in", 0755);
+    mkdir(FIXTURES "vfs-in/sub", 0755);
+    __write_file(FIXTURES "vfs-in/in.txt", "base\n");
+    __write_file(FIXTURES "vfs-in/sub/deep.txt", "deep");
+    mkdir(FIXTURES "vfs-expect", 0755);
+    __write_file(FIXTURES "vfs-expect/in.txt", "base\n");
+    __write_file(FIXTURES "vfs-expect/out.txt", "x\n");
+}
+
+/* everything a guest path holds, read through a descriptor of its own */
+static std::string __vfs_content(Vfs *vfs, const char *path) {
+    int32_t fd = vfs_open(vfs, path, O_RDONLY);
+    if (fd < 0)
+        return "<none>";
+    std::string content;
+    char buf[64];
+    int32_t n;
+    while ((n = vfs_read(vfs, fd, buf, sizeof(buf))) > 0)
+        content.append(buf, n);
+    vfs_close(vfs, fd);
+    return content;
+}
+
+/* a directory or a manifest preloads the files, looked up by guest path */
+TEST(VfsTest, Preload) {
+    __vfs_fixtures();
+    VfsImage image;
+    vfs_image_load(&image, FIXTURES "vfs-in");
+    EXPECT_EQ(2u, image.files.size());
+    EXPECT_EQ("deep", image.files["sub/deep.txt"]);
+
+    Vfs vfs;
+    vfs_init(&vfs, &image);
+    char buf[16];
+    int32_t fd = vfs_open(&vfs, "./in.txt", O_RDONLY);
+    EXPECT_EQ(VFS_FD_BASE, fd);
+    EXPECT_EQ(5, vfs_read(&vfs, fd, buf, sizeof(buf)));
+    EXPECT_EQ("base\n", std::string(buf, 5));
+    EXPECT_EQ(0, vfs_read(&vfs, fd, buf, sizeof(buf)));
+    EXPECT_EQ(-1, vfs_write(&vfs, fd, "x", 1));
+    EXPECT_EQ(VFS_FD_BASE + 1, vfs_open(&vfs, "sub/deep.txt", O_RDONLY));
+    EXPECT_EQ(-1, vfs_open(&vfs, "no-such-file.txt", O_RDONLY));
+    EXPECT_EQ(0, vfs_close(&vfs, fd));
+    EXPECT_EQ(-1, vfs_close(&vfs, fd));
+    EXPECT_EQ(fd, vfs_open(&vfs, "no-such-file.txt", O_WRONLY | O_CREAT));
+    EXPECT_EQ("", __vfs_content(&vfs, "no-such-file.txt"));
+
+    __write_file(FIXTURES "vfs-manifest.txt", "# guest host\n./data/a.txt vfs-in/in.txt\n");
+    VfsImage listed;
+    vfs_image_load(&listed, FIXTURES "vfs-manifest.txt");
+    EXPECT_EQ(1u, listed.files.size());
+    EXPECT_EQ("base\n", listed.files["data/a.txt"]);
+}
+
+/* writes go to a copy of the preloaded file, O_TRUNC empties it and O_APPEND
+ * writes at its end */
+TEST(VfsTest, TruncAppend) {
+    VfsImage image;
+    image.files["log.txt"] = "0123456789";
+    Vfs vfs;
+    vfs_init(&vfs, &image);
+
+    int32_t fd = vfs_open(&vfs, "log.txt", O_WRONLY);
+    EXPECT_EQ(2, vfs_write(&vfs, fd, "ab", 2));
+    EXPECT_EQ("ab23456789", __vfs_content(&vfs, "log.txt"));
+    EXPECT_EQ("0123456789", image.files["log.txt"]);
+
+    int32_t appending = vfs_open(&vfs, "log.txt", O_WRONLY | O_APPEND);
+    EXPECT_EQ(1, vfs_write(&vfs, appending, "X", 1));
+    EXPECT_EQ(1, vfs_write(&vfs, fd, "c", 1));
+    EXPECT_EQ(1, vfs_write(&vfs, appending, "Y", 1));
+    EXPECT_EQ("abc3456789XY", __vfs_content(&vfs, "log.txt"));
+
+    vfs_close(&vfs, vfs_open(&vfs, "log.txt", O_RDONLY | O_TRUNC));
+    EXPECT_EQ("abc3456789XY", __vfs_content(&vfs, "log.txt"));
+    int32_t truncating = vfs_open(&vfs, "log.txt", O_WRONLY | O_TRUNC);
+    EXPECT_EQ("", __vfs_content(&vfs, "log.txt"));
+    EXPECT_EQ(1, vfs_write(&vfs, truncating, "t", 1));
+    EXPECT_EQ("t", __vfs_content(&vfs, "log.txt"));
+
+    vfs_reset(&vfs);
+    EXPECT_EQ("0123456789", __vfs_content(&vfs, "log.txt"));
+    EXPECT_EQ("0123456789", image.files["log.txt"]);
+}
+
+/* every expected file must be left by the run, preloaded or written, and
+ * every written file must be expected */
+TEST(VfsTest, CompareExpected) {
+    __vfs_fixtures();
+    VfsImage image;
+    vfs_image_load(&image, FIXTURES "vfs-in");
+    Vfs vfs;
+    std::string report;
+
+    vfs_init(&vfs, &image);
+    EXPECT_FALSE(vfs_compare(&vfs, FIXTURES "vfs-expect", &report));
+    EXPECT_EQ("out.txt: missing\n", report);
+
+    int32_t fd = vfs_open(&vfs, "out.txt", O_WRONLY | O_CREAT);
+    vfs_write(&vfs, fd, "y\n", 2);
+    report.clear();
+    EXPECT_FALSE(vfs_compare(&vfs, FIXTURES "vfs-expect", &report));
+    EXPECT_EQ("out.txt: differs\n", report);
+
+    vfs_close(&vfs, fd);
+    fd = vfs_open(&vfs, "out.txt", O_WRONLY | O_TRUNC);
+    vfs_write(&vfs, fd, "x\n", 2);
+    report.clear();
+    EXPECT_TRUE(vfs_compare(&vfs, FIXTURES "vfs-expect", &report));
+    EXPECT_EQ("", report);
+
+    vfs_close(&vfs, vfs_open(&vfs, "extra.txt", O_WRONLY | O_CREAT));
+    fd = vfs_open(&vfs, "in.txt", O_WRONLY | O_APPEND);
+    vfs_write(&vfs, fd, "more", 4);
+    EXPECT_FALSE(vfs_compare(&vfs, FIXTURES "vfs-expect", &report));
+    EXPECT_EQ("in.txt: differs\nextra.txt: not expected\n", report);
+
+    report.clear();
+    EXPECT_FALSE(vfs_compare(&vfs, FIXTURES "no-such-dir", &report));
+    EXPECT_EQ(FIXTURES "no-such-dir: cannot be read\n", report);
+}
+
+/* --vfs_expect of a run, which reports and does not change the exit status */
+TEST(VfsTest, GuestFiles) {
+    __vfs_fixtures();
+    std::string nothing = __write_program("vfs-nothing",
+                                          ".text\n"
+                                          "main:\n"
+                                          "    addi $v0, $zero, 10\n"
+                                          "    syscall\n");
+    EXPECT_EXIT(__simulator_main(nothing, {"--vfs", FIXTURES "vfs-in", "--vfs_expect", FIXTURES "vfs-expect"}),
+                ::testing::ExitedWithCode(0), "captured files differ .*\n.*out.txt: missing");
+
+    // open("out.txt", O_WRONLY | O_CREAT | O_TRUNC), write "x\n"
+    std::string writes = __write_program("vfs-write",
+                                         ".data\n"
+                                         "TEXT: .asciiz \"x\\n\"\n"
+                                         "PATH: .asciiz \"out.txt\"\n"
+                                         ".text\n"
+                                         "main:\n"
+                                         "    lui $a0, 80\n"
+                                         "    ori $a0, $a0, 4\n"
+                                         "    addi $a1, $zero, 577\n"
+                                         "    addi $v0, $zero, 13\n"
+                                         "    syscall\n"
+                                         "    lui $a1, 80\n"
+                                         "    addi $a2, $zero, 2\n"
+                                         "    addi $v0, $zero, 15\n"
+                                         "    syscall\n"
+                                         "    addi $v0, $zero, 10\n"
+                                         "    syscall\n");
+    EXPECT_EXIT(__simulator_main(writes, {"--vfs", FIXTURES "vfs-in", "--vfs_expect", FIXTURES "vfs-expect"}),
+                ::testing::ExitedWithCode(0), "captured files match");
+}
+
+/* heap instances keep the cpu context on a cache line of its own */
+TEST(SimulatorTest, HeapInstanceIsAligned) {
+    std::vector<Simulator *> simulators;
+    for (int i = 0; i < 8; i++) {
+        simulators.push_back(new Simulator());
+        EXPECT_EQ(0u, (uintptr_t) &simulators.back()->cpu % CPU_CACHE_LINE);
+    }
+    for (Simulator *simulator : simulators)
+        delete simulator;
+}
+
+/* options_init leaves nothing to what the memory held before */
+TEST(OptionsTest, InitClearsEveryOption) {
+    Options options;
+    memset(&options, 0xff, sizeof(options));
+    options_init(&options);
+
+    EXPECT_EQ(NULL, options.ASM);
+    EXPECT_EQ(NULL, options.input_file);
+    EXPECT_EQ(NULL, options.output_bin);
+    EXPECT_EQ(NULL, options.output_stdout);
+    EXPECT_FALSE(options.input_from_file);
+    EXPECT_FALSE(options.assembly_only);
+}
+
+/* a program that reads nothing runs without --input_file */
+TEST(OptionsTest, RunsWithoutInputFile) {
+    std::string output;
+    RunResult result;
+    __run_fixture("memcpy-hello-world", {}, &output, &result, false);
+
+    EXPECT_EQ(RUN_EXITED, result.status) << result.message;
+    EXPECT_EQ(__read_file(FIXTURES "memcpy-hello-world.out"), output);
+}
+
+/* every line of input, read the way the read syscalls take them */
+static std::vector<std::string> __input_lines(InputSource *input) {
+    std::vector<std::string> lines;
+    const char *line;
+    size_t n;
+    while (input_next_line(input, &line, &n))
+        lines.push_back(std::string(line, n));
+    return lines;
+}
+
+/* lines of a buffer, a mapped file and a pipe, whose window is refilled in
+ * the middle of lines and grows for a line longer than itself */
+TEST(InputTest, NextLine) {
+    InputSource input;
+    const char *buffer = "a\nbb\n\nlast";
+    input_open_buffer(&input, buffer, strlen(buffer));
+    EXPECT_EQ(std::vector<std::string>({"a", "bb", "", "last"}), __input_lines(&input));
+    input_open_buffer(&input, "x\n", 2);
+    EXPECT_EQ(std::vector<std::string>({"x"}), __input_lines(&input));
+
+    std::vector<std::string> expected;
+    std::string content;
+    for (uint32_t i = 0; i < 20000; i++)
+        expected.push_back(std::to_string(i * 7919));
+    expected.push_back(std::string(INPUT_CHUNK_SIZE * 2 + 5, 'x'));
+    expected.push_back("no newline");
+    for (size_t i = 0; i < expected.size(); i++)
+        content += expected[i] + (i + 1 < expected.size() ? "\n" : "");
+
+    std::ofstream(FIXTURES "input-lines.txt") << content;
+    ASSERT_TRUE(input_open(&input, FIXTURES "input-lines.txt"));
+    EXPECT_EQ(expected, __input_lines(&input));
+
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    ASSERT_TRUE(input_open(&input, ("/dev/fd/" + std::to_string(fds[0])).c_str()));
+    close(fds[0]);
+    EXPECT_EQ(0u, input.mapped);
+    std::thread writer([&content, fds]() {
+        // odd sizes, so that reads end in the middle of lines
+        for (size_t at = 0; at < content.size(); at += 1009)
+            EXPECT_GT(write(fds[1], content.data() + at, std::min((size_t) 1009, content.size() - at)), 0);
+        close(fds[1]);
+    });
+    EXPECT_EQ(expected, __input_lines(&input));
+    writer.join();
+    input_close(&input);
+}
+
+static bool __parse_int(const char *s, int32_t *value) {
+    return input_parse_int(s, strlen(s), value);
+}
+
+/* hexadecimal only as a whole line, otherwise the decimal prefix as std::stoi
+ * reads it; a number out of range is an error, not an exception */
+TEST(InputTest, ParseInt) {
+    const struct {
+        const char *text;
+        int32_t value;
+    } valid[] = {
+            {"0x1F", 31}, {"0XfF", 255}, {"0x7FFFFFFF", INT_MAX},
+            {"0x1g", 0}, {"0x", 0}, {"0x 1", 0},
+            {"  42", 42}, {"\t-7", -7}, {"+7", 7}, {"12abc", 12}, {" +0x10", 0},
+            {"2147483647", INT_MAX}, {"-2147483648", INT_MIN}, {"-0", 0},
+    };
+    for (auto number: valid) {
+        int32_t value = -1;
+        EXPECT_TRUE(__parse_int(number.text, &value)) << number.text;
+        EXPECT_EQ(number.value, value) << number.text;
+    }
+    for (const char *text : {"", " ", "-", "+", "abc", "- 1", "0x80000000", "0xFFFFFFFFFFFFFFFF1",
+                             "2147483648", "-2147483649", "99999999999999999999999"}) {
+        int32_t value = 0;
+        EXPECT_FALSE(__parse_int(text, &value)) << text;
+    }
+}
+
+/* strtod and strtof over lines that are not terminated, shorter or longer
+ * than the copy on the stack */
+TEST(InputTest, ParseReal) {
+    double d = 0;
+    EXPECT_TRUE(input_parse_double("1.5\n2", 3, &d));
+    EXPECT_EQ(1.5, d);
+    EXPECT_TRUE(input_parse_double("  -2.5e3x", 9, &d));
+    EXPECT_EQ(-2500.0, d);
+    std::string long_line = "0." + std::string(100, '0') + "1";
+    EXPECT_TRUE(input_parse_double(long_line.data(), long_line.size(), &d));
+    EXPECT_DOUBLE_EQ(1e-101, d);
+    EXPECT_FALSE(input_parse_double("1e400", 5, &d));
+    EXPECT_FALSE(input_parse_double("abc", 3, &d));
+    EXPECT_FALSE(input_parse_double("", 0, &d));
+
+    float f = 0;
+    EXPECT_TRUE(input_parse_float("0.25", 4, &f));
+    EXPECT_EQ(0.25f, f);
+    EXPECT_FALSE(input_parse_float("1e40", 4, &f));
+    EXPECT_FALSE(input_parse_float("-", 1, &f));
+}
+
 int main(int argc, char **argv) {
     testing::InitGoogleTest(&argc, argv);
+    testing::FLAGS_gtest_death_test_style = "threadsafe";
     return RUN_ALL_TESTS();
 }